@@ -1,28 +1,168 @@
 // Copyright (c) 2012-2018 Dano Pernis
 // See LICENSE for details
 
+#include "hcc/assembler/symbol_map.h"
+#include "hcc/cpu/bus.h"
 #include "hcc/cpu/cpu.h"
-#include <cassert>
+#include "hcc/cpu/debugger.h"
+#include "hcc/cpu/hypercall.h"
+#include "hcc/cpu/input_log.h"
+#include "hcc/cpu/interpreter.h"
+#include "hcc/cpu/loader.h"
+#include "hcc/cpu/pacer.h"
+#include "hcc/cpu/screen.h"
+#include "hcc/util/triple_buffer.h"
+#include <boost/algorithm/string/join.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
 #include <gtkmm.h>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <thread>
 
 namespace {
 
-const unsigned int SCREEN_WIDTH = 512;
-const unsigned int SCREEN_HEIGHT = 256;
+using hcc::cpu::SCREEN_HEIGHT;
+using hcc::cpu::SCREEN_WIDTH;
+
+// selectable clock frequencies in Hz, zero means unthrottled
+const std::uint64_t FREQUENCIES[] = {
+    1000000, 2000000, 5000000, 10000000, 20000000, 50000000, 100000000, 0,
+};
+const int DEFAULT_FREQUENCY = 3;
+
+// how often the CPU thread publishes the screen, if it changed
+const auto FRAME_INTERVAL = std::chrono::microseconds(1000000 / 60);
+
+// how often the CPU thread checks whether the program is stuck in a loop
+const std::uint64_t LOOP_CHECK_TICKS = 1 << 20;
+
+using frame_buffer = hcc::util::triple_buffer<hcc::cpu::screen_frame>;
+
+hcc::cpu::word parse_address(const std::string& text)
+{
+    std::size_t end = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(text, &end, 0);
+    } catch (const std::logic_error&) {
+        end = 0;
+    }
+    if (end == 0 || end != text.size() || value > 0xffff) {
+        throw std::runtime_error("Invalid address: " + text);
+    }
+    return value;
+}
+
+struct command_line_options {
+    command_line_options(int argc, char* argv[])
+    {
+        opterr = 0;
+        int opt = -1;
+        while ((opt = getopt(argc, argv, ":hK:k:x:b:w:a:")) != -1) {
+            switch (opt) {
+            case 'h':
+                help = true;
+                break;
+            case 'K':
+                record_file = optarg;
+                break;
+            case 'k':
+                replay_file = optarg;
+                break;
+            case 'x':
+                symbol_file = optarg;
+                break;
+            case 'b':
+                breakpoints.push_back(parse_address(optarg));
+                break;
+            case 'w':
+                watchpoints.emplace_back(parse_address(optarg), hcc::cpu::debugger::write);
+                break;
+            case 'a':
+                watchpoints.emplace_back(parse_address(optarg),
+                                         hcc::cpu::debugger::read | hcc::cpu::debugger::write);
+                break;
+            case '?':
+                throw std::runtime_error(std::string("Unknown command line option: ")
+                                         + static_cast<char>(optopt));
+            case ':':
+                throw std::runtime_error(std::string("Missing argument for command line option: ")
+                                         + static_cast<char>(optopt));
+            }
+        }
+        if (argc - optind > 1) {
+            throw std::runtime_error("Expected at most one program");
+        }
+        if (optind < argc) {
+            program_file = argv[optind];
+        }
+        if (!record_file.empty() && !replay_file.empty()) {
+            throw std::runtime_error("Cannot record and replay keyboard at the same time");
+        }
+    }
+
+    void print_help() const
+    {
+        std::cout << "Usage: emulator [options] [program]\n"
+                     "Options:\n"
+                     "  -h                   Display this information\n"
+                     "  -K <file>            Record keyboard input into <file> on exit\n"
+                     "  -k <file>            Replay keyboard input from <file>, ignoring the\n"
+                     "                       user; see also hackrun -k\n"
+                     "  -x <symbols>         Execute stdlib functions found in symbol map written\n"
+                     "                       by hcc -g for [program] natively, until another\n"
+                     "                       program is loaded; see also hackrun -x\n"
+                     "  -b <address>         Pause before executing ROM <address>\n"
+                     "  -w <address>         Pause after writing into RAM <address>\n"
+                     "  -a <address>         Pause after reading or writing RAM <address>\n"
+                     "Programs run at full speed without breakpoints and watchpoints, and\n"
+                     "instruction by instruction with them; stdlib functions are then not\n"
+                     "executed natively\n";
+    }
+
+    bool help{false};
+    std::string record_file;
+    std::string replay_file;
+    std::string symbol_file;
+    std::vector<hcc::cpu::word> breakpoints;
+    std::vector<std::pair<hcc::cpu::word, unsigned int>> watchpoints;
+    std::string program_file;
+};
+
+// where the keyboard register comes from
+enum class keyboard_mode {
+    live,
+    record, // live, and every change is logged
+    replay, // from the log, at the ticks it was recorded at
+};
 
 struct screen_widget : Gtk::DrawingArea {
-    screen_widget(hcc::cpu::RAM& ram);
+    screen_widget(frame_buffer& frames);
+
+    /**
+     * Pick up the latest frame, render rows which changed and invalidate them.
+     */
+    void update();
 
     bool draw(const Cairo::RefPtr<Cairo::Context>& cr);
 
 private:
-    Glib::RefPtr<Gdk::Pixbuf> pixbuf;
-    hcc::cpu::RAM& ram;
+    void render(unsigned int y);
+
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+    frame_buffer& frames;
+    hcc::cpu::screen_frame shown;
+    bool stale = true;
 };
 
 struct emulator {
@@ -31,14 +171,36 @@ struct emulator {
     void load_clicked();
     void run_clicked();
     void pause_clicked();
+    void step_clicked();
+    void show_stop(const hcc::cpu::stop& s);
+    void speed_changed();
     bool keyboard_callback(GdkEventKey* event);
+    bool load(const std::string& filename);
+    std::uint64_t update_keyboard();
     void cpu_thread();
+    void publish_frame();
     void screen_thread();
     void setup_button(Gtk::ToolButton& button, const gchar* stock_id, const gchar* text);
 
     hcc::cpu::ROM rom;
     hcc::cpu::RAM ram;
     hcc::cpu::CPU cpu;
+    hcc::cpu::interpreter interpreter;
+
+    // devices above RAM, the console prints on the standard output
+    hcc::cpu::timer timer;
+    hcc::cpu::console console{std::cout};
+    hcc::cpu::bus io;
+
+    // native stdlib functions, if enabled before the first load
+    std::unique_ptr<hcc::cpu::hypercalls> calls;
+
+    // used instead of the interpreter if anything is set, changed only while paused
+    hcc::cpu::debugger debug;
+
+    // set before the first load, recorded log belongs to the CPU thread while running
+    keyboard_mode keys_mode = keyboard_mode::live;
+    hcc::cpu::input_log keys_log;
 
 private:
     std::thread thread_cpu;
@@ -46,6 +208,25 @@ private:
     std::mutex running_mutex;
     bool running = false;
 
+    // the CPU thread sleeps here while the program waits for a key
+    std::mutex idle_mutex;
+    std::condition_variable idle_condition;
+
+    // RAM belongs to the CPU thread while running, the screen is handed over
+    // to the UI as frames and the keyboard register comes back separately
+    hcc::cpu::screen_dirty dirty;
+    frame_buffer frames;
+    std::atomic<hcc::cpu::word> key{0};
+
+    // instructions executed since the program was loaded
+    std::uint64_t tick = 0;
+    std::unique_ptr<hcc::cpu::input_replay> replay;
+
+    // set by the UI, read by the CPU thread
+    std::atomic<std::uint64_t> frequency{FREQUENCIES[DEFAULT_FREQUENCY]};
+    // set by the CPU thread, read by the UI
+    std::atomic<double> achieved{0};
+
 public:
     void run()
     {
@@ -63,7 +244,11 @@ public:
         if (!running) {
             return;
         }
-        running = false;
+        {
+            std::lock_guard<std::mutex> idle_lock(idle_mutex);
+            running = false;
+        }
+        idle_condition.notify_all();
         thread_cpu.join();
         thread_screen.join();
     }
@@ -78,6 +263,14 @@ public:
     Gtk::ToolButton button_load;
     Gtk::ToolButton button_run;
     Gtk::ToolButton button_pause;
+    Gtk::ToolButton button_step;
+    Gtk::SeparatorToolItem separator_speed;
+    Gtk::ToolItem speed_item;
+    Gtk::ComboBoxText speed;
+    Gtk::ToolItem achieved_item;
+    Gtk::Label achieved_label;
+    Gtk::ToolItem status_item;
+    Gtk::Label status_label;
     screen_widget screen;
 };
 
@@ -139,80 +332,55 @@ uint16_t translate(guint keyval)
     return keyval;
 }
 
-bool load(const char* filename, hcc::cpu::ROM& rom)
+screen_widget::screen_widget(frame_buffer& frames_)
+    : surface(Cairo::ImageSurface::create(Cairo::FORMAT_RGB24, SCREEN_WIDTH, SCREEN_HEIGHT))
+    , frames(frames_)
 {
-    std::ifstream input(filename);
-    std::string line;
-    auto it = begin(rom);
-    while (input.good() && it != end(rom)) {
-        getline(input, line);
-        if (line.size() == 0) {
-            continue;
-        }
-        if (line.size() != 16) {
-            return false;
-        }
+    set_size_request(SCREEN_WIDTH, SCREEN_HEIGHT);
+    signal_draw().connect(sigc::mem_fun(this, &screen_widget::draw));
+}
 
-        auto& instruction = *it++;
-        for (unsigned int i = 0; i < 16; ++i) {
-            instruction <<= 1;
-            switch (line[i]) {
-            case '0':
-                break;
-            case '1':
-                instruction |= 1;
-                break;
-            default:
-                return false;
-            }
-        }
+void screen_widget::update()
+{
+    if (!frames.update() && !stale) {
+        return;
     }
 
-    // clear the rest
-    while (it != end(rom)) {
-        *it++ = 0;
+    // frames may have been skipped, so compare with what is shown
+    const auto& frame = frames.front();
+    const auto row_size = hcc::cpu::SCREEN_ROW_WORDS * sizeof(hcc::cpu::word);
+    surface->flush();
+    unsigned int first = 0;
+    for (unsigned int y = 0; y <= SCREEN_HEIGHT; ++y) {
+        const auto offset = y * hcc::cpu::SCREEN_ROW_WORDS;
+        const bool changed = y < SCREEN_HEIGHT
+                             && (stale || std::memcmp(&frame[offset], &shown[offset], row_size));
+        if (changed) {
+            std::memcpy(&shown[offset], &frame[offset], row_size);
+            render(y);
+            continue;
+        }
+        // invalidate runs of changed rows
+        if (first < y) {
+            surface->mark_dirty(0, first, SCREEN_WIDTH, y - first);
+            queue_draw_area(0, first, SCREEN_WIDTH, y - first);
+        }
+        first = y + 1;
     }
-
-    return true;
+    stale = false;
 }
 
-screen_widget::screen_widget(hcc::cpu::RAM& ram_)
-    : pixbuf(Gdk::Pixbuf::create(Gdk::Colorspace::COLORSPACE_RGB, false, 8, SCREEN_WIDTH,
-                                 SCREEN_HEIGHT))
-    , ram(ram_)
+void screen_widget::render(unsigned int y)
 {
-    set_size_request(SCREEN_WIDTH, SCREEN_HEIGHT);
-    signal_draw().connect(sigc::mem_fun(this, &screen_widget::draw));
+    const auto words = shown.data() + y * hcc::cpu::SCREEN_ROW_WORDS;
+    const auto pixels = surface->get_data() + y * surface->get_stride();
+    hcc::cpu::expand(words, hcc::cpu::SCREEN_ROW_WORDS, reinterpret_cast<uint32_t*>(pixels));
 }
 
 bool screen_widget::draw(const Cairo::RefPtr<Cairo::Context>& cr)
 {
-    const auto rowstride = pixbuf->get_rowstride();
-    auto first = begin(ram) + 0x4000;
-    auto last = begin(ram) + 0x6000;
-    guchar* row = pixbuf->get_pixels();
-    uint16_t value = 0;
-
-    for (unsigned int y = 0; y < SCREEN_HEIGHT; ++y) {
-        guchar* p = row;
-
-        for (unsigned int x = 0; x < SCREEN_WIDTH; ++x) {
-            if ((x % 16) == 0) {
-                assert(first != last);
-                value = *first++;
-            }
-
-            const auto color = (value & 1) ? 0x00 : 0xff;
-            value = value >> 1;
-
-            *p++ = color;
-            *p++ = color;
-            *p++ = color;
-        }
-        row += rowstride;
-    }
-
-    Gdk::Cairo::set_source_pixbuf(cr, pixbuf, 0, 0);
+    // clipped to the invalidated area
+    cr->set_source(surface, 0, 0);
     cr->paint();
     return false;
 }
@@ -222,18 +390,26 @@ emulator::emulator()
     , load_dialog(window, "Load ROM")
     , error_dialog(window, "Error loading program", false, Gtk::MessageType::MESSAGE_ERROR,
                    Gtk::ButtonsType::BUTTONS_CLOSE, true)
-    , screen(ram)
+    , screen(frames)
 {
+    /* devices */
+    io.map(hcc::cpu::TIMER, hcc::cpu::TIMER + 1, timer);
+    io.map(hcc::cpu::CONSOLE, hcc::cpu::CONSOLE, console);
+    interpreter.set_bus(&io);
+
     /* toolbar buttons */
     setup_button(button_load, "document-open", "Load...");
     setup_button(button_run, "media-playback-start", "Run");
     setup_button(button_pause, "media-playback-pause", "Pause");
+    setup_button(button_step, "go-next", "Step");
     button_load.signal_clicked().connect(sigc::mem_fun(this, &emulator::load_clicked));
     button_run.signal_clicked().connect(sigc::mem_fun(this, &emulator::run_clicked));
     button_pause.signal_clicked().connect(sigc::mem_fun(this, &emulator::pause_clicked));
+    button_step.signal_clicked().connect(sigc::mem_fun(this, &emulator::step_clicked));
 
     button_run.set_sensitive(false);
     button_pause.set_sensitive(false);
+    button_step.set_sensitive(false);
 
     /* toolbar itself */
     toolbar.set_hexpand(true);
@@ -242,6 +418,24 @@ emulator::emulator()
     toolbar.insert(separator, -1);
     toolbar.insert(button_run, -1);
     toolbar.insert(button_pause, -1);
+    toolbar.insert(button_step, -1);
+    toolbar.insert(separator_speed, -1);
+    toolbar.insert(speed_item, -1);
+    toolbar.insert(achieved_item, -1);
+    toolbar.insert(status_item, -1);
+
+    /* clock speed */
+    for (const auto f : FREQUENCIES) {
+        speed.append(f ? std::to_string(f / 1000000) + " MHz" : "Unthrottled");
+    }
+    speed.set_active(DEFAULT_FREQUENCY);
+    speed.set_tooltip_text("Clock speed");
+    speed.signal_changed().connect(sigc::mem_fun(this, &emulator::speed_changed));
+    speed_item.add(speed);
+    achieved_label.set_tooltip_text("Achieved clock speed");
+    achieved_item.add(achieved_label);
+    status_label.set_tooltip_text("Why the program was paused");
+    status_item.add(status_label);
 
     /* keyboard */
     keyboard.add_events(Gdk::EventMask::KEY_PRESS_MASK | Gdk::EventMask::KEY_RELEASE_MASK);
@@ -280,25 +474,52 @@ void emulator::load_clicked()
         return;
     }
 
-    auto filename = load_dialog.get_filename();
-    const bool loaded = load(filename.c_str(), rom);
-
-    if (!loaded) {
+    if (!load(load_dialog.get_filename())) {
         error_dialog.run();
         error_dialog.hide();
-        return;
     }
+}
 
+// Start over with cleared RAM, so that keyboard logs replay the same way.
+bool emulator::load(const std::string& filename)
+{
+    if (button_pause.get_sensitive()) {
+        pause_clicked();
+    }
+    if (!hcc::cpu::load(filename, rom)) {
+        return false;
+    }
+
+    interpreter.load(rom);
+    // a symbol map given by -x describes the program loaded with it only
+    interpreter.set_hook({}, nullptr);
+    calls.reset();
     cpu.reset();
+    ram.fill(0);
+    dirty.mark_all();
+    publish_frame();
+    screen.update();
+    tick = 0;
+    if (keys_mode == keyboard_mode::record) {
+        keys_log.events.clear();
+    }
+    if (keys_mode == keyboard_mode::replay) {
+        replay.reset(new hcc::cpu::input_replay{keys_log});
+    }
     button_run.set_sensitive(true);
+    button_step.set_sensitive(true);
+    status_label.set_text("");
+    return true;
 }
 
 void emulator::run_clicked()
 {
     run();
 
+    status_label.set_text("");
     button_run.set_sensitive(false);
     button_run.set_visible(false);
+    button_step.set_sensitive(false);
     button_pause.set_sensitive(true);
     button_pause.set_visible(true);
 }
@@ -306,45 +527,243 @@ void emulator::run_clicked()
 void emulator::pause_clicked()
 {
     pause();
+    screen.update();
 
     button_pause.set_sensitive(false);
     button_pause.set_visible(false);
     button_run.set_sensitive(true);
     button_run.set_visible(true);
+    button_step.set_sensitive(true);
+}
+
+// Execute one instruction while paused, stepping over a breakpoint.
+void emulator::step_clicked()
+{
+    update_keyboard();
+    auto s = debug.run(cpu, rom, ram, 1, &dirty, &io);
+    if (s.ticks == 0) {
+        s = debug.run(cpu, rom, ram, 1, &dirty, &io);
+    }
+    tick += s.ticks;
+    publish_frame();
+    screen.update();
+    if (s.reason == hcc::cpu::stop_reason::watchpoint) {
+        show_stop(s);
+    } else {
+        status_label.set_text("At " + std::to_string(cpu.pc));
+    }
+}
+
+// Called on the UI thread after the CPU thread stopped at a breakpoint or a watchpoint.
+void emulator::show_stop(const hcc::cpu::stop& s)
+{
+    pause_clicked();
+    std::ostringstream text;
+    if (s.reason == hcc::cpu::stop_reason::breakpoint) {
+        text << "Breakpoint at " << s.address;
+    } else {
+        text << "Watchpoint " << s.address << " accessed, at " << cpu.pc;
+    }
+    status_label.set_text(text.str());
+}
+
+void emulator::speed_changed()
+{
+    const int row = speed.get_active_row_number();
+    if (row >= 0) {
+        frequency = FREQUENCIES[row];
+    }
 }
 
 bool emulator::keyboard_callback(GdkEventKey* event)
 {
-    ram.at(0x6000) = (event->type == GDK_KEY_RELEASE) ? 0 : translate(event->keyval);
+    if (keys_mode == keyboard_mode::replay) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        key = (event->type == GDK_KEY_RELEASE) ? 0 : translate(event->keyval);
+    }
+    idle_condition.notify_all();
     return true;
 }
 
+// Set the keyboard register before running, and return the number of ticks
+// it may run before the register changes.
+std::uint64_t emulator::update_keyboard()
+{
+    if (replay) {
+        return replay->apply(tick, ram);
+    }
+    ram[hcc::cpu::KEYBOARD] = key;
+    if (keys_mode == keyboard_mode::record) {
+        keys_log.record(tick, key);
+    }
+    return std::numeric_limits<std::uint64_t>::max();
+}
+
 void emulator::cpu_thread()
 {
-    int steps = 0;
+    using clock = hcc::cpu::pacer::clock;
+    hcc::cpu::pacer pacer;
+    pacer.start(frequency, clock::now());
+    auto next_frame = clock::now();
+    std::uint64_t unchecked = 0;
+
     while (running) {
-        cpu.step(rom, ram);
-        if (steps > 100) {
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-            steps = 0;
+        const auto now = clock::now();
+        if (now >= next_frame) {
+            publish_frame();
+            next_frame = now + FRAME_INTERVAL;
+        }
+        if (pacer.frequency() != frequency) {
+            pacer.start(frequency, now);
         }
-        ++steps;
+
+        auto ticks = pacer.budget(now);
+        if (ticks == 0) {
+            std::this_thread::sleep_until(std::min(pacer.due(), next_frame));
+            continue;
+        }
+        ticks = std::min(ticks, update_keyboard());
+        hcc::cpu::stop stopped{hcc::cpu::stop_reason::none, ticks, 0};
+        if (debug.empty()) {
+            interpreter.run(cpu, ram, ticks, &dirty);
+        } else {
+            stopped = debug.run(cpu, rom, ram, ticks, &dirty, &io);
+            ticks = stopped.ticks;
+        }
+        tick += ticks;
+        pacer.advance(ticks, clock::now());
+        achieved = pacer.achieved();
+        if (stopped.reason != hcc::cpu::stop_reason::none) {
+            Glib::signal_idle().connect_once([this, stopped] { show_stop(stopped); });
+            break;
+        }
+
+        // every now and then, check whether the program is stuck in a loop; the
+        // check would step over breakpoints, so it is not done while debugging
+        unchecked += ticks;
+        if (unchecked < LOOP_CHECK_TICKS || !debug.empty()) {
+            continue;
+        }
+        unchecked = 0;
+        std::uint64_t probed = 0;
+        const auto limit = std::min<std::uint64_t>(1024, update_keyboard());
+        const auto state = hcc::cpu::detect_loop(cpu, rom, ram, limit, probed, &dirty, &io);
+        tick += probed;
+        pacer.advance(probed, clock::now());
+        const bool replaying = replay && !replay->finished();
+        if (state == hcc::cpu::activity::running
+            || (state == hcc::cpu::activity::idle && replaying)) {
+            continue;
+        }
+
+        // nothing to do until a key is pressed, or ever
+        publish_frame();
+        achieved = 0;
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        const auto pressed = ram[hcc::cpu::KEYBOARD];
+        // replayed keys are over, and the user is ignored
+        const bool waiting_for_key = (state == hcc::cpu::activity::idle)
+            && keys_mode != keyboard_mode::replay;
+        idle_condition.wait(lock, [&] { return !running || (waiting_for_key && key != pressed); });
+        pacer.start(frequency, clock::now());
+    }
+    publish_frame();
+    achieved = 0;
+}
+
+void emulator::publish_frame()
+{
+    if (dirty.take().none()) {
+        return;
     }
+    auto& frame = frames.back();
+    const auto first = ram.begin() + hcc::cpu::SCREEN;
+    std::copy(first, first + frame.size(), frame.begin());
+    frames.publish();
 }
 
 void emulator::screen_thread()
 {
     while (running) {
-        Glib::signal_idle().connect_once(sigc::mem_fun(screen, &screen_widget::queue_draw));
+        Glib::signal_idle().connect_once(sigc::mem_fun(screen, &screen_widget::update));
+        Glib::signal_idle().connect_once([this] {
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(2) << achieved / 1000000 << " MHz";
+            achieved_label.set_text(text.str());
+        });
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 }
 
 } // namespace {
 
-int main(int argc, char* argv[])
-{
-    Glib::RefPtr<Gtk::Application> app = Gtk::Application::create(argc, argv, "hcc.emulator");
+int main(int argc, char* argv[]) try {
+    const command_line_options options{argc, argv};
+    if (options.help) {
+        options.print_help();
+        return 0;
+    }
+
+    // the rest of the command line is ours, not for GTK
+    int gtk_argc = 1;
+    Glib::RefPtr<Gtk::Application> app = Gtk::Application::create(gtk_argc, argv, "hcc.emulator");
     emulator e;
-    return app->run(e.window);
+    if (!options.replay_file.empty()) {
+        std::ifstream input{options.replay_file};
+        if (!input) {
+            throw std::runtime_error("Cannot read keyboard input log: " + options.replay_file);
+        }
+        e.keys_log = hcc::cpu::input_log::load(input);
+        e.keys_mode = keyboard_mode::replay;
+    }
+    if (!options.record_file.empty()) {
+        e.keys_mode = keyboard_mode::record;
+    }
+    for (const auto address : options.breakpoints) {
+        e.debug.set_breakpoint(address, true);
+    }
+    for (const auto& watchpoint : options.watchpoints) {
+        e.debug.set_watchpoint(watchpoint.first, watchpoint.second);
+    }
+    if (!options.program_file.empty() && !e.load(options.program_file)) {
+        throw std::runtime_error("Cannot load program: " + options.program_file);
+    }
+    if (!options.symbol_file.empty()) {
+        std::ifstream input{options.symbol_file};
+        if (!input) {
+            throw std::runtime_error("Cannot read symbol map: " + options.symbol_file);
+        }
+        const auto symbols = hcc::assembler::symbol_map::load(input);
+        hcc::cpu::hypercalls::symbols labels;
+        hcc::cpu::hypercalls::symbols variables;
+        for (const auto& label : symbols.labels) {
+            labels.emplace(label.name, label.address);
+        }
+        for (const auto& variable : symbols.variables) {
+            variables.emplace(variable.name, variable.address);
+        }
+        e.calls.reset(new hcc::cpu::hypercalls{labels, variables});
+        e.interpreter.set_hook(e.calls->addresses(), e.calls->make_hook());
+    }
+
+    const auto status = app->run(e.window);
+    e.pause();
+
+    if (!options.record_file.empty()) {
+        std::ofstream output{options.record_file};
+        e.keys_log.save(output);
+        if (!output) {
+            throw std::runtime_error("Cannot write keyboard input log: " + options.record_file);
+        }
+    }
+    return status;
+}
+catch (const std::exception& e) {
+    std::cerr << "When executing "
+              << boost::algorithm::join(std::vector<std::string>(argv, argv + argc), " ")
+              << " ...\n" << e.what() << "\n";
+    return 1;
 }
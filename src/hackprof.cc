@@ -0,0 +1,230 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/asm.h"
+#include "hcc/cpu/profile.h"
+#include <boost/algorithm/string/join.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+struct command_line_options {
+    command_line_options(int argc, char* argv[])
+    {
+        opterr = 0;
+        int opt = -1;
+        while ((opt = getopt(argc, argv, ":hn:")) != -1) {
+            switch (opt) {
+            case 'h':
+                help = true;
+                break;
+            case 'n':
+                lines = std::stoul(optarg);
+                break;
+            case '?':
+                throw std::runtime_error(std::string("Unknown command line option: ")
+                                         + static_cast<char>(optopt));
+            case ':':
+                throw std::runtime_error(std::string("Missing argument for command line option: ")
+                                         + static_cast<char>(optopt));
+            }
+        }
+        if (help) {
+            return;
+        }
+        if (argc - optind != 2) {
+            throw std::runtime_error("Expected symbol map and profile");
+        }
+        symbol_file = argv[optind];
+        profile_file = argv[optind + 1];
+    }
+
+    void print_help() const
+    {
+        std::cout << "Usage: hackprof [options] symbols profile\n"
+                     "Symbols are read from symbol map written by hcc -g, or from .asm file.\n"
+                     "Options:\n"
+                     "  -h                   Display this information\n"
+                     "  -n <lines>           Number of lines in each section (default: 20)\n";
+    }
+
+    bool help{false};
+    std::size_t lines{20};
+    std::string symbol_file;
+    std::string profile_file;
+};
+
+bool ends_with(const std::string& value, const std::string& suffix)
+{
+    if (suffix.size() > value.size()) {
+        return false;
+    }
+    return std::equal(suffix.rbegin(), suffix.rend(), value.rbegin());
+}
+
+// Symbol map written by hcc -g, or made from the assembly listing.
+hcc::assembler::symbol_map load_symbols(const std::string& filename)
+{
+    std::ifstream input{filename};
+    if (!input) {
+        throw std::runtime_error("Cannot read " + filename);
+    }
+    hcc::assembler::symbol_map symbols;
+    if (ends_with(filename, ".asm")) {
+        hcc::assembler::program{input}.assemble(&symbols);
+    } else {
+        symbols = hcc::assembler::symbol_map::load(input);
+    }
+    return symbols;
+}
+
+// Name of the function containing address, or of the nearest label.
+std::string function_name(const hcc::assembler::symbol_map& symbols, hcc::cpu::word address)
+{
+    if (const auto f = symbols.find_function(address)) {
+        return f->name;
+    }
+    if (const auto l = symbols.find_label(address)) {
+        return l->name;
+    }
+    return "<start>";
+}
+
+std::string percent(std::uint64_t part, std::uint64_t whole)
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(2) << std::setw(6)
+       << (whole ? 100.0 * part / whole : 0.0) << '%';
+    return ss.str();
+}
+
+// by count, descending
+template <typename T>
+std::vector<std::pair<T, std::uint64_t>> sorted(const std::map<T, std::uint64_t>& counts)
+{
+    std::vector<std::pair<T, std::uint64_t>> result(counts.begin(), counts.end());
+    std::stable_sort(result.begin(), result.end(),
+                     [](const auto& a, const auto& b) { return a.second > b.second; });
+    return result;
+}
+
+} // namespace {
+
+int main(int argc, char* argv[]) try {
+    const command_line_options options{argc, argv};
+    if (options.help) {
+        options.print_help();
+        return 0;
+    }
+
+    const auto symbols = load_symbols(options.symbol_file);
+
+    std::ifstream profile_input{options.profile_file};
+    if (!profile_input) {
+        throw std::runtime_error("Cannot read " + options.profile_file);
+    }
+    const auto profile = hcc::cpu::profile::load(profile_input);
+
+    // flat profile
+    std::uint64_t total = 0;
+    std::map<std::string, std::uint64_t> self;
+    std::map<std::string, std::uint64_t> entered;
+    for (std::size_t address = 0; address < profile.executions.size(); ++address) {
+        if (profile.executions[address]) {
+            total += profile.executions[address];
+            self[function_name(symbols, address)] += profile.executions[address];
+        }
+    }
+
+    // call graph, as jumps between functions
+    std::map<std::string, std::map<std::string, std::uint64_t>> from;
+    std::map<std::string, std::map<std::string, std::uint64_t>> to;
+    for (const auto& jump : profile.jumps) {
+        const auto source = function_name(symbols, jump.first.first);
+        const auto target = function_name(symbols, jump.first.second);
+        const auto f = symbols.find_function(jump.first.second);
+        if (f && f->start == jump.first.second) {
+            entered[target] += jump.second;
+        }
+        if (source != target) {
+            from[target][source] += jump.second;
+            to[source][target] += jump.second;
+        }
+    }
+
+    std::cout << "Flat profile, " << total << " ticks:\n"
+              << "   self  cumulative        ticks      entered  function\n";
+    std::uint64_t cumulative = 0;
+    std::size_t lines = 0;
+    for (const auto& entry : sorted(self)) {
+        if (lines++ == options.lines || entry.second == 0) {
+            break;
+        }
+        cumulative += entry.second;
+        std::cout << percent(entry.second, total) << "     " << percent(cumulative, total)
+                  << std::setw(13) << entry.second << std::setw(13) << entered[entry.first] << "  "
+                  << entry.first;
+        const auto f = std::find_if(symbols.functions.begin(), symbols.functions.end(),
+                                    [&](const auto& g) { return g.name == entry.first; });
+        if (f != symbols.functions.end()) {
+            if (const auto source = symbols.find_source(f->start)) {
+                std::cout << " (" << source->file << ':' << source->first_line << '-'
+                          << source->last_line << ')';
+            }
+        }
+        std::cout << '\n';
+    }
+
+    std::cout << "\nCall graph, taken jumps between functions and stubs:\n";
+    lines = 0;
+    for (const auto& entry : sorted(self)) {
+        if (lines++ == options.lines || entry.second == 0) {
+            break;
+        }
+        std::cout << entry.first << '\n';
+        for (const auto& caller : sorted(from[entry.first])) {
+            std::cout << "    <- " << std::setw(13) << caller.second << "  " << caller.first
+                      << '\n';
+        }
+        for (const auto& callee : sorted(to[entry.first])) {
+            std::cout << "    -> " << std::setw(13) << callee.second << "  " << callee.first
+                      << '\n';
+        }
+    }
+
+    std::cout << "\nHottest jumps:\n"
+              << "  address     executed        taken    not taken  location\n";
+    std::map<hcc::cpu::word, std::uint64_t> jumps;
+    for (const auto address : profile.branches) {
+        jumps[address] = profile.executions[address];
+    }
+    lines = 0;
+    for (const auto& entry : sorted(jumps)) {
+        if (lines++ == options.lines) {
+            break;
+        }
+        const hcc::cpu::word address = entry.first;
+        const auto taken = profile.taken(address);
+        std::cout << std::setw(9) << address << std::setw(13) << entry.second << std::setw(13)
+                  << taken << std::setw(13) << entry.second - taken << "  ";
+        if (const auto l = symbols.find_label(address)) {
+            std::cout << l->name << '+' << address - l->address;
+        }
+        std::cout << '\n';
+    }
+
+    return 0;
+}
+catch (const std::exception& e) {
+    std::cerr << "When executing "
+              << boost::algorithm::join(std::vector<std::string>(argv, argv + argc), " ")
+              << " ...\n" << e.what() << "\n";
+    return 1;
+}
@@ -0,0 +1,694 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/symbol_map.h"
+#include "hcc/cpu/bus.h"
+#include "hcc/cpu/cpu.h"
+#include "hcc/cpu/hypercall.h"
+#include "hcc/cpu/input_log.h"
+#include "hcc/cpu/interpreter.h"
+#include "hcc/cpu/jit.h"
+#include "hcc/cpu/loader.h"
+#include "hcc/cpu/screen.h"
+#include "hcc/cpu/snapshot.h"
+#include "hcc/cpu/trace.h"
+#include "hcc/util/thread_pool.h"
+#include <boost/algorithm/string/join.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace hcc::cpu;
+
+namespace {
+
+// Loop detection runs between chunks, and is given a few steps to find the loop.
+// Chunks grow with the run, so short programs are stopped soon after they halt.
+const std::uint64_t CHUNK = 1 << 18;
+const std::uint64_t PROBE = 1024;
+
+struct range {
+    word first;
+    word last;
+};
+
+// Initial RAM contents, as (address, value) pairs.
+using input_vector = std::vector<std::pair<word, word>>;
+
+unsigned long parse_number(const std::string& text, unsigned long limit)
+{
+    std::size_t end = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(text, &end, 0);
+    } catch (const std::logic_error&) {
+        end = 0;
+    }
+    if (end == 0 || end != text.size() || value > limit) {
+        throw std::runtime_error("Invalid number: " + text);
+    }
+    return value;
+}
+
+word parse_value(const std::string& text)
+{
+    if (!text.empty() && text[0] == '-') {
+        return -parse_number(text.substr(1), 0x8000);
+    }
+    return parse_number(text, 0xffff);
+}
+
+range parse_range(const std::string& text)
+{
+    const auto colon = text.find(':');
+    if (colon == std::string::npos) {
+        const word address = parse_number(text, 0x6000);
+        return {address, address};
+    }
+    const range r{static_cast<word>(parse_number(text.substr(0, colon), 0x6000)),
+                  static_cast<word>(parse_number(text.substr(colon + 1), 0x6000))};
+    if (r.first > r.last) {
+        throw std::runtime_error("Invalid RAM range: " + text);
+    }
+    return r;
+}
+
+// One vector per line, written as whitespace separated address=value pairs.
+// Empty lines and lines starting with '#' are skipped.
+std::vector<input_vector> load_vectors(const std::string& filename)
+{
+    std::ifstream input{filename};
+    if (!input) {
+        throw std::runtime_error("Cannot read input vectors: " + filename);
+    }
+
+    std::vector<input_vector> vectors;
+    std::string line;
+    while (getline(input, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos || line[0] == '#') {
+            continue;
+        }
+        std::istringstream ss{line};
+        input_vector vector;
+        std::string assignment;
+        while (ss >> assignment) {
+            const auto equals = assignment.find('=');
+            if (equals == std::string::npos) {
+                throw std::runtime_error("Invalid input vector assignment: " + assignment);
+            }
+            vector.emplace_back(parse_number(assignment.substr(0, equals), 0x6000),
+                                parse_value(assignment.substr(equals + 1)));
+        }
+        vectors.emplace_back(std::move(vector));
+    }
+    return vectors;
+}
+
+input_log load_keys(const std::string& filename)
+{
+    std::ifstream input{filename};
+    if (!input) {
+        throw std::runtime_error("Cannot read keyboard input log: " + filename);
+    }
+    return input_log::load(input);
+}
+
+// Symbol map written by hcc -g, as names of addresses.
+void load_symbols(const std::string& filename, hypercalls::symbols& labels,
+                  hypercalls::symbols& variables)
+{
+    std::ifstream input{filename};
+    if (!input) {
+        throw std::runtime_error("Cannot read symbol map: " + filename);
+    }
+    const auto symbols = hcc::assembler::symbol_map::load(input);
+    for (const auto& label : symbols.labels) {
+        labels.emplace(label.name, label.address);
+    }
+    for (const auto& variable : symbols.variables) {
+        variables.emplace(variable.name, variable.address);
+    }
+}
+
+struct command_line_options {
+    command_line_options(int argc, char* argv[])
+    {
+        opterr = 0;
+        int opt = -1;
+        while ((opt = getopt(argc, argv, ":hcdpuSTXj:t:i:k:r:x:s:m:")) != -1) {
+            switch (opt) {
+            case 'h':
+                help = true;
+                break;
+            case 'c':
+                checksum = true;
+                break;
+            case 'd':
+                devices = true;
+                break;
+            case 'p':
+                profile = true;
+                break;
+            case 'u':
+                changes = true;
+                break;
+            case 'S':
+                save = true;
+                break;
+            case 'T':
+                trace = true;
+                break;
+            case 'X':
+                validate = true;
+                break;
+            case 'j':
+                threads = parse_number(optarg, 1024);
+                break;
+            case 't':
+                ticks = parse_number(optarg, static_cast<unsigned long>(-1));
+                break;
+            case 'i':
+                vectors = load_vectors(optarg);
+                break;
+            case 'k':
+                keys = load_keys(optarg);
+                break;
+            case 'r':
+                ranges.push_back(parse_range(optarg));
+                break;
+            case 'x':
+                hypercall = true;
+                load_symbols(optarg, labels, variables);
+                hypercalls{labels, variables}; // checks the calling convention
+                break;
+            case 's':
+                capture = parse_number(optarg, static_cast<unsigned long>(-1));
+                if (capture == 0) {
+                    throw std::runtime_error("Invalid capture interval: " + std::string(optarg));
+                }
+                break;
+            case 'm':
+                if (optarg != std::string("pbm") && optarg != std::string("png")) {
+                    throw std::runtime_error("Unknown image format: " + std::string(optarg));
+                }
+                format = optarg;
+                break;
+            case '?':
+                throw std::runtime_error(std::string("Unknown command line option: ")
+                                         + static_cast<char>(optopt));
+            case ':':
+                throw std::runtime_error(std::string("Missing argument for command line option: ")
+                                         + static_cast<char>(optopt));
+            }
+        }
+        while (optind < argc) {
+            input_files.emplace_back(argv[optind++]);
+        }
+
+        if (input_files.empty() && !help) {
+            throw std::runtime_error("Missing input file(s)");
+        }
+        if (profile && trace) {
+            throw std::runtime_error("Cannot profile and trace the same run");
+        }
+        if (devices && trace) {
+            throw std::runtime_error("Cannot trace runs with devices");
+        }
+        if (hypercall && trace) {
+            throw std::runtime_error("Cannot trace runs with hypercalls");
+        }
+        if (validate && !hypercall) {
+            throw std::runtime_error("Validation needs hypercalls");
+        }
+        if (changes && capture == 0) {
+            throw std::runtime_error("Capturing changes needs a capture interval");
+        }
+    }
+
+    void print_help() const
+    {
+        std::cout << "Usage: hackrun [options] file...\n"
+                     "Files are programs in .hack or binary ROM format (see hcc -f), or .snap\n"
+                     "machine snapshots\n"
+                     "Options:\n"
+                     "  -h                   Display this information\n"
+                     "  -j <threads>         Number of worker threads (default: all cores)\n"
+                     "  -t <ticks>           Tick budget of each run (default: 10000000)\n"
+                     "  -i <file>            Run every program once per input vector in <file>;\n"
+                     "                       one vector per line, as address=value pairs\n"
+                     "  -k <file>            Replay keyboard input log in every run;\n"
+                     "                       see emulator -K\n"
+                     "  -r <first>[:<last>]  Print RAM[first..last] after the run\n"
+                     "  -c                   Print checksum of the whole RAM after the run\n"
+                     "  -d                   Map the timer and the console devices above RAM,\n"
+                     "                       and print what was written to the console\n"
+                     "  -p                   Profile the run into <file>.prof, or <file>.<i>.prof\n"
+                     "                       with input vectors; see hackprof\n"
+                     "  -T                   Trace the run into <file>.trace, or <file>.<i>.trace\n"
+                     "                       with input vectors; see hacktrace\n"
+                     "  -S                   Save the machine after the run into <file>.snap, or\n"
+                     "                       <file>.<i>.snap with input vectors\n"
+                     "  -x <symbols>         Execute stdlib functions found in symbol map written\n"
+                     "                       by hcc -g natively, as one tick per call\n"
+                     "  -X                   Execute them both ways, and report the first one\n"
+                     "                       which differs as mismatch=<function>\n"
+                     "  -s <ticks>           Capture the screen every <ticks> ticks and at the end\n"
+                     "                       of the run into <file>.<frame>.pbm, or\n"
+                     "                       <file>.<i>.<frame>.pbm with input vectors\n"
+                     "  -u                   Capture only frames which differ from the last one\n"
+                     "  -m pbm|png           Format of captured frames (default: pbm)\n";
+    }
+
+    bool help{false};
+    bool checksum{false};
+    bool devices{false};
+    bool profile{false};
+    bool trace{false};
+    bool save{false};
+    bool hypercall{false};
+    bool validate{false};
+    bool changes{false};
+    unsigned int threads{0};
+    std::uint64_t ticks{10000000};
+    std::uint64_t capture{0};
+    std::string format{"pbm"};
+    std::vector<input_vector> vectors;
+    input_log keys;
+    std::vector<range> ranges;
+    hypercalls::symbols labels;
+    hypercalls::symbols variables;
+    std::vector<std::string> input_files;
+};
+
+// FNV-1a
+std::uint32_t checksum(const RAM& ram)
+{
+    std::uint32_t hash = 2166136261u;
+    for (word value : ram) {
+        hash = (hash ^ (value & 0xff)) * 16777619u;
+        hash = (hash ^ (value >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+// C-like string literal, so that results stay on one line.
+std::string quote(const std::string& text)
+{
+    std::ostringstream result;
+    result << '"';
+    for (const unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            result << '\\' << c;
+        } else if (c == '\n') {
+            result << "\\n";
+        } else if (c < 0x20 || c >= 0x7f) {
+            result << "\\x" << std::hex << std::setw(2) << std::setfill('0') << int{c} << std::dec;
+        } else {
+            result << c;
+        }
+    }
+    result << '"';
+    return result.str();
+}
+
+// Records every instruction, while another thread streams the trace into a
+// file, so the run does not wait for the disk.
+struct tracer {
+    explicit tracer(const std::string& filename)
+        : output{filename, std::ios::binary}
+        , writer{[this] { write(); }}
+    {
+        engine.set_trace(&recorder);
+    }
+
+    ~tracer()
+    {
+        if (writer.joinable()) {
+            done = true;
+            writer.join();
+        }
+    }
+
+    void load(const ROM& rom) { engine.load(rom); }
+    void set_bus(bus*) {} // traced runs have no devices
+    void set_hook(const std::vector<word>&, hook) {} // nor hypercalls
+    void run(CPU& cpu, RAM& ram, std::uint64_t ticks) { engine.run(cpu, ram, ticks); }
+    void skip(std::uint64_t ticks) { recorder.skip(ticks); }
+
+    // Stop and return the number of chunks lost.
+    std::uint64_t finish()
+    {
+        recorder.flush();
+        done = true;
+        writer.join();
+        if (!output) {
+            throw std::runtime_error("Cannot write trace");
+        }
+        return recorder.dropped();
+    }
+
+private:
+    void write()
+    {
+        trace_chunk chunk;
+        for (;;) {
+            const bool last = done;
+            while (recorder.read(chunk)) {
+                write_chunk(output, chunk);
+            }
+            if (last) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::ofstream output;
+    trace recorder{256, 1 << 16, true};
+    interpreter engine;
+    std::atomic<bool> done{false};
+    std::thread writer;
+};
+
+// Writes the screen into numbered image files, a frame every interval ticks.
+struct screen_capture {
+    screen_capture(const command_line_options& options, const std::string& output)
+        : interval{options.capture}
+        , changes{options.changes}
+        , png{options.format == "png"}
+        , output{output}
+    {
+    }
+
+    // Tick at which the next frame is due, or never.
+    std::uint64_t due() const
+    {
+        return interval ? next : static_cast<std::uint64_t>(-1);
+    }
+
+    void tick(std::uint64_t ticks, const RAM& ram)
+    {
+        if (interval && ticks >= next) {
+            take(ram);
+            next = ticks + interval;
+        }
+    }
+
+    // the last frame, unless it was just taken
+    void finish(std::uint64_t ticks, const RAM& ram)
+    {
+        if (interval && ticks + interval != next) {
+            take(ram);
+        }
+    }
+
+    unsigned int frames = 0;
+
+private:
+    void take(const RAM& ram)
+    {
+        const word* const words = &ram[SCREEN];
+        if (changes && frames
+            && std::memcmp(words, last.data(), last.size() * sizeof(word)) == 0) {
+            return;
+        }
+        std::copy(words, words + last.size(), last.begin());
+
+        std::ostringstream number;
+        number << std::setw(6) << std::setfill('0') << frames;
+        const auto filename = output + "." + number.str() + (png ? ".png" : ".pbm");
+        std::ofstream image{filename, std::ios::binary};
+        if (png) {
+            write_png(image, words);
+        } else {
+            write_pbm(image, words);
+        }
+        if (!image) {
+            throw std::runtime_error("Cannot write screen capture: " + filename);
+        }
+        ++frames;
+    }
+
+    const std::uint64_t interval;
+    const bool changes;
+    const bool png;
+    const std::string output;
+    std::uint64_t next = 0;
+    screen_frame last;
+};
+
+// Instructions executed by loop detection, which only the tracer records.
+template <typename engine_type>
+void skipped(engine_type&, std::uint64_t)
+{
+}
+
+void skipped(tracer& engine, std::uint64_t ticks)
+{
+    engine.skip(ticks);
+}
+
+// Profiled runs are done by the slower, counting interpreter, and traced
+// runs by the recording one.
+template <typename engine_type>
+std::string run(engine_type& engine, const command_line_options& options, const snapshot& machine,
+                const input_vector& vector, const std::string& output)
+{
+    std::unique_ptr<ROM> rom{new ROM()};
+    std::unique_ptr<RAM> ram{new RAM()};
+    std::ostringstream result;
+
+    std::ostringstream console_output;
+    console console_device{console_output};
+    timer timer_device;
+    bus io;
+    io.map(TIMER, TIMER + 1, timer_device);
+    io.map(CONSOLE, CONSOLE, console_device);
+    bus* const devices = options.devices ? &io : nullptr;
+
+    CPU cpu;
+    machine.restore(cpu, *rom, *ram);
+    engine.load(*rom);
+    engine.set_bus(devices);
+    std::unique_ptr<hypercalls> calls;
+    if (options.hypercall) {
+        calls.reset(new hypercalls{options.labels, options.variables});
+        const ROM* const jack_code = options.validate ? rom.get() : nullptr;
+        engine.set_hook(calls->addresses(), calls->make_hook(jack_code));
+    }
+    for (const auto& assignment : vector) {
+        (*ram)[assignment.first] = assignment.second;
+    }
+
+    // runs never cross a keyboard change, so it happens at the recorded tick
+    input_replay keys{options.keys};
+    screen_capture capture{options, output};
+    std::uint64_t ticks = 0;
+    activity state = activity::running;
+    try {
+        while (ticks < options.ticks) {
+            // nor a capture
+            capture.tick(ticks, *ram);
+            const auto until = std::min(
+                {keys.apply(ticks, *ram), options.ticks - ticks, capture.due() - ticks});
+            std::uint64_t probed = 0;
+            state = detect_loop(cpu, *rom, *ram, std::min(PROBE, until), probed, nullptr, devices);
+            ticks += probed;
+            skipped(engine, probed);
+            if (state == activity::idle && !keys.finished()) {
+                state = activity::running;
+            }
+            if (state != activity::running) {
+                break;
+            }
+            const auto chunk = std::min({CHUNK, std::max(PROBE, ticks), until - probed});
+            engine.run(cpu, *ram, chunk);
+            ticks += chunk;
+        }
+        // nothing is going to press a key
+        switch (state) {
+        case activity::running:
+            result << " timeout";
+            break;
+        case activity::idle:
+            result << " idle";
+            break;
+        case activity::halted:
+            result << " halted";
+            break;
+        }
+        result << " ticks=" << ticks;
+    } catch (const std::out_of_range&) {
+        result << " fault";
+    } catch (const hypercall_mismatch& e) {
+        result << " mismatch=" << e.function;
+    }
+    // engines outlive the run
+    engine.set_bus(nullptr);
+    engine.set_hook({}, nullptr);
+    result << " pc=" << cpu.pc;
+
+    if (options.capture) {
+        capture.finish(ticks, *ram);
+        result << " frames=" << capture.frames;
+    }
+
+    if (options.checksum) {
+        result << " checksum=" << std::hex << std::setw(8) << std::setfill('0') << checksum(*ram)
+               << std::dec;
+    }
+    for (const auto& r : options.ranges) {
+        result << ' ' << r.first << ':' << r.last << '=';
+        for (unsigned int address = r.first; address <= r.last; ++address) {
+            result << (address == r.first ? "" : ",") << static_cast<std::int16_t>((*ram)[address]);
+        }
+    }
+
+    if (options.devices) {
+        result << " console=" << quote(console_output.str());
+    }
+
+    if (options.save) {
+        const auto snapshot_file = output + ".snap";
+        std::ofstream snapshot_output{snapshot_file, std::ios::binary};
+        snapshot{cpu, *rom, *ram, &machine}.save(snapshot_output);
+        if (!snapshot_output) {
+            throw std::runtime_error("Cannot write snapshot: " + snapshot_file);
+        }
+    }
+    return result.str();
+}
+
+// Profiles, traces, snapshots and screen captures are written into files named after output.
+std::string run(const command_line_options& options, const snapshot& machine,
+                const input_vector& vector, const std::string& output)
+{
+    if (options.trace) {
+        tracer engine{output + ".trace"};
+        auto result = run(engine, options, machine, vector, output);
+        const auto dropped = engine.finish();
+        if (dropped) {
+            result += " dropped=" + std::to_string(dropped);
+        }
+        return result;
+    }
+
+    // engines are reused by jobs on the same thread
+    if (!options.profile) {
+        thread_local jit engine;
+        return run(engine, options, machine, vector, output);
+    }
+
+    thread_local interpreter engine;
+    engine.set_profiling(true);
+    const auto result = run(engine, options, machine, vector, output);
+
+    const auto profile_file = output + ".prof";
+    std::ofstream profile_output{profile_file};
+    engine.get_profile().save(profile_output);
+    if (!profile_output) {
+        throw std::runtime_error("Cannot write profile: " + profile_file);
+    }
+    return result;
+}
+
+bool ends_with(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size()
+        && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Programs start from reset with cleared RAM, snapshots where they were taken.
+// Returns nullptr if the file could not be read or is malformed.
+std::unique_ptr<snapshot> load_machine(const std::string& filename)
+{
+    if (ends_with(filename, ".snap")) {
+        std::ifstream input{filename, std::ios::binary};
+        try {
+            return std::unique_ptr<snapshot>{new snapshot{snapshot::load(input)}};
+        } catch (const std::runtime_error&) {
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<ROM> rom{new ROM()};
+    std::unique_ptr<RAM> ram{new RAM()};
+    if (!load(filename, *rom)) {
+        return nullptr;
+    }
+    CPU cpu;
+    cpu.reset();
+    return std::unique_ptr<snapshot>{new snapshot{cpu, *rom, *ram}};
+}
+
+} // namespace {
+
+int main(int argc, char* argv[]) try {
+    command_line_options options{argc, argv};
+    if (options.help) {
+        options.print_help();
+        return 0;
+    }
+
+    const bool named_vectors = !options.vectors.empty();
+    if (!named_vectors) {
+        options.vectors.emplace_back();
+    }
+
+    // every program is loaded once, and shared by all its runs
+    std::vector<std::unique_ptr<snapshot>> machines;
+    for (const auto& filename : options.input_files) {
+        machines.push_back(load_machine(filename));
+    }
+
+    // every program with every input vector, results are printed in order
+    std::vector<std::string> names;
+    std::vector<std::string> results;
+    std::vector<hcc::util::thread_pool::job> jobs;
+    for (const auto& filename : options.input_files) {
+        for (std::size_t i = 0; i < options.vectors.size(); ++i) {
+            names.push_back(named_vectors ? filename + "#" + std::to_string(i) : filename);
+        }
+    }
+    results.resize(names.size());
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        const auto& filename = options.input_files[i / options.vectors.size()];
+        const auto machine = machines[i / options.vectors.size()].get();
+        const auto& vector = options.vectors[i % options.vectors.size()];
+        auto& result = results[i];
+        const auto vector_index = std::to_string(i % options.vectors.size());
+        const auto output = filename + (named_vectors ? "." + vector_index : "");
+        if (!machine) {
+            result = " error";
+            continue;
+        }
+        jobs.emplace_back([&options, machine, &vector, &result, output] {
+            result = run(options, *machine, vector, output);
+        });
+    }
+
+    hcc::util::thread_pool{options.threads}.run(std::move(jobs));
+
+    bool errors = false;
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        std::cout << names[i] << results[i] << '\n';
+        errors = errors || results[i] == " error";
+    }
+    return errors ? 1 : 0;
+}
+catch (const std::runtime_error& e) {
+    std::cerr << "When executing "
+              << boost::algorithm::join(std::vector<std::string>(argv, argv + argc), " ")
+              << " ...\n" << e.what() << "\n";
+    return 1;
+}
@@ -0,0 +1,138 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/symbol_map.h"
+#include "hcc/cpu/trace.h"
+#include <boost/algorithm/string/join.hpp>
+#include <unistd.h>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+using namespace hcc::cpu;
+
+namespace {
+
+struct command_line_options {
+    command_line_options(int argc, char* argv[])
+    {
+        opterr = 0;
+        int opt = -1;
+        while ((opt = getopt(argc, argv, ":hn:s:")) != -1) {
+            switch (opt) {
+            case 'h':
+                help = true;
+                break;
+            case 'n':
+                count = std::stoull(optarg);
+                break;
+            case 's':
+                symbol_file = optarg;
+                break;
+            case '?':
+                throw std::runtime_error(std::string("Unknown command line option: ")
+                                         + static_cast<char>(optopt));
+            case ':':
+                throw std::runtime_error(std::string("Missing argument for command line option: ")
+                                         + static_cast<char>(optopt));
+            }
+        }
+        if (help) {
+            return;
+        }
+        if (argc - optind != 1) {
+            throw std::runtime_error("Expected one trace file");
+        }
+        trace_file = argv[optind];
+    }
+
+    void print_help() const
+    {
+        std::cout << "Usage: hacktrace [options] trace\n"
+                     "Options:\n"
+                     "  -h                   Display this information\n"
+                     "  -n <count>           Print last <count> instructions (default: 1000)\n"
+                     "  -s <file>            Name addresses using symbol map written by hcc -g\n";
+    }
+
+    bool help{false};
+    std::uint64_t count{1000};
+    std::string symbol_file;
+    std::string trace_file;
+};
+
+void print(std::ostream& out, const trace_entry& entry, const hcc::assembler::symbol_map& symbols)
+{
+    out << std::setw(12) << entry.tick << std::setw(7) << entry.pc;
+    if (const auto label = symbols.find_label(entry.pc)) {
+        const auto location = label->name + "+" + std::to_string(entry.pc - label->address);
+        out << "  " << std::left << std::setw(32) << location << std::right;
+    }
+    out << "  A=" << std::setw(5) << entry.a << "  D=" << std::setw(6)
+        << static_cast<std::int16_t>(entry.d);
+    if (entry.write) {
+        out << "  M[" << entry.address;
+        if (const auto variable = symbols.find_variable(entry.address)) {
+            out << ' ' << variable->name;
+        }
+        out << "]=" << static_cast<std::int16_t>(entry.value);
+    }
+    out << '\n';
+}
+
+} // namespace {
+
+int main(int argc, char* argv[]) try {
+    const command_line_options options{argc, argv};
+    if (options.help) {
+        options.print_help();
+        return 0;
+    }
+
+    hcc::assembler::symbol_map symbols;
+    if (!options.symbol_file.empty()) {
+        std::ifstream input{options.symbol_file};
+        if (!input) {
+            throw std::runtime_error("Cannot read " + options.symbol_file);
+        }
+        symbols = hcc::assembler::symbol_map::load(input);
+    }
+
+    std::ifstream input{options.trace_file, std::ios::binary};
+    if (!input) {
+        throw std::runtime_error("Cannot read " + options.trace_file);
+    }
+
+    // chunk by chunk, keeping the last entries only
+    std::deque<trace_entry> last;
+    trace_chunk chunk;
+    std::vector<trace_entry> entries;
+    while (read_chunk(input, chunk)) {
+        entries.clear();
+        decode(chunk, entries);
+        last.insert(last.end(), entries.begin(), entries.end());
+        while (last.size() > options.count) {
+            last.pop_front();
+        }
+    }
+
+    // gaps come from dropped chunks, or instructions executed without recording
+    std::uint64_t previous = 0;
+    for (const auto& entry : last) {
+        if (&entry != &last.front() && entry.tick != previous + 1) {
+            std::cout << "    ... " << entry.tick - previous - 1 << " not recorded\n";
+        }
+        print(std::cout, entry, symbols);
+        previous = entry.tick;
+    }
+
+    return 0;
+}
+catch (const std::exception& e) {
+    std::cerr << "When executing "
+              << boost::algorithm::join(std::vector<std::string>(argv, argv + argc), " ")
+              << " ...\n" << e.what() << "\n";
+    return 1;
+}
@@ -2,6 +2,7 @@
 // See LICENSE for details
 
 #include "hcc/assembler/asm.h"
+#include "hcc/cpu/loader.h"
 #include "hcc/jack/ast.h"
 #include "hcc/jack/parser.h"
 #include "hcc/jack/tokenizer.h"
@@ -23,19 +24,42 @@ bool ends_with(const std::string& value, const std::string& suffix)
     return std::equal(suffix.rbegin(), suffix.rend(), value.rbegin());
 }
 
+// Where a Jack subroutine was declared.
+struct subroutine_source {
+    std::string function;
+    std::string file;
+    unsigned first_line;
+    unsigned last_line;
+};
+
 struct command_line_options {
     command_line_options(int argc, char* argv[])
     {
         opterr = 0;
         int opt = -1;
-        while ((opt = getopt(argc, argv, ":ho:S")) != -1) {
+        while ((opt = getopt(argc, argv, ":cghf:o:DS")) != -1) {
             switch (opt) {
+            case 'c':
+                link = false;
+                break;
+            case 'g':
+                symbols = true;
+                break;
             case 'h':
                 help = true;
                 break;
+            case 'f':
+                format = optarg;
+                if (format != "hack" && format != "bin") {
+                    throw std::runtime_error("Unknown output format: " + format);
+                }
+                break;
             case 'o':
                 output = optarg;
                 break;
+            case 'D':
+                eliminate = true;
+                break;
             case 'S':
                 assemble = false;
                 break;
@@ -55,44 +79,84 @@ struct command_line_options {
                 asm_input_files.emplace_back(input_file);
             } else if (ends_with(input_file, ".vm")) {
                 vm_input_files.emplace_back(input_file);
+            } else if (ends_with(input_file, ".o")) {
+                object_input_files.emplace_back(input_file);
             } else {
                 throw std::runtime_error("Input file has unknown suffix: " + input_file);
             }
         }
 
         const auto all_empty = jack_input_files.empty() && asm_input_files.empty()
-                               && vm_input_files.empty();
+                               && vm_input_files.empty() && object_input_files.empty();
         if (all_empty && !help) {
             throw std::runtime_error("Missing input file(s)");
         }
 
-        // Until we get linker working, we have to impose some constraints
-        if (asm_input_files.size() > 1) {
+        // The linker joins objects only, assembly is written as a single program
+        if (!assemble && !object_input_files.empty()) {
+            throw std::runtime_error("Cannot write assembly of object files");
+        }
+        if (!assemble && asm_input_files.size() > 1) {
             throw std::runtime_error("More than one asm input file");
         }
-        if (!asm_input_files.empty() && !jack_input_files.empty()) {
+        if (!assemble && !asm_input_files.empty() && !jack_input_files.empty()) {
             throw std::runtime_error("Mixing jack and asm input files");
         }
+        if (!link && !assemble) {
+            throw std::runtime_error("Options -c and -S exclude each other");
+        }
+        if (!link && symbols) {
+            throw std::runtime_error("Symbol maps are written when linking");
+        }
+        if (eliminate && (!link || !assemble)) {
+            throw std::runtime_error("Dead code is eliminated when linking");
+        }
+        // Objects are Jack code, which is linked with the runtime of Jack code
+        if (!link && (!asm_input_files.empty() || !vm_input_files.empty()
+                      || !object_input_files.empty())) {
+            throw std::runtime_error("Only jack input files compile into an object");
+        }
+        // VM code brings its own runtime
         if (!jack_input_files.empty() && !vm_input_files.empty()) {
             throw std::runtime_error("Mixing jack and vm input files");
         }
         if (!vm_input_files.empty() && !asm_input_files.empty()) {
             throw std::runtime_error("Mixing vm and asm input files");
         }
+        if (!vm_input_files.empty() && !object_input_files.empty()) {
+            throw std::runtime_error("Mixing vm input files and objects");
+        }
 
         if (output.empty()) {
-            if (assemble) {
-                output = "output.hack";
+            if (!link) {
+                output = "output.o";
+            } else if (assemble) {
+                output = format == "bin" ? "output.bin" : "output.hack";
             } else {
                 output = "output.asm";
             }
         }
+        const auto slash = output.rfind('/');
+        const auto dot = output.rfind('.');
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+            symbol_output = output.substr(0, dot) + ".sym";
+        } else {
+            symbol_output = output + ".sym";
+        }
     }
 
     void print_help() const
     {
         std::cout << "Usage: hcc [options] file...\n"
+                     "Files are .jack, .vm or .asm sources, or .o objects written by hcc -c\n"
                      "Options:\n"
+                     "  -c                   Compile jack input files into an object; do not link\n"
+                     "  -D                   Drop code unreachable from the bootstrap when linking,\n"
+                     "                       and report the ROM words saved\n"
+                     "  -g                   Write symbol map of the program next to the output,\n"
+                     "                       with suffix .sym\n"
+                     "  -f hack|bin          Format of the assembled output (default: hack);\n"
+                     "                       bin is a binary ROM image, see hcc::cpu::save_binary\n"
                      "  -h                   Display this information\n"
                      "  -o <file>            Place the output into <file>\n"
                      "  -S                   Compile only; do not assemble\n";
@@ -100,13 +164,20 @@ struct command_line_options {
 
     bool help{false};
     bool assemble{true};
+    bool link{true};
+    bool eliminate{false};
+    bool symbols{false};
+    std::string format{"hack"};
     std::string output;
+    std::string symbol_output;
     std::vector<std::string> jack_input_files;
     std::vector<std::string> asm_input_files;
     std::vector<std::string> vm_input_files;
+    std::vector<std::string> object_input_files;
 };
 
-void jack_to_asm(const std::vector<std::string>& jack_input_files, hcc::assembler::program& out)
+void jack_to_asm(const std::vector<std::string>& jack_input_files, hcc::assembler::program& out,
+                 std::vector<subroutine_source>& sources, bool runtime = true)
 {
     if (jack_input_files.empty()) {
         return;
@@ -127,6 +198,13 @@ void jack_to_asm(const std::vector<std::string>& jack_input_files, hcc::assemble
         throw std::runtime_error(ss.str());
     }
 
+    for (std::size_t i = 0; i < classes.size(); ++i) {
+        for (const auto& subroutine : classes[i].subroutines) {
+            sources.push_back({classes[i].name + "." + subroutine.name, jack_input_files[i],
+                               subroutine.first_line, subroutine.last_line});
+        }
+    }
+
     // produce intermediate code
     hcc::ssa::unit u;
     for (const auto& class_ : classes) {
@@ -143,7 +221,7 @@ void jack_to_asm(const std::vector<std::string>& jack_input_files, hcc::assemble
         subroutine.allocate_registers();
     }
 
-    u.translate_to_asm(out);
+    u.translate_to_asm(out, runtime);
 }
 
 void vm_to_asm(const std::vector<std::string>& vm_input_files, hcc::assembler::program& out)
@@ -170,10 +248,55 @@ void asm_to_asm(const std::vector<std::string>& asm_input_files, hcc::assembler:
     }
 
     for (const auto& input_file : asm_input_files) {
-        std::ifstream input_stream{input_file};
-        hcc::assembler::program prog{input_stream};
-        out = prog;
+        out = hcc::assembler::program::load(input_file);
+    }
+}
+
+// Code generated from jack and vm follows the label conventions the global
+// optimization relies on, hand-written assembly need not.
+hcc::assembler::object optimized_object(hcc::assembler::program& p, bool generated = true)
+{
+    p.local_optimization();
+    if (generated) {
+        p.global_optimization();
+    }
+    return p.assemble_object();
+}
+
+// One object per source, or per all jack or vm sources, and the runtime of
+// Jack code first, unless only compiling.
+std::vector<hcc::assembler::object> compile(const command_line_options& options,
+                                            std::vector<subroutine_source>& sources)
+{
+    std::vector<hcc::assembler::object> objects;
+    const bool jack_code = !options.jack_input_files.empty() || !options.object_input_files.empty();
+    if (jack_code && options.link) {
+        hcc::assembler::program runtime;
+        hcc::ssa::unit{}.translate_to_asm(runtime);
+        objects.push_back(optimized_object(runtime));
+    }
+    if (!options.jack_input_files.empty()) {
+        hcc::assembler::program out;
+        jack_to_asm(options.jack_input_files, out, sources, false);
+        objects.push_back(optimized_object(out));
     }
+    for (const auto& input_file : options.asm_input_files) {
+        auto out = hcc::assembler::program::load(input_file);
+        objects.push_back(optimized_object(out, false));
+    }
+    if (!options.vm_input_files.empty()) {
+        hcc::assembler::program out;
+        vm_to_asm(options.vm_input_files, out);
+        objects.push_back(optimized_object(out));
+    }
+    for (const auto& input_file : options.object_input_files) {
+        std::ifstream input{input_file};
+        if (!input) {
+            throw std::runtime_error("Cannot read object: " + input_file);
+        }
+        objects.push_back(hcc::assembler::object::load(input));
+    }
+    return objects;
 }
 
 int main(int argc, char* argv[]) try {
@@ -183,17 +306,59 @@ int main(int argc, char* argv[]) try {
         return 0;
     }
 
-    hcc::assembler::program out;
-    jack_to_asm(options.jack_input_files, out);
-    asm_to_asm(options.asm_input_files, out);
-    vm_to_asm(options.vm_input_files, out);
-    out.local_optimization();
+    std::vector<subroutine_source> sources;
+    if (!options.assemble) {
+        hcc::assembler::program out;
+        jack_to_asm(options.jack_input_files, out, sources);
+        asm_to_asm(options.asm_input_files, out);
+        vm_to_asm(options.vm_input_files, out);
+        out.local_optimization();
+        if (options.asm_input_files.empty()) {
+            out.global_optimization();
+        }
+        out.save(options.output);
+        return 0;
+    }
+
+    auto objects = compile(options, sources);
+    if (options.eliminate) {
+        std::size_t total = 0;
+        for (const auto& object : objects) {
+            total += object.code.size();
+        }
+        const auto dropped = hcc::assembler::eliminate_dead_code(objects);
+        std::cout << "Dropped " << dropped << " of " << total << " ROM words of dead code\n";
+    }
+    if (!options.link) {
+        std::ofstream object_output{options.output};
+        objects.back().save(object_output);
+        if (!object_output) {
+            throw std::runtime_error("Cannot write output: " + options.output);
+        }
+        return 0;
+    }
 
     // output
-    if (options.assemble) {
-        hcc::assembler::saveHACK(options.output, out.assemble());
+    hcc::assembler::symbol_map symbols;
+    const auto code = hcc::assembler::link(objects, &symbols);
+    if (options.format == "bin") {
+        std::ofstream binary_output{options.output, std::ios::binary};
+        hcc::cpu::save_binary(binary_output, code.data(), code.size());
+        if (!binary_output) {
+            throw std::runtime_error("Cannot write output: " + options.output);
+        }
     } else {
-        out.save(options.output);
+        hcc::assembler::saveHACK(options.output, code);
+    }
+    if (options.symbols) {
+        for (const auto& source : sources) {
+            symbols.add_source(source.function, source.file, source.first_line, source.last_line);
+        }
+        std::ofstream symbol_output{options.symbol_output};
+        symbols.save(symbol_output);
+        if (!symbol_output) {
+            throw std::runtime_error("Cannot write output: " + options.symbol_output);
+        }
     }
 
     return 0;
@@ -1,12 +1,16 @@
 // Copyright (c) 2012-2018 Dano Pernis
 // See LICENSE for details
 #include "hcc/assembler/asm.h"
+#include "hcc/assembler/asm.local.h"
+#include "hcc/util/mapped_file.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <map>
-#include <sstream>
+#include <iterator>
 #include <string>
 #include <stdexcept>
 #include <unordered_map>
@@ -16,56 +20,144 @@ namespace assembler {
 
 namespace {
 
-const std::map<std::string, unsigned short> destMap = {
-    {"M", hcc::instruction::DEST_M},
-    {"D", hcc::instruction::DEST_D},
-    {"MD", hcc::instruction::DEST_M | hcc::instruction::DEST_D},
-    {"A", hcc::instruction::DEST_A},
-    {"AM", hcc::instruction::DEST_A | hcc::instruction::DEST_M},
-    {"AD", hcc::instruction::DEST_A | hcc::instruction::DEST_D},
-    {"AMD", hcc::instruction::DEST_A | hcc::instruction::DEST_M | hcc::instruction::DEST_D},
-};
+// Mnemonics of up to four characters packed into a number, to switch on.
+constexpr std::uint32_t key(const char* mnemonic, unsigned int shift = 0)
+{
+    return *mnemonic ? std::uint32_t(static_cast<unsigned char>(*mnemonic)) << shift
+                           | key(mnemonic + 1, shift + 8)
+                     : 0;
+}
 
-const std::map<std::string, unsigned short> jumpMap = {
-    {"JGT", hcc::instruction::JGT},
-    {"JEQ", hcc::instruction::JEQ},
-    {"JGE", hcc::instruction::JGE},
-    {"JLT", hcc::instruction::JLT},
-    {"JNE", hcc::instruction::JNE},
-    {"JLE", hcc::instruction::JLE},
-    {"JMP", hcc::instruction::JMP},
-};
+// 0 if longer, which matches no mnemonic.
+std::uint32_t key_of(const char* first, const char* last)
+{
+    if (last - first > 4) {
+        return 0;
+    }
+    std::uint32_t result = 0;
+    for (unsigned int shift = 0; first != last; ++first, shift += 8) {
+        if (*first == 0) {
+            return 0;
+        }
+        result |= std::uint32_t(static_cast<unsigned char>(*first)) << shift;
+    }
+    return result;
+}
 
-const std::map<std::string, unsigned short> compMap = {
-    {"0", hcc::instruction::COMP_ZERO},
-    {"1", hcc::instruction::COMP_ONE},
-    {"!D", hcc::instruction::COMP_NOT_D},
-    {"!A", hcc::instruction::COMP_NOT_A},
-    {"!M", hcc::instruction::COMP_NOT_M},
-    {"-1", hcc::instruction::COMP_MINUS_ONE},
-    {"-D", hcc::instruction::COMP_MINUS_D},
-    {"-A", hcc::instruction::COMP_MINUS_A},
-    {"-M", hcc::instruction::COMP_MINUS_M},
-    {"M", hcc::instruction::COMP_M},
-    {"M+1", hcc::instruction::COMP_M_PLUS_ONE},
-    {"M-1", hcc::instruction::COMP_M_MINUS_ONE},
-    {"M-D", hcc::instruction::COMP_M_MINUS_D},
-    {"A", hcc::instruction::COMP_A},
-    {"A+1", hcc::instruction::COMP_A_PLUS_ONE},
-    {"A-1", hcc::instruction::COMP_A_MINUS_ONE},
-    {"A-D", hcc::instruction::COMP_A_MINUS_D},
-    {"D", hcc::instruction::COMP_D},
-    {"D+1", hcc::instruction::COMP_D_PLUS_ONE},
-    {"D+A", hcc::instruction::COMP_D_PLUS_A},
-    {"D+M", hcc::instruction::COMP_D_PLUS_M},
-    {"D-1", hcc::instruction::COMP_D_MINUS_ONE},
-    {"D-A", hcc::instruction::COMP_D_MINUS_A},
-    {"D-M", hcc::instruction::COMP_D_MINUS_M},
-    {"D&A", hcc::instruction::COMP_D_AND_A},
-    {"D&M", hcc::instruction::COMP_D_AND_M},
-    {"D|A", hcc::instruction::COMP_D_OR_A},
-    {"D|M", hcc::instruction::COMP_D_OR_M},
-};
+// Returns -1 if unknown.
+int decode_dest(const char* first, const char* last)
+{
+    int dest = 0;
+    for (; first != last; ++first) {
+        int bit = 0;
+        switch (*first) {
+        case 'A':
+            bit = hcc::instruction::DEST_A;
+            break;
+        case 'M':
+            bit = hcc::instruction::DEST_M;
+            break;
+        case 'D':
+            bit = hcc::instruction::DEST_D;
+            break;
+        default:
+            return -1;
+        }
+        if (dest & bit) {
+            return -1;
+        }
+        dest |= bit;
+    }
+    return dest ? dest : -1;
+}
+
+// Returns -1 if unknown.
+int decode_comp(const char* first, const char* last)
+{
+    switch (key_of(first, last)) {
+    case key("0"):
+        return hcc::instruction::COMP_ZERO;
+    case key("1"):
+        return hcc::instruction::COMP_ONE;
+    case key("!D"):
+        return hcc::instruction::COMP_NOT_D;
+    case key("!A"):
+        return hcc::instruction::COMP_NOT_A;
+    case key("!M"):
+        return hcc::instruction::COMP_NOT_M;
+    case key("-1"):
+        return hcc::instruction::COMP_MINUS_ONE;
+    case key("-D"):
+        return hcc::instruction::COMP_MINUS_D;
+    case key("-A"):
+        return hcc::instruction::COMP_MINUS_A;
+    case key("-M"):
+        return hcc::instruction::COMP_MINUS_M;
+    case key("M"):
+        return hcc::instruction::COMP_M;
+    case key("M+1"):
+        return hcc::instruction::COMP_M_PLUS_ONE;
+    case key("M-1"):
+        return hcc::instruction::COMP_M_MINUS_ONE;
+    case key("M-D"):
+        return hcc::instruction::COMP_M_MINUS_D;
+    case key("A"):
+        return hcc::instruction::COMP_A;
+    case key("A+1"):
+        return hcc::instruction::COMP_A_PLUS_ONE;
+    case key("A-1"):
+        return hcc::instruction::COMP_A_MINUS_ONE;
+    case key("A-D"):
+        return hcc::instruction::COMP_A_MINUS_D;
+    case key("D"):
+        return hcc::instruction::COMP_D;
+    case key("D+1"):
+        return hcc::instruction::COMP_D_PLUS_ONE;
+    case key("D+A"):
+        return hcc::instruction::COMP_D_PLUS_A;
+    case key("D+M"):
+        return hcc::instruction::COMP_D_PLUS_M;
+    case key("D-1"):
+        return hcc::instruction::COMP_D_MINUS_ONE;
+    case key("D-A"):
+        return hcc::instruction::COMP_D_MINUS_A;
+    case key("D-M"):
+        return hcc::instruction::COMP_D_MINUS_M;
+    case key("D&A"):
+        return hcc::instruction::COMP_D_AND_A;
+    case key("D&M"):
+        return hcc::instruction::COMP_D_AND_M;
+    case key("D|A"):
+        return hcc::instruction::COMP_D_OR_A;
+    case key("D|M"):
+        return hcc::instruction::COMP_D_OR_M;
+    default:
+        return -1;
+    }
+}
+
+// Returns -1 if unknown.
+int decode_jump(const char* first, const char* last)
+{
+    switch (key_of(first, last)) {
+    case key("JGT"):
+        return hcc::instruction::JGT;
+    case key("JEQ"):
+        return hcc::instruction::JEQ;
+    case key("JGE"):
+        return hcc::instruction::JGE;
+    case key("JLT"):
+        return hcc::instruction::JLT;
+    case key("JNE"):
+        return hcc::instruction::JNE;
+    case key("JLE"):
+        return hcc::instruction::JLE;
+    case key("JMP"):
+        return hcc::instruction::JMP;
+    default:
+        return -1;
+    }
+}
 
 void instructionToString(std::ostream& out, unsigned short instr)
 {
@@ -203,14 +295,76 @@ void instructionToString(std::ostream& out, unsigned short instr)
     }
 }
 
+// built-in symbols, interned first by every program, so that ids are indices here
+const std::pair<const char*, cpu::word> builtins[] = {
+    {"SP", 0x0000},
+    {"LCL", 0x0001},
+    {"ARG", 0x0002},
+    {"THIS", 0x0003},
+    {"THAT", 0x0004},
+
+    {"SCREEN", 0x4000},
+    {"KBD", 0x6000},
+
+    {"R0", 0x0000},
+    {"R1", 0x0001},
+    {"R2", 0x0002},
+    {"R3", 0x0003},
+    {"R4", 0x0004},
+    {"R5", 0x0005},
+    {"R6", 0x0006},
+    {"R7", 0x0007},
+    {"R8", 0x0008},
+    {"R9", 0x0009},
+    {"R10", 0x000a},
+    {"R11", 0x000b},
+    {"R12", 0x000c},
+    {"R13", 0x000d},
+    {"R14", 0x000e},
+    {"R15", 0x000f},
+};
+const std::size_t builtin_count = sizeof(builtins) / sizeof(builtins[0]);
+
+// value of a symbol, or undefined
+const std::int32_t undefined = -1;
+
+// load of a symbol not known yet, patched after the pass
+struct fixup {
+    std::size_t address;
+    symbol_table::id symbol;
+};
+
 } // namespace {
 
+std::int32_t builtin_address(symbol_table::id symbol)
+{
+    return symbol < builtin_count ? builtins[symbol].second : -1;
+}
+
+symbol_table::id symbol_table::intern(const std::string& name)
+{
+    const auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    names.push_back(name);
+    ids.emplace(name, names.size() - 1);
+    return names.size() - 1;
+}
+
+program::program()
+{
+    for (const auto& builtin : builtins) {
+        names.intern(builtin.first);
+    }
+}
+
 void program::emitLoadSymbolic(std::string symbol)
 {
     instruction i;
     i.type = instruction_type::LOAD;
-    i.symbol = std::move(symbol);
-    instructions.push_back(std::move(i));
+    i.symbol = names.intern(symbol);
+    instructions.push_back(i);
 }
 void program::emitLoadConstant(cpu::word constant)
 {
@@ -237,147 +391,227 @@ void program::emitLabel(std::string label)
 {
     instruction i;
     i.type = instruction_type::LABEL;
-    i.symbol = std::move(label);
-    instructions.push_back(std::move(i));
+    i.symbol = names.intern(label);
+    instructions.push_back(i);
 }
 void program::emitComment(std::string comment)
 {
     instruction i;
     i.type = instruction_type::COMMENT;
-    i.symbol = std::move(comment);
-    instructions.push_back(std::move(i));
+    i.symbol = comments.size();
+    comments.push_back(std::move(comment));
+    instructions.push_back(i);
 }
 
-std::vector<uint16_t> program::assemble() const
+// Single pass, loads of symbols not known yet are patched afterwards.
+object program::assemble_object() const
 {
-    // built-in symbols
-    std::unordered_map<std::string, int> table = {
-        {"SP", 0x0000},
-        {"LCL", 0x0001},
-        {"ARG", 0x0002},
-        {"THIS", 0x0003},
-        {"THAT", 0x0004},
-
-        {"SCREEN", 0x4000},
-        {"KBD", 0x6000},
-
-        {"R0", 0x0000},
-        {"R1", 0x0001},
-        {"R2", 0x0002},
-        {"R3", 0x0003},
-        {"R4", 0x0004},
-        {"R5", 0x0005},
-        {"R6", 0x0006},
-        {"R7", 0x0007},
-        {"R8", 0x0008},
-        {"R9", 0x0009},
-        {"R10", 0x000a},
-        {"R11", 0x000b},
-        {"R12", 0x000c},
-        {"R13", 0x000d},
-        {"R14", 0x000e},
-        {"R15", 0x000f},
-    };
-
-    // first pass
-    int address = 0;
+    object result;
+    result.code.reserve(instructions.size());
+    std::vector<std::int32_t> values(names.size(), undefined);
+    std::vector<fixup> fixups;
     for (const auto& c : instructions) {
         switch (c.type) {
-        case instruction_type::LABEL: {
-            // assign address to label
-            const auto x = table.emplace(c.symbol, address);
-            if (!x.second) {
-                throw std::runtime_error{"Duplicate label " + c.symbol};
+        case instruction_type::LABEL:
+            if (c.symbol < builtin_count || values[c.symbol] != undefined) {
+                throw std::runtime_error{"Duplicate label " + names.name(c.symbol)};
             }
-            break; }
+            values[c.symbol] = result.code.size();
+            result.labels.push_back(
+                {names.name(c.symbol), static_cast<cpu::word>(result.code.size())});
+            break;
         case instruction_type::LOAD:
+            if (c.symbol < builtin_count) {
+                result.code.push_back(builtins[c.symbol].second);
+            } else if (values[c.symbol] != undefined) {
+                result.relocations.push_back(result.code.size());
+                result.code.push_back(values[c.symbol]);
+            } else {
+                fixups.push_back({result.code.size(), c.symbol});
+                result.code.push_back(0);
+            }
+            break;
         case instruction_type::VERBATIM:
-            // maintain address
-            ++address;
+            result.code.push_back(c.instr);
             break;
         case instruction_type::COMMENT:
             break;
         }
     }
 
-    // second pass
-    int variable = 0x10;
+    // labels defined later, or else other objects' labels or variables
+    const auto backward = result.relocations.size();
+    for (const auto& f : fixups) {
+        if (values[f.symbol] != undefined) {
+            result.code[f.address] = values[f.symbol];
+            result.relocations.push_back(f.address);
+        } else {
+            result.references.push_back({static_cast<cpu::word>(f.address), names.name(f.symbol)});
+        }
+    }
+    std::inplace_merge(result.relocations.begin(), result.relocations.begin() + backward,
+                       result.relocations.end());
+    return result;
+}
+
+// As link() does with the only object, single pass too.
+std::vector<uint16_t> program::assemble(symbol_map* symbols) const
+{
+    std::vector<std::int32_t> values(names.size(), undefined);
+    for (std::size_t i = 0; i < builtin_count; ++i) {
+        values[i] = builtins[i].second;
+    }
+    std::vector<fixup> fixups;
     std::vector<uint16_t> result;
-    result.reserve(address);
+    result.reserve(instructions.size());
     for (const auto& c : instructions) {
         switch (c.type) {
         case instruction_type::LABEL:
-        case instruction_type::COMMENT:
-            // ignore
+            if (values[c.symbol] != undefined) {
+                throw std::runtime_error{"Duplicate label " + names.name(c.symbol)};
+            }
+            values[c.symbol] = result.size();
+            if (symbols) {
+                symbols->labels.push_back(
+                    {names.name(c.symbol), static_cast<cpu::word>(result.size())});
+            }
             break;
-        case instruction_type::LOAD: {
-            const auto x = table.emplace(c.symbol, variable);
-            if (x.second) {
-                ++variable;
+        case instruction_type::LOAD:
+            if (values[c.symbol] == undefined) {
+                fixups.push_back({result.size(), c.symbol});
             }
-            result.push_back(x.first->second);
-            break; }
+            result.push_back(values[c.symbol]);
+            break;
         case instruction_type::VERBATIM:
             result.push_back(c.instr);
             break;
+        case instruction_type::COMMENT:
+            break;
+        }
+    }
+
+    // labels defined later, or else variables, allocated in the order of first use
+    cpu::word variable = 0x10;
+    for (const auto& f : fixups) {
+        auto& value = values[f.symbol];
+        if (value == undefined) {
+            value = variable;
+            if (symbols) {
+                symbols->variables.push_back({names.name(f.symbol), variable});
+            }
+            ++variable;
         }
+        result[f.address] = value;
+    }
+    if (symbols) {
+        symbols->find_functions(result.size());
     }
     return result;
 }
 
 program::program(std::istream& input)
+    : program()
+{
+    const std::string text{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+    parse(text.data(), text.data() + text.size());
+}
+
+program program::load(const std::string& filename)
 {
-    std::string line;
-    while (std::getline(input, line)) {
+    const util::mapped_file file{filename};
+    if (!file.opened()) {
+        throw std::runtime_error("Cannot read assembly: " + filename);
+    }
+    program result;
+    result.parse(file.data(), file.data() + file.size());
+    return result;
+}
+
+// One line at a time, in place. Only symbols not seen before are copied.
+void program::parse(const char* first, const char* last)
+{
+    std::string symbol; // reused for lookups
+    unsigned int line_number = 0;
+    auto malformed = [&](const char* what) {
+        return std::runtime_error("Malformed assembly at line " + std::to_string(line_number)
+                                  + ": " + what);
+    };
+
+    while (first != last) {
+        ++line_number;
+        const auto newline = static_cast<const char*>(std::memchr(first, '\n', last - first));
+        const auto next = newline ? newline + 1 : last;
+        auto end = newline ? newline : last;
+        if (end != first && end[-1] == '\r') {
+            --end;
+        }
+
         // ignore blank lines
-        if (line.empty()) {
+        if (first == end) {
+            first = next;
             continue;
         }
 
         instruction i;
-        if (line.find("//") == 0) {
+        if (end - first >= 2 && first[0] == '/' && first[1] == '/') {
             i.type = instruction_type::COMMENT;
-            i.symbol = line.substr(2, line.length());
-        } else if (line.at(0) == '@') {
-            std::string symbol = line.substr(1, line.length() - 1);
-            if (isdigit(symbol.at(0))) {
+            i.symbol = comments.size();
+            comments.emplace_back(first + 2, end);
+        } else if (*first == '@') {
+            if (end - first == 1) {
+                throw malformed("missing symbol");
+            }
+            if (std::isdigit(static_cast<unsigned char>(first[1]))) {
+                unsigned long value = 0;
+                for (auto p = first + 1; p != end; ++p) {
+                    const unsigned int digit = *p - '0';
+                    if (digit > 9) {
+                        throw malformed("invalid constant");
+                    }
+                    value = value * 10 + digit;
+                    if (value & hcc::instruction::COMPUTE) {
+                        throw malformed("constant out of range");
+                    }
+                }
                 i.type = instruction_type::VERBATIM;
-                std::stringstream ss(symbol);
-                ss >> i.instr;
+                i.instr = value;
             } else {
                 i.type = instruction_type::LOAD;
-                i.symbol = symbol;
+                symbol.assign(first + 1, end);
+                i.symbol = names.intern(symbol);
+            }
+        } else if (*first == '(') {
+            if (end - first < 3 || end[-1] != ')') {
+                throw malformed("invalid label");
             }
-        } else if (line.at(0) == '(') {
             i.type = instruction_type::LABEL;
-            i.symbol = line.substr(1, line.length() - 2);
+            symbol.assign(first + 1, end - 1);
+            i.symbol = names.intern(symbol);
         } else {
-            i.type = instruction_type::VERBATIM;
             // dest=comp;jump
-            auto length = line.length();
-            auto equals = line.find('=');
-            auto semicolon = line.rfind(';');
+            const auto equals = std::find(first, end, '=');
+            const auto comp_first = equals == end ? first : equals + 1;
+            const auto semicolon = std::find(comp_first, end, ';');
 
-            unsigned short dest, comp, jump;
-
-            if (equals > length || equals == 0) {
-                dest = 0;
-                equals = -1;
-            } else {
-                dest = destMap.at(line.substr(0, equals));
+            const int dest = equals == end ? 0 : decode_dest(first, equals);
+            if (dest < 0) {
+                throw malformed("unknown destination");
             }
-            if (semicolon > length) {
-                comp = compMap.at(line.substr(equals + 1, length - equals - 1));
-                jump = 0;
-            } else {
-                comp = compMap.at(line.substr(equals + 1, semicolon - equals - 1));
-                jump = jumpMap.at(line.substr(semicolon + 1, 3));
+            const int comp = decode_comp(comp_first, semicolon);
+            if (comp < 0) {
+                throw malformed("unknown computation");
+            }
+            const int jump = semicolon == end ? 0 : decode_jump(semicolon + 1, end);
+            if (jump < 0) {
+                throw malformed("unknown jump");
             }
 
+            i.type = instruction_type::VERBATIM;
             i.instr = hcc::instruction::COMPUTE | hcc::instruction::RESERVED | comp | dest | jump;
         }
 
-        instructions.push_back(std::move(i));
+        instructions.push_back(i);
+        first = next;
     }
 }
 
@@ -387,17 +621,17 @@ void program::save(const std::string& filename) const
     for (const auto& i : instructions) {
         switch (i.type) {
         case instruction_type::LOAD:
-            out << '@' << i.symbol << '\n';
+            out << '@' << names.name(i.symbol) << '\n';
             break;
         case instruction_type::VERBATIM:
             instructionToString(out, i.instr);
             out << '\n';
             break;
         case instruction_type::LABEL:
-            out << '(' << i.symbol << ")\n";
+            out << '(' << names.name(i.symbol) << ")\n";
             break;
         case instruction_type::COMMENT:
-            out << "//" << i.symbol << "\n";
+            out << "//" << comments[i.symbol] << "\n";
             break;
         }
     }
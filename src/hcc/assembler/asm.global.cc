@@ -0,0 +1,581 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/assembler/asm.local.h"
+#include "hcc/util/graph.h"
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+namespace hcc {
+namespace assembler {
+
+namespace {
+
+const std::int64_t none = -1;
+
+bool is_jump(const instruction& i)
+{
+    return i.type == instruction_type::VERBATIM && (i.instr & hcc::instruction::COMPUTE)
+           && (i.instr & hcc::instruction::MASK_JUMP);
+}
+
+bool is_unconditional_jump(const instruction& i)
+{
+    return is_jump(i) && (i.instr & hcc::instruction::MASK_JUMP) == hcc::instruction::JMP;
+}
+
+// Reads A, or M at the address in A, other than as a jump target.
+bool reads_A(const instruction& i)
+{
+    if (i.type != instruction_type::VERBATIM || !(i.instr & hcc::instruction::COMPUTE)) {
+        return false;
+    }
+    if (i.instr & hcc::instruction::DEST_M) {
+        return true;
+    }
+    switch (i.instr & hcc::instruction::MASK_COMP) {
+    case hcc::instruction::COMP_ZERO:
+    case hcc::instruction::COMP_ONE:
+    case hcc::instruction::COMP_MINUS_ONE:
+    case hcc::instruction::COMP_D:
+    case hcc::instruction::COMP_NOT_D:
+    case hcc::instruction::COMP_MINUS_D:
+    case hcc::instruction::COMP_D_PLUS_ONE:
+    case hcc::instruction::COMP_D_MINUS_ONE:
+        return false;
+    default:
+        return true;
+    }
+}
+
+bool writes_A(const instruction& i)
+{
+    switch (i.type) {
+    case instruction_type::LOAD:
+        return true;
+    case instruction_type::VERBATIM:
+        return !(i.instr & hcc::instruction::COMPUTE) || (i.instr & hcc::instruction::DEST_A);
+    default:
+        return false;
+    }
+}
+
+constant_value meet(const constant_value& a, const constant_value& b)
+{
+    return a == b ? a : constant_value();
+}
+
+registers meet(const registers& a, const registers& b)
+{
+    registers result;
+    result.D = meet(a.D, b.D);
+    result.A = meet(a.A, b.A);
+    result.M = meet(a.M, b.M);
+    result.M_is_D = a.M_is_D && b.M_is_D;
+    for (std::size_t i = 0; i < CELLS; ++i) {
+        result.cells[i] = meet(a.cells[i], b.cells[i]);
+    }
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// Basic blocks, each starting with a label or following a jump, and edges
+// between them. One more node stands for code outside the program, which
+// enters it at its labels and is reached by jumps elsewhere and by falling
+// off its end.
+//-----------------------------------------------------------------------------
+struct control_flow_graph {
+    control_flow_graph(const std::vector<instruction>& instructions, const symbol_table& names)
+        : instructions(instructions)
+        , block_of_label(names.size(), none)
+    {
+        std::vector<bool> escapes(names.size(), false);
+
+        // symbol loaded into A while A is used only as a jump target
+        std::int64_t pending = none;
+        std::int64_t known_A = none;
+        std::int64_t known_A_load = none;
+        auto start_block = [&](std::size_t first) {
+            firsts.push_back(first);
+            labels.push_back(none);
+            jump_targets.push_back(none);
+            jump_loads.push_back(none);
+        };
+        auto escape = [&]() {
+            if (pending != none) {
+                escapes[pending] = true;
+                pending = none;
+            }
+        };
+
+        start_block(0);
+        for (std::size_t index = 0; index < instructions.size(); ++index) {
+            const auto& i = instructions[index];
+            if (i.type == instruction_type::COMMENT) {
+                continue;
+            }
+            if (i.type == instruction_type::LABEL) {
+                if (firsts.back() != index) {
+                    start_block(index);
+                }
+                labels.back() = i.symbol;
+                block_of_label[i.symbol] = firsts.size() - 1;
+                escape(); // flows into code entered elsewhere too
+                known_A = none;
+                continue;
+            }
+            if (is_jump(i)) {
+                if (!(i.instr & hcc::instruction::DEST_A)) {
+                    jump_targets.back() = known_A;
+                    jump_loads.back() = known_A_load >= std::int64_t(firsts.back()) ? known_A_load
+                                                                                     : none;
+                }
+                if (index + 1 < instructions.size()) {
+                    start_block(index + 1);
+                }
+            }
+            if (reads_A(i)) {
+                escape();
+            }
+            if (writes_A(i)) {
+                known_A = i.type == instruction_type::LOAD ? i.symbol : none;
+                known_A_load = index;
+                pending = known_A;
+            }
+        }
+        escape(); // falls through into whatever follows
+
+        const auto blocks = firsts.size();
+        firsts.push_back(instructions.size());
+        outside = blocks;
+        for (std::size_t b = 0; b <= blocks; ++b) {
+            g.add_node();
+        }
+
+        g.add_edge(outside, 0);
+        for (std::size_t symbol = 0; symbol < names.size(); ++symbol) {
+            const auto b = block_of_label[symbol];
+            if (b != none && (escapes[symbol] || !local(names.name(symbol)))) {
+                g.add_edge(outside, b);
+            }
+        }
+        for (std::size_t b = 0; b < blocks; ++b) {
+            const auto last = last_instruction(b);
+            const bool jumps = last != none && is_jump(instructions[last]);
+            if (jumps) {
+                const auto target = jump_block(b);
+                if (target != none) {
+                    g.add_edge(b, target);
+                } else {
+                    jump_targets[b] = none;
+                    g.add_edge(b, outside);
+                }
+            }
+            if (!jumps || !is_unconditional_jump(instructions[last])) {
+                g.add_edge(b, b + 1 < blocks ? b + 1 : outside);
+            }
+        }
+    }
+
+    std::size_t size() const { return outside; }
+
+    // Instructions of the block, but its label.
+    std::size_t first(std::size_t block) const
+    {
+        const auto index = firsts[block];
+        return labels[block] != none ? index + 1 : index;
+    }
+    std::size_t last(std::size_t block) const { return firsts[block + 1]; }
+
+    // Index of the last instruction of the block, but comments, or none.
+    std::int64_t last_instruction(std::size_t block) const
+    {
+        for (auto index = last(block); index > first(block); --index) {
+            if (instructions[index - 1].type != instruction_type::COMMENT) {
+                return index - 1;
+            }
+        }
+        return none;
+    }
+
+    bool is_label(symbol_table::id symbol) const { return block_of_label[symbol] != none; }
+
+    // Block the block jumps to, or none if unknown or not jumping.
+    std::int64_t jump_block(std::size_t block) const
+    {
+        return jump_targets[block] != none ? block_of_label[jump_targets[block]] : none;
+    }
+
+    const std::vector<instruction>& instructions;
+    util::graph g;
+    std::size_t outside;
+    std::vector<std::int64_t> labels; // of blocks, or none
+    std::vector<std::int64_t> jump_targets; // symbol, or none if unknown or not jumping
+    std::vector<std::int64_t> jump_loads; // of the target in the block, or none
+
+private:
+    // Block labels of jack and vm code are only ever used by their program.
+    static bool local(const std::string& label) { return label.find('$') != std::string::npos; }
+
+    std::vector<std::int64_t> block_of_label;
+    std::vector<std::size_t> firsts; // and the end of the last block
+};
+
+//-----------------------------------------------------------------------------
+// What is known about registers at the start and the end of blocks, flowing
+// forward, and whether A and D are read later at their start, flowing
+// backward.
+//-----------------------------------------------------------------------------
+struct dataflow {
+    explicit dataflow(const control_flow_graph& cfg)
+        : cfg(cfg)
+        , in(cfg.size() + 1)
+        , out(cfg.size() + 1)
+        , reached(cfg.size() + 1, false)
+        , live_A(cfg.size() + 1, false)
+        , live_D(cfg.size() + 1, false)
+        , queued(cfg.size() + 1, false)
+    {
+        forward();
+        backward();
+    }
+
+    // What flows along the edges from a block.
+    registers flow_out(std::size_t block) const
+    {
+        auto r = out[block];
+        if (block != cfg.outside && cfg.jump_targets[block] != none) {
+            // A is left at the target, whether jumping or not
+            r.A = constant_value(constant_value_type::OTHER, true, cfg.jump_targets[block]);
+        }
+        return r;
+    }
+
+    // What is read after the block.
+    dead_code_elimination live_out(std::size_t block) const
+    {
+        bool A = false;
+        bool D = false;
+        for (const auto s : cfg.g.successors()[block]) {
+            A = A || live_A[s];
+            D = D || live_D[s];
+        }
+        return dead_code_elimination{A, D, false};
+    }
+
+    const control_flow_graph& cfg;
+    std::vector<registers> in;
+    std::vector<registers> out;
+    std::vector<bool> reached;
+    std::vector<bool> live_A;
+    std::vector<bool> live_D;
+
+private:
+    void enqueue(std::size_t block)
+    {
+        if (block != cfg.outside && !queued[block]) {
+            queued[block] = true;
+            work.push_back(block);
+        }
+    }
+
+    std::size_t dequeue()
+    {
+        const auto block = work.back();
+        work.pop_back();
+        queued[block] = false;
+        return block;
+    }
+
+    void forward()
+    {
+        const auto& instructions = cfg.instructions;
+        reached[cfg.outside] = true;
+        for (const auto b : cfg.g.successors()[cfg.outside]) {
+            enqueue(b);
+        }
+        while (!work.empty()) {
+            const auto b = dequeue();
+            bool first = true;
+            registers r;
+            for (const auto p : cfg.g.predecessors()[b]) {
+                if (reached[p]) {
+                    r = first ? flow_out(p) : meet(r, flow_out(p));
+                    first = false;
+                }
+            }
+            in[b] = r;
+            constant_propagation propagate{r};
+            for (auto index = cfg.first(b); index < cfg.last(b); ++index) {
+                auto copy = instructions[index];
+                propagate(copy);
+            }
+            if (!reached[b] || !(out[b] == propagate.state())) {
+                reached[b] = true;
+                out[b] = propagate.state();
+                for (const auto s : cfg.g.successors()[b]) {
+                    enqueue(s);
+                }
+            }
+        }
+    }
+
+    void backward()
+    {
+        const auto& instructions = cfg.instructions;
+        live_A[cfg.outside] = live_D[cfg.outside] = true;
+        for (std::size_t b = 0; b < cfg.size(); ++b) {
+            enqueue(b);
+        }
+        while (!work.empty()) {
+            const auto b = dequeue();
+            auto eliminate = live_out(b);
+            for (auto index = cfg.last(b); index > cfg.first(b); --index) {
+                auto copy = instructions[index - 1];
+                eliminate(copy);
+            }
+            if (live_A[b] != eliminate.requires_A() || live_D[b] != eliminate.requires_D()) {
+                live_A[b] = eliminate.requires_A();
+                live_D[b] = eliminate.requires_D();
+                for (const auto p : cfg.g.predecessors()[b]) {
+                    enqueue(p);
+                }
+            }
+        }
+    }
+
+    std::vector<bool> queued;
+    std::vector<std::size_t> work;
+};
+
+//-----------------------------------------------------------------------------
+// Jump threading: where what flows into a block decides where it jumps, and
+// it only computes A and D, which nobody reads there, jump there directly.
+//-----------------------------------------------------------------------------
+struct jump_threading {
+    jump_threading(std::vector<instruction>& instructions, const symbol_table& names)
+        : instructions(instructions)
+        , cfg(instructions, names)
+        , flow(cfg)
+    {
+    }
+
+    // Returns whether anything changed.
+    bool operator()()
+    {
+        // where to add @label, and whether 0;JMP follows
+        std::vector<std::tuple<std::size_t, symbol_table::id, bool>> inserts;
+        for (std::size_t b = 0; b < cfg.size(); ++b) {
+            if (!flow.reached[b] || !pure(b)) {
+                continue;
+            }
+            for (const std::size_t p : cfg.g.predecessors()[b]) {
+                if (p == cfg.outside || p == b) {
+                    continue;
+                }
+                const auto target = destination(b, flow.flow_out(p));
+                if (target == none) {
+                    continue;
+                }
+                const auto label = static_cast<symbol_table::id>(cfg.labels[target]);
+                const auto load = cfg.jump_loads[p];
+                const auto jump = cfg.last_instruction(p);
+                const auto fallthrough = p + 1 < cfg.size() ? p + 1 : cfg.outside;
+                if (cfg.jump_block(p) == std::int64_t(b)) {
+                    // not if the jump computes from its old target, nor its
+                    // fallthrough reads it
+                    if (reads_A(instructions[jump])
+                        || (!is_unconditional_jump(instructions[jump])
+                            && flow.live_A[fallthrough])) {
+                        continue;
+                    }
+                    if (load == none || read_between(load, jump)) {
+                        inserts.emplace_back(jump, label, false);
+                    } else {
+                        instructions[load].symbol = label;
+                        changed = true;
+                    }
+                } else if (fallthrough == b && cost(b) > 2) {
+                    inserts.emplace_back(cfg.last(p), label, true);
+                }
+            }
+        }
+
+        // last first, so that indices stay valid
+        std::sort(inserts.begin(), inserts.end());
+        for (auto it = inserts.rbegin(); it != inserts.rend(); ++it) {
+            const instruction jump[] = {
+                {instruction_type::LOAD, std::get<1>(*it), 0},
+                {instruction_type::VERBATIM, 0,
+                 hcc::instruction::COMPUTE | hcc::instruction::RESERVED
+                     | hcc::instruction::COMP_ZERO | hcc::instruction::JMP},
+            };
+            instructions.insert(instructions.begin() + std::get<0>(*it), jump,
+                                jump + (std::get<2>(*it) ? 2 : 1));
+            changed = true;
+        }
+        return changed;
+    }
+
+private:
+    // Writes nothing but A and D, and ends with a jump.
+    bool pure(std::size_t block) const
+    {
+        const auto last = cfg.last_instruction(block);
+        if (last == none || !is_jump(instructions[last])) {
+            return false;
+        }
+        for (auto index = cfg.first(block); index < cfg.last(block); ++index) {
+            const auto& i = instructions[index];
+            if (i.type == instruction_type::VERBATIM && (i.instr & hcc::instruction::COMPUTE)
+                && (i.instr & hcc::instruction::DEST_M)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether A or M is read after the load, before the jump.
+    bool read_between(std::size_t load, std::size_t jump) const
+    {
+        return std::any_of(instructions.begin() + load + 1, instructions.begin() + jump, reads_A);
+    }
+
+    std::size_t cost(std::size_t block) const
+    {
+        std::size_t result = 0;
+        for (auto index = cfg.first(block); index < cfg.last(block); ++index) {
+            result += instructions[index].type != instruction_type::COMMENT;
+        }
+        return result;
+    }
+
+    // Block where code starting in the given one ends up, through pure blocks
+    // only, or none if not known or not worth jumping to.
+    std::int64_t destination(const std::size_t start, registers r) const
+    {
+        auto block = start;
+        bool jumped = false;
+        for (int steps = 0; steps < 8 && block != cfg.outside; ++steps) {
+            if (steps != 0 && cfg.labels[block] != none && !flow.live_D[block]
+                && (jumped || !flow.live_A[block])) {
+                return block != start ? std::int64_t(block) : none;
+            }
+            if (!pure(block)) {
+                return none;
+            }
+
+            constant_propagation propagate{r};
+            const auto last = cfg.last_instruction(block);
+            for (auto index = cfg.first(block); index < std::size_t(last); ++index) {
+                auto copy = instructions[index];
+                propagate(copy);
+            }
+            const auto outcome = taken(instructions[last], propagate.state());
+            if (outcome < 0) {
+                return none;
+            }
+            auto jump = instructions[last];
+            propagate(jump); // which may compute too
+            r = propagate.state();
+            jumped = outcome;
+            if (outcome) {
+                const auto target = cfg.jump_block(block);
+                if (target == none) {
+                    return none;
+                }
+                r.A = constant_value(constant_value_type::OTHER, true, cfg.jump_targets[block]);
+                block = target;
+            } else {
+                block = block + 1;
+            }
+        }
+        return none;
+    }
+
+    // Returns 1 if the jump is taken, 0 if not, or -1 if not known.
+    static int taken(instruction jump, const registers& r)
+    {
+        constant_propagation propagate{r};
+        propagate(jump);
+        const auto condition = jump.instr & hcc::instruction::MASK_JUMP;
+        if (condition == hcc::instruction::JMP) {
+            return 1;
+        }
+        int value = 0;
+        switch (jump.instr & hcc::instruction::MASK_COMP) {
+        case hcc::instruction::COMP_ZERO:
+            value = 0;
+            break;
+        case hcc::instruction::COMP_ONE:
+            value = 1;
+            break;
+        case hcc::instruction::COMP_MINUS_ONE:
+            value = -1;
+            break;
+        default:
+            return -1;
+        }
+        return (value < 0 && (condition & hcc::instruction::JLT))
+               || (value == 0 && (condition & hcc::instruction::JEQ))
+               || (value > 0 && (condition & hcc::instruction::JGT));
+    }
+
+    std::vector<instruction>& instructions;
+    const control_flow_graph cfg;
+    const dataflow flow;
+    bool changed = false;
+};
+
+} // namespace {
+
+//=============================================================================
+// DRIVER
+//=============================================================================
+void program::global_optimization()
+{
+    // two iterations are usually enough
+    for (int i = 0; i < 2; ++i) {
+        jump_threading{instructions, names}();
+
+        {
+            const control_flow_graph cfg{instructions, names};
+            const dataflow flow{cfg};
+            for (std::size_t b = 0; b < cfg.size(); ++b) {
+                if (!flow.reached[b]) {
+                    // nothing jumps here, nor falls through, not even to its label
+                    std::fill(instructions.begin() + cfg.first(b) - (cfg.labels[b] != none),
+                              instructions.begin() + cfg.last(b), NOP);
+                    continue;
+                }
+                constant_propagation propagate{flow.in[b]};
+                for (auto index = cfg.first(b); index < cfg.last(b); ++index) {
+                    auto& i = instructions[index];
+                    const auto original = i;
+                    propagate(i);
+                    if (is_nop(i) && original.type == instruction_type::LOAD
+                        && cfg.is_label(original.symbol)) {
+                        i = original; // so that jumps still show where they go
+                    }
+                }
+            }
+        }
+
+        // what is read may have changed
+        const control_flow_graph cfg{instructions, names};
+        const dataflow flow{cfg};
+        for (std::size_t b = 0; b < cfg.size(); ++b) {
+            auto eliminate = flow.live_out(b);
+            for (auto index = cfg.last(b); index > cfg.first(b); --index) {
+                eliminate(instructions[index - 1]);
+            }
+        }
+
+        instructions.erase(std::remove_if(instructions.begin(), instructions.end(), is_nop),
+                           instructions.end());
+    }
+}
+
+} // namespace assembler {
+} // namespace hcc {
@@ -2,12 +2,16 @@
 // See LICENSE for details
 #pragma once
 
+#include "hcc/assembler/object.h"
+#include "hcc/assembler/symbol_map.h"
 #include "hcc/cpu/cpu.h"
 #include "hcc/cpu/instruction.h"
 
+#include <cstdint>
 #include <istream>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 namespace hcc {
@@ -20,10 +24,26 @@ enum class instruction_type {
     COMMENT,
 };
 
+/**
+ * Names of symbols, each stored once and referred to by a number, so that
+ * instructions are compared, copied and resolved without touching strings.
+ */
+struct symbol_table {
+    using id = std::uint32_t;
+
+    id intern(const std::string& name);
+    const std::string& name(id symbol) const { return names[symbol]; }
+    std::size_t size() const { return names.size(); }
+
+private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string, id> ids;
+};
+
 struct instruction {
     instruction_type type;
-    std::string symbol;
-    cpu::word instr;
+    symbol_table::id symbol = 0; // of a load or a label, or the index of a comment
+    cpu::word instr = 0;
 };
 
 inline bool operator==(const instruction& a, const instruction& b)
@@ -33,9 +53,22 @@ inline bool operator==(const instruction& a, const instruction& b)
 }
 
 struct program {
-    program() = default;
+    program();
+
+    /**
+     * Parse assembly, one instruction, label or comment per line.
+     *
+     * @throws std::runtime_error with the line number if the input is malformed
+     */
     program(std::istream&);
 
+    /**
+     * As the above, but the file is mapped into memory rather than read.
+     *
+     * @throws std::runtime_error if the file cannot be read or is malformed
+     */
+    static program load(const std::string& filename);
+
     void emitLoadSymbolic(std::string symbol);
     void emitLoadConstant(cpu::word constant);
     void emitInstruction(cpu::word instruction);
@@ -44,12 +77,34 @@ struct program {
 
     void local_optimization();
 
-    std::vector<cpu::word> assemble() const;
+    /**
+     * Propagate constants and drop computations of A and D nobody reads, as
+     * local_optimization() does, but across basic blocks: what is known at
+     * the end of a block flows into the blocks it jumps or falls through to.
+     * Jumps into blocks which only decide where to jump next go there
+     * directly, and blocks nothing reaches are removed.
+     *
+     * Labels containing '$' are assumed to be used by this program only, as
+     * block labels of jack and vm code are, unless their address is used as
+     * data. Code outside the program may enter it at any other label, and is
+     * assumed to read both A and D.
+     */
+    void global_optimization();
+
+    // if symbols are given, labels, functions and allocated variables are recorded there
+    std::vector<cpu::word> assemble(symbol_map* symbols = nullptr) const;
+
+    // labels are relative, and loads of symbols not defined here are left to link()
+    object assemble_object() const;
 
     void save(const std::string& filename) const;
 
 private:
+    void parse(const char* first, const char* last);
+
     std::vector<instruction> instructions;
+    symbol_table names; // built-in symbols first
+    std::vector<std::string> comments;
 };
 
 void saveHACK(const std::string& filename, std::vector<uint16_t>);
@@ -1,6 +1,6 @@
 // Copyright (c) 2012-2018 Dano Pernis
 // See LICENSE for details
-#include "hcc/assembler/asm.h"
+#include "hcc/assembler/asm.local.h"
 
 #include <algorithm>
 #include <cassert>
@@ -8,51 +8,37 @@
 namespace hcc {
 namespace assembler {
 
-namespace {
-
 const instruction NOP = {
     instruction_type::VERBATIM,
-    "",
+    0,
     hcc::instruction::COMPUTE | hcc::instruction::RESERVED | hcc::instruction::COMP_ZERO,
 };
 
-//=============================================================================
-// LOCAL CONSTANT PROPAGATION
-//=============================================================================
-
-//-----------------------------------------------------------------------------
-// Represents knowledge about value in registers
-//-----------------------------------------------------------------------------
-enum class constant_value_type {
-    UNKNOWN,
-    ZERO,
-    NEGATIVE_ONE,
-    POSITIVE_ONE,
-    OTHER,
-};
-struct constant_value {
-    constant_value(constant_value_type type = constant_value_type::UNKNOWN, std::string other = "")
-        : type(std::move(type))
-        , other(std::move(other))
-    {
-    }
+bool is_nop(const instruction& i)
+{
+    return i == NOP;
+}
 
-    constant_value_type type;
-    std::string other;
-};
 bool operator==(const constant_value& a, const constant_value& b)
 {
     if (a.type != b.type)
         return false;
-    if (a.type == constant_value_type::OTHER && a.other != b.other)
+    if (a.type == constant_value_type::OTHER && (a.symbolic != b.symbolic || a.other != b.other))
         return false;
     return true;
 }
-struct registers {
-    constant_value D;
-    constant_value A;
-    constant_value M;
-};
+
+bool operator==(const registers& a, const registers& b)
+{
+    return a.D == b.D && a.A == b.A && a.M == b.M && a.M_is_D == b.M_is_D
+           && std::equal(a.cells, a.cells + CELLS, b.cells);
+}
+
+namespace {
+
+//=============================================================================
+// LOCAL CONSTANT PROPAGATION
+//=============================================================================
 
 //-----------------------------------------------------------------------------
 // Propagate constants in "comp" part of C-instruction
@@ -394,208 +380,264 @@ uint16_t simplify(uint16_t comp, const registers& r)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Address A holds, or -1 if unknown
+//-----------------------------------------------------------------------------
+std::int32_t address_of(const constant_value& A)
+{
+    switch (A.type) {
+    case constant_value_type::ZERO:
+        return 0;
+    case constant_value_type::POSITIVE_ONE:
+        return 1;
+    case constant_value_type::NEGATIVE_ONE:
+        return 0xffff;
+    case constant_value_type::OTHER:
+        return A.symbolic ? builtin_address(A.other) : A.other;
+    default:
+        return -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Read D instead of M holding the same value, so that A may not be needed
+//-----------------------------------------------------------------------------
+uint16_t read_D_for_M(uint16_t comp)
+{
+    switch (comp) {
+    case hcc::instruction::COMP_M:
+        return hcc::instruction::COMP_D;
+    case hcc::instruction::COMP_NOT_M:
+        return hcc::instruction::COMP_NOT_D;
+    case hcc::instruction::COMP_MINUS_M:
+        return hcc::instruction::COMP_MINUS_D;
+    case hcc::instruction::COMP_M_PLUS_ONE:
+        return hcc::instruction::COMP_D_PLUS_ONE;
+    case hcc::instruction::COMP_M_MINUS_ONE:
+        return hcc::instruction::COMP_D_MINUS_ONE;
+    default:
+        return comp;
+    }
+}
+
+} // namespace {
+
 //-----------------------------------------------------------------------------
 // Propagate constants in asm program
 //-----------------------------------------------------------------------------
-struct constant_propagation {
-    void operator()(instruction& cmd)
-    {
-        auto handle_ainstr = [&](const constant_value& new_A) {
-            if (r.A == new_A) {
-                cmd = NOP;
-            } else {
-                r.A = new_A;
-                r.M.type = constant_value_type::UNKNOWN;
-            }
-        };
+void constant_propagation::operator()(instruction& cmd)
+{
+    auto memory_at = [&](const constant_value& A) {
+        const auto address = address_of(A);
+        return 0 <= address && address < static_cast<std::int32_t>(CELLS) ? r.cells[address]
+                                                                           : constant_value();
+    };
+    auto handle_ainstr = [&](const constant_value& new_A) {
+        if (r.A == new_A) {
+            cmd = NOP;
+        } else {
+            r.A = new_A;
+            r.M = memory_at(r.A);
+            r.M_is_D = false;
+        }
+    };
 
-        switch (cmd.type) {
-        case instruction_type::LABEL:
-            // reset
-            r = registers();
-            break;
-        case instruction_type::COMMENT:
-            // nothing to do here
-            break;
-        case instruction_type::LOAD:
-            handle_ainstr(constant_value(constant_value_type::OTHER, "@" + cmd.symbol));
-            break;
-        case instruction_type::VERBATIM:
-            if (cmd.instr & hcc::instruction::COMPUTE) {
-                // C-instruction
+    switch (cmd.type) {
+    case instruction_type::LABEL:
+        // reset
+        r = registers();
+        break;
+    case instruction_type::COMMENT:
+        // nothing to do here
+        break;
+    case instruction_type::LOAD:
+        handle_ainstr(constant_value(constant_value_type::OTHER, true, cmd.symbol));
+        break;
+    case instruction_type::VERBATIM:
+        if (cmd.instr & hcc::instruction::COMPUTE) {
+            // C-instruction
 
-                // try to simplify
-                uint16_t comp = cmd.instr & hcc::instruction::MASK_COMP;
-                comp = simplify(comp, r);
-                comp = simplify(comp, r);
-                cmd.instr = (cmd.instr & ~hcc::instruction::MASK_COMP) | comp;
+            // try to simplify
+            uint16_t comp = cmd.instr & hcc::instruction::MASK_COMP;
+            if (r.M_is_D) {
+                comp = read_D_for_M(comp);
+            }
+            comp = simplify(comp, r);
+            comp = simplify(comp, r);
+            cmd.instr = (cmd.instr & ~hcc::instruction::MASK_COMP) | comp;
 
-                constant_value result;
-                switch (comp) {
-                case hcc::instruction::COMP_ZERO:
-                    result.type = constant_value_type::ZERO;
-                    break;
-                case hcc::instruction::COMP_ONE:
-                    result.type = constant_value_type::POSITIVE_ONE;
-                    break;
-                case hcc::instruction::COMP_MINUS_ONE:
-                    result.type = constant_value_type::NEGATIVE_ONE;
-                    break;
-                case hcc::instruction::COMP_D:
-                    cmd.instr &= ~hcc::instruction::DEST_D;
-                    result = r.D;
-                    break;
-                case hcc::instruction::COMP_A:
-                    result = r.A;
-                    break;
-                case hcc::instruction::COMP_M:
-                    result = r.M;
-                    break;
-                default:
-                    // nothing
-                    break;
-                }
+            constant_value result;
+            switch (comp) {
+            case hcc::instruction::COMP_ZERO:
+                result.type = constant_value_type::ZERO;
+                break;
+            case hcc::instruction::COMP_ONE:
+                result.type = constant_value_type::POSITIVE_ONE;
+                break;
+            case hcc::instruction::COMP_MINUS_ONE:
+                result.type = constant_value_type::NEGATIVE_ONE;
+                break;
+            case hcc::instruction::COMP_D:
+                cmd.instr &= ~hcc::instruction::DEST_D;
+                result = r.D;
+                break;
+            case hcc::instruction::COMP_A:
+                result = r.A;
+                break;
+            case hcc::instruction::COMP_M:
+                result = r.M;
+                break;
+            default:
+                // nothing
+                break;
+            }
 
-                if (cmd.instr & hcc::instruction::DEST_D) {
-                    r.D = result;
-                }
-                if (cmd.instr & hcc::instruction::DEST_A) {
-                    r.A = result;
-                }
-                if (cmd.instr & hcc::instruction::DEST_M) {
-                    r.M = result;
+            if (cmd.instr & hcc::instruction::DEST_D) {
+                r.D = result;
+            }
+            if (cmd.instr & hcc::instruction::DEST_M) {
+                r.M = result;
+                const auto address = address_of(r.A);
+                if (address < 0) {
+                    std::fill(r.cells, r.cells + CELLS, constant_value());
+                } else if (address < static_cast<std::int32_t>(CELLS)) {
+                    r.cells[address] = result;
                 }
+            }
+            if (cmd.instr & hcc::instruction::DEST_A) {
+                // M is written at the old address
+                r.A = result;
+                r.M = memory_at(r.A);
+                r.M_is_D = false;
+            } else if ((cmd.instr & hcc::instruction::DEST_M)
+                       && (cmd.instr & hcc::instruction::DEST_D)) {
+                r.M_is_D = true;
+            } else if (cmd.instr & hcc::instruction::DEST_M) {
+                r.M_is_D = comp == hcc::instruction::COMP_D;
+            } else if (cmd.instr & hcc::instruction::DEST_D) {
+                r.M_is_D = comp == hcc::instruction::COMP_M;
+            }
 
-                if ((cmd.instr & (hcc::instruction::MASK_DEST | hcc::instruction::MASK_JUMP)) == 0) {
-                    cmd = NOP;
-                }
-            } else {
-                // A-instruction
+            if ((cmd.instr & (hcc::instruction::MASK_DEST | hcc::instruction::MASK_JUMP)) == 0) {
+                cmd = NOP;
+            }
+        } else {
+            // A-instruction
 
-                if (cmd.instr == 0) {
-                    handle_ainstr(constant_value(constant_value_type::ZERO));
-                } else if (cmd.instr == 1) {
-                    handle_ainstr(constant_value(constant_value_type::POSITIVE_ONE));
-                } else {
-                    handle_ainstr(
-                        constant_value(constant_value_type::OTHER, std::to_string(cmd.instr)));
-                }
+            if (cmd.instr == 0) {
+                handle_ainstr(constant_value(constant_value_type::ZERO));
+            } else if (cmd.instr == 1) {
+                handle_ainstr(constant_value(constant_value_type::POSITIVE_ONE));
+            } else {
+                handle_ainstr(constant_value(constant_value_type::OTHER, false, cmd.instr));
             }
         }
     }
-
-private:
-    registers r;
-};
+}
 
 //=============================================================================
 // LOCAL DEAD CODE ELIMINATION
 //=============================================================================
-struct dead_code_elimination {
-    void operator()(instruction& command)
-    {
-        bool live = false;
-        bool provide_A = false;
-        bool provide_D = false;
-        switch (command.type) {
-        case instruction_type::VERBATIM:
-            if (command.instr & hcc::instruction::COMPUTE) {
-                if ((command.instr & hcc::instruction::DEST_M) || (command.instr & hcc::instruction::MASK_JUMP)) {
-                    live = true;
-                }
-                if (command.instr & hcc::instruction::DEST_A) {
-                    provide_A = true;
-                }
-                if (command.instr & hcc::instruction::DEST_D) {
-                    provide_D = true;
-                }
-            } else {
+void dead_code_elimination::operator()(instruction& command)
+{
+    bool live = false;
+    bool provide_A = false;
+    bool provide_D = false;
+    switch (command.type) {
+    case instruction_type::VERBATIM:
+        if (command.instr & hcc::instruction::COMPUTE) {
+            if ((command.instr & hcc::instruction::DEST_M) || (command.instr & hcc::instruction::MASK_JUMP)) {
+                live = true;
+            }
+            if ((command.instr & hcc::instruction::MASK_JUMP) && targets_require_D) {
+                // D computed here or earlier may be read where it jumps to
+                require_D = true;
+            }
+            if (command.instr & hcc::instruction::DEST_A) {
                 provide_A = true;
             }
-            break;
-        case instruction_type::LABEL:
-        case instruction_type::COMMENT:
-            live = true;
-            break;
-        case instruction_type::LOAD:
+            if (command.instr & hcc::instruction::DEST_D) {
+                provide_D = true;
+            }
+        } else {
             provide_A = true;
-            break;
         }
+        break;
+    case instruction_type::LABEL:
+    case instruction_type::COMMENT:
+        live = true;
+        break;
+    case instruction_type::LOAD:
+        provide_A = true;
+        break;
+    }
 
-        if (require_A && provide_A) {
-            live = true;
-            require_A = false;
-        }
-        if (require_D && provide_D) {
-            live = true;
-            require_D = false;
-        }
+    if (require_A && provide_A) {
+        live = true;
+        require_A = false;
+    }
+    if (require_D && provide_D) {
+        live = true;
+        require_D = false;
+    }
 
-        if (live) {
-            if (command.type == instruction_type::VERBATIM) {
-                if (command.instr & hcc::instruction::COMPUTE) {
-                    if ((command.instr & hcc::instruction::MASK_JUMP) || (command.instr & hcc::instruction::DEST_M)) {
-                        require_A = true;
-                    }
-                    switch (command.instr & hcc::instruction::MASK_COMP) {
-                    case hcc::instruction::COMP_ZERO:
-                    case hcc::instruction::COMP_ONE:
-                    case hcc::instruction::COMP_MINUS_ONE:
-                        break;
-                    case hcc::instruction::COMP_D:
-                    case hcc::instruction::COMP_NOT_D:
-                    case hcc::instruction::COMP_MINUS_D:
-                    case hcc::instruction::COMP_D_PLUS_ONE:
-                    case hcc::instruction::COMP_D_MINUS_ONE:
-                        require_D = true;
-                        break;
-                    case hcc::instruction::COMP_A:
-                    case hcc::instruction::COMP_NOT_A:
-                    case hcc::instruction::COMP_MINUS_A:
-                    case hcc::instruction::COMP_A_PLUS_ONE:
-                    case hcc::instruction::COMP_A_MINUS_ONE:
-                    case hcc::instruction::COMP_M:
-                    case hcc::instruction::COMP_NOT_M:
-                    case hcc::instruction::COMP_MINUS_M:
-                    case hcc::instruction::COMP_M_PLUS_ONE:
-                    case hcc::instruction::COMP_M_MINUS_ONE:
-                        require_A = true;
-                        break;
-                    case hcc::instruction::COMP_D_PLUS_A:
-                    case hcc::instruction::COMP_D_MINUS_A:
-                    case hcc::instruction::COMP_A_MINUS_D:
-                    case hcc::instruction::COMP_D_AND_A:
-                    case hcc::instruction::COMP_D_OR_A:
-                    case hcc::instruction::COMP_D_PLUS_M:
-                    case hcc::instruction::COMP_D_MINUS_M:
-                    case hcc::instruction::COMP_M_MINUS_D:
-                    case hcc::instruction::COMP_D_AND_M:
-                    case hcc::instruction::COMP_D_OR_M:
-                        require_D = true;
-                        require_A = true;
-                        break;
-                    default:
-                        assert(false && "Undocumented instruction");
-                    }
+    if (live) {
+        if (command.type == instruction_type::VERBATIM) {
+            if (command.instr & hcc::instruction::COMPUTE) {
+                if ((command.instr & hcc::instruction::MASK_JUMP) || (command.instr & hcc::instruction::DEST_M)) {
+                    require_A = true;
+                }
+                switch (command.instr & hcc::instruction::MASK_COMP) {
+                case hcc::instruction::COMP_ZERO:
+                case hcc::instruction::COMP_ONE:
+                case hcc::instruction::COMP_MINUS_ONE:
+                    break;
+                case hcc::instruction::COMP_D:
+                case hcc::instruction::COMP_NOT_D:
+                case hcc::instruction::COMP_MINUS_D:
+                case hcc::instruction::COMP_D_PLUS_ONE:
+                case hcc::instruction::COMP_D_MINUS_ONE:
+                    require_D = true;
+                    break;
+                case hcc::instruction::COMP_A:
+                case hcc::instruction::COMP_NOT_A:
+                case hcc::instruction::COMP_MINUS_A:
+                case hcc::instruction::COMP_A_PLUS_ONE:
+                case hcc::instruction::COMP_A_MINUS_ONE:
+                case hcc::instruction::COMP_M:
+                case hcc::instruction::COMP_NOT_M:
+                case hcc::instruction::COMP_MINUS_M:
+                case hcc::instruction::COMP_M_PLUS_ONE:
+                case hcc::instruction::COMP_M_MINUS_ONE:
+                    require_A = true;
+                    break;
+                case hcc::instruction::COMP_D_PLUS_A:
+                case hcc::instruction::COMP_D_MINUS_A:
+                case hcc::instruction::COMP_A_MINUS_D:
+                case hcc::instruction::COMP_D_AND_A:
+                case hcc::instruction::COMP_D_OR_A:
+                case hcc::instruction::COMP_D_PLUS_M:
+                case hcc::instruction::COMP_D_MINUS_M:
+                case hcc::instruction::COMP_M_MINUS_D:
+                case hcc::instruction::COMP_D_AND_M:
+                case hcc::instruction::COMP_D_OR_M:
+                    require_D = true;
+                    require_A = true;
+                    break;
+                default:
+                    assert(false && "Undocumented instruction");
                 }
             }
-        } else {
-            command = NOP;
         }
+    } else {
+        command = NOP;
     }
-
-private:
-    bool require_A = false;
-    bool require_D = false;
-};
-
-bool is_nop(const instruction& i)
-{
-    return i == NOP;
 }
 
+namespace {
+
 template<class Iterator>
-void remove_fallthrough_jump(Iterator first, Iterator last)
+void remove_fallthrough_jump(Iterator first, Iterator last, symbol_table::id comment)
 {
     auto last_load = last;
     auto last_jump = last;
@@ -617,7 +659,7 @@ void remove_fallthrough_jump(Iterator first, Iterator last)
             if (last_load != last && first->symbol == last_load->symbol) {
                 if (last_jump != last) {
                     last_jump->type = instruction_type::COMMENT;
-                    last_jump->symbol = "fallthrough";
+                    last_jump->symbol = comment;
                 }
             }
             break;
@@ -634,9 +676,12 @@ void remove_fallthrough_jump(Iterator first, Iterator last)
 //=============================================================================
 void program::local_optimization()
 {
+    const symbol_table::id fallthrough = comments.size();
+    comments.push_back("fallthrough");
+
     // two iterations are usually enough
     for (int i = 0; i < 2; ++i) {
-        remove_fallthrough_jump(instructions.begin(), instructions.end());
+        remove_fallthrough_jump(instructions.begin(), instructions.end(), fallthrough);
 
         std::for_each(instructions.begin(), instructions.end(), constant_propagation());
 
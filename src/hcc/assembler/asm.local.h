@@ -0,0 +1,102 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/assembler/asm.h"
+
+#include <cstdint>
+
+namespace hcc {
+namespace assembler {
+
+// Passes of local_optimization(), which global_optimization() runs on basic
+// blocks, starting from what flows into them.
+
+extern const instruction NOP;
+
+bool is_nop(const instruction& i);
+
+//-----------------------------------------------------------------------------
+// Represents knowledge about value in registers
+//-----------------------------------------------------------------------------
+enum class constant_value_type {
+    UNKNOWN,
+    ZERO,
+    NEGATIVE_ONE,
+    POSITIVE_ONE,
+    OTHER,
+};
+struct constant_value {
+    constant_value(constant_value_type type = constant_value_type::UNKNOWN, bool symbolic = false,
+                   std::uint32_t other = 0)
+        : type(type)
+        , symbolic(symbolic)
+        , other(other)
+    {
+    }
+
+    constant_value_type type;
+    bool symbolic; // other is a symbol, rather than a number
+    std::uint32_t other;
+};
+bool operator==(const constant_value& a, const constant_value& b);
+
+// Words R0 to R15, which compiled code uses as registers.
+const std::size_t CELLS = 16;
+
+struct registers {
+    constant_value D;
+    constant_value A;
+    constant_value M; // at address A
+    bool M_is_D = false; // whatever their value is
+    constant_value cells[CELLS];
+};
+bool operator==(const registers& a, const registers& b);
+
+// Address of a built-in symbol, or -1 if it is not one.
+std::int32_t builtin_address(symbol_table::id symbol);
+
+//-----------------------------------------------------------------------------
+// Propagate constants in asm program, forgetting everything at labels.
+// Writes to unknown addresses forget the cells too.
+//-----------------------------------------------------------------------------
+struct constant_propagation {
+    explicit constant_propagation(const registers& r = registers())
+        : r(r)
+    {
+    }
+
+    void operator()(instruction& cmd);
+
+    const registers& state() const { return r; }
+
+private:
+    registers r;
+};
+
+//-----------------------------------------------------------------------------
+// Remove computations of A and D nobody reads, walking the program backward.
+// Unless told otherwise, code jumped to is assumed to read D.
+//-----------------------------------------------------------------------------
+struct dead_code_elimination {
+    explicit dead_code_elimination(bool require_A = false, bool require_D = false,
+                                   bool targets_require_D = true)
+        : require_A(require_A)
+        , require_D(require_D)
+        , targets_require_D(targets_require_D)
+    {
+    }
+
+    void operator()(instruction& command);
+
+    bool requires_A() const { return require_A; }
+    bool requires_D() const { return require_D; }
+
+private:
+    bool require_A;
+    bool require_D;
+    bool targets_require_D;
+};
+
+} // namespace assembler {
+} // namespace hcc {
@@ -0,0 +1,365 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/asm.h"
+#include "hcc/assembler/symbol_map.h"
+#include "hcc/cpu/cpu.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace hcc::assembler;
+using namespace hcc::instruction;
+
+std::vector<hcc::cpu::word> assemble(const std::string& text)
+{
+    std::istringstream in{text};
+    return program{in}.assemble();
+}
+
+// Message of the error thrown, or empty if none.
+std::string error(const std::string& text)
+{
+    try {
+        assemble(text);
+    } catch (const std::runtime_error& e) {
+        return e.what();
+    }
+    return {};
+}
+
+void test_parse()
+{
+    const auto code = assemble("// comment\n"
+                               "@32767\n"
+                               "\n"
+                               "(loop)\r\n"
+                               "@x\n"
+                               "AMD=D|M;JMP\n"
+                               "MD=!A\n"
+                               "0;JLE\n"
+                               "@loop\n"
+                               "@R13\n");
+    const hcc::cpu::word x = 0x10;
+    const hcc::cpu::word fixed = COMPUTE | RESERVED;
+    assert((code == std::vector<hcc::cpu::word>{
+                        32767, x, fixed | DEST_A | DEST_M | DEST_D | COMP_D_OR_M | JMP,
+                        fixed | DEST_M | DEST_D | COMP_NOT_A, fixed | COMP_ZERO | JLE, 1, 13}));
+
+    // every computation the assembler writes parses back
+    program p;
+    const hcc::cpu::word comps[] = {
+        COMP_ZERO, COMP_ONE, COMP_MINUS_ONE, COMP_D, COMP_A, COMP_NOT_D, COMP_NOT_A,
+        COMP_MINUS_D, COMP_MINUS_A, COMP_D_PLUS_ONE, COMP_A_PLUS_ONE, COMP_D_MINUS_ONE,
+        COMP_A_MINUS_ONE, COMP_D_PLUS_A, COMP_D_MINUS_A, COMP_A_MINUS_D, COMP_D_AND_A,
+        COMP_D_OR_A, COMP_M, COMP_NOT_M, COMP_MINUS_M, COMP_M_PLUS_ONE, COMP_M_MINUS_ONE,
+        COMP_D_PLUS_M, COMP_D_MINUS_M, COMP_M_MINUS_D, COMP_D_AND_M, COMP_D_OR_M,
+    };
+    for (const auto comp : comps) {
+        p.emitInstruction(DEST_D | comp | JNE);
+    }
+    const std::string filename = "asm.test.asm";
+    p.save(filename);
+    assert(program::load(filename).assemble() == p.assemble());
+    std::remove(filename.c_str());
+}
+
+void test_errors()
+{
+    assert(error("@1\nD=A\nAM=M+1;JQ\n") == "Malformed assembly at line 3: unknown jump");
+    assert(error("@32768\n") == "Malformed assembly at line 1: constant out of range");
+    assert(error("@12a\n") == "Malformed assembly at line 1: invalid constant");
+    assert(error("@\n") == "Malformed assembly at line 1: missing symbol");
+    assert(error("\n\n(loop\n") == "Malformed assembly at line 3: invalid label");
+    assert(error("()\n") == "Malformed assembly at line 1: invalid label");
+    assert(error("DD=A\n") == "Malformed assembly at line 1: unknown destination");
+    assert(error("=A\n") == "Malformed assembly at line 1: unknown destination");
+    assert(error("D=A+D\n") == "Malformed assembly at line 1: unknown computation");
+    assert(error("D=A+1+\n") == "Malformed assembly at line 1: unknown computation");
+    assert(error("D;JMPX\n") == "Malformed assembly at line 1: unknown jump");
+
+    bool thrown = false;
+    try {
+        program::load("does/not/exist.asm");
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// Runs the program until it halts, with R0 set to input. Returns the ticks taken.
+std::uint64_t run(const std::vector<hcc::cpu::word>& code, hcc::cpu::word input,
+                  hcc::cpu::RAM& ram)
+{
+    hcc::cpu::ROM rom;
+    std::copy(code.begin(), code.end(), rom.begin());
+    ram = hcc::cpu::RAM{};
+    ram[0] = input;
+    hcc::cpu::CPU cpu;
+    cpu.reset();
+    std::uint64_t ticks = 0;
+    while (ticks < 1000) {
+        std::uint64_t probed = 0;
+        const auto state = hcc::cpu::detect_loop(cpu, rom, ram, 2, probed);
+        ticks += probed;
+        if (state == hcc::cpu::activity::halted) {
+            return ticks;
+        }
+    }
+    assert(false);
+    return ticks;
+}
+
+void test_global_optimization()
+{
+    // D crosses jumps, R1 is tested right after it is set
+    std::istringstream in{"@7\n"
+                          "D=A\n"
+                          "@$store\n"
+                          "0;JMP\n"
+                          "($unused)\n"
+                          "D=0\n"
+                          "($store)\n"
+                          "@R3\n"
+                          "M=D\n"
+                          "@R0\n"
+                          "D=M\n"
+                          "@$true\n"
+                          "D;JNE\n"
+                          "@R1\n"
+                          "M=0\n"
+                          "@$join\n"
+                          "0;JMP\n"
+                          "($true)\n"
+                          "@R1\n"
+                          "M=-1\n"
+                          "($join)\n"
+                          "@R1\n"
+                          "D=M\n"
+                          "@$end\n"
+                          "D;JEQ\n"
+                          "@R2\n"
+                          "M=1\n"
+                          "($end)\n"
+                          "@$end\n"
+                          "0;JMP\n"};
+    program p{in};
+    const auto original = p.assemble();
+    p.local_optimization();
+    p.global_optimization();
+    const auto optimized = p.assemble();
+
+    for (const hcc::cpu::word input : {0, 5}) {
+        hcc::cpu::RAM expected, actual;
+        const auto before = run(original, input, expected);
+        const auto after = run(optimized, input, actual);
+        assert(expected == actual);
+        assert(actual[3] == 7);
+        assert(after < before);
+    }
+
+    // the store uses the address loaded for the jump, which goes elsewhere
+    std::istringstream store{"@5\n"
+                             "D=A\n"
+                             "@T$1\n"
+                             "M=D\n"
+                             "0;JMP\n"
+                             "(X)\n"
+                             "@X\n"
+                             "0;JMP\n"
+                             "(T$1)\n"
+                             "@T$2\n"
+                             "0;JMP\n"
+                             "(Y)\n"
+                             "@Y\n"
+                             "0;JMP\n"
+                             "(T$2)\n"
+                             "@T$2\n"
+                             "0;JMP\n"};
+    program q{store};
+    q.local_optimization();
+    q.global_optimization();
+    symbol_map symbols;
+    hcc::cpu::RAM ram;
+    run(q.assemble(&symbols), 0, ram);
+    const auto label = std::find_if(symbols.labels.begin(), symbols.labels.end(),
+                                    [](const symbol_map::symbol& s) { return s.name == "T$1"; });
+    assert(label != symbols.labels.end() && ram[label->address] == 5);
+}
+
+// Address of the label, or -1 if the program has none of that name.
+int address_of(const symbol_map& symbols, const std::string& name)
+{
+    const auto label = std::find_if(symbols.labels.begin(), symbols.labels.end(),
+                                    [&](const symbol_map::symbol& s) { return s.name == name; });
+    return label != symbols.labels.end() ? label->address : -1;
+}
+
+// How many A-instructions of the code load the address.
+std::size_t loads(const std::vector<hcc::cpu::word>& code, int address)
+{
+    return std::count(code.begin(), code.end(), address);
+}
+
+struct optimized {
+    std::vector<hcc::cpu::word> original;
+    std::vector<hcc::cpu::word> code;
+    symbol_map symbols;
+};
+
+optimized optimize(const std::string& text)
+{
+    std::istringstream in{text};
+    program p{in};
+    optimized result;
+    result.original = p.assemble();
+    p.local_optimization();
+    p.global_optimization();
+    result.code = p.assemble(&result.symbols);
+    return result;
+}
+
+void test_jump_threading()
+{
+    // the branch after T$test is known from D=-1, so its load is retargeted
+    auto known = optimize("@R0\n"
+                          "D=M\n"
+                          "@T$zero\n"
+                          "D;JEQ\n"
+                          "D=-1\n"
+                          "@T$test\n"
+                          "0;JMP\n"
+                          "(T$zero)\n"
+                          "D=0\n"
+                          "(T$test)\n"
+                          "@T$yes\n"
+                          "D;JNE\n"
+                          "@R1\n"
+                          "M=0\n"
+                          "@T$end\n"
+                          "0;JMP\n"
+                          "(T$yes)\n"
+                          "@R1\n"
+                          "M=1\n"
+                          "(T$end)\n"
+                          "@T$end\n"
+                          "0;JMP\n");
+    assert(loads(known.code, address_of(known.symbols, "T$yes")) == 2);
+    for (const hcc::cpu::word input : {0, 5}) {
+        hcc::cpu::RAM expected, actual;
+        const auto before = run(known.original, input, expected);
+        const auto after = run(known.code, input, actual);
+        assert(expected == actual);
+        assert(actual[1] == (input == 0 ? 0 : 1));
+        assert(after < before || input == 0);
+    }
+
+    // the load is also the address of a store, so @T$yes goes before the jump
+    auto stored = optimize("D=1\n"
+                           "@T$test\n"
+                           "M=D\n"
+                           "0;JMP\n"
+                           "(T$zero)\n"
+                           "D=0\n"
+                           "(T$test)\n"
+                           "@T$yes\n"
+                           "D;JNE\n"
+                           "@R1\n"
+                           "M=0\n"
+                           "@T$end\n"
+                           "0;JMP\n"
+                           "(T$yes)\n"
+                           "@R1\n"
+                           "M=1\n"
+                           "(T$end)\n"
+                           "@T$end\n"
+                           "0;JMP\n");
+    const auto test = address_of(stored.symbols, "T$test");
+    const auto yes = address_of(stored.symbols, "T$yes");
+    assert(loads(stored.code, test) == 1);
+    assert(loads(stored.code, yes) == 2);
+    {
+        hcc::cpu::RAM ram;
+        run(stored.code, 0, ram);
+        assert(ram[test] == 1);
+        assert(ram[1] == 1);
+    }
+
+    // T$zero stores, so it is not threaded through, but gets a jump of its own
+    // instead of falling into the test
+    auto fallthrough = optimize("@R0\n"
+                                "D=M\n"
+                                "@T$zero\n"
+                                "D;JEQ\n"
+                                "@T$test\n"
+                                "0;JMP\n"
+                                "(T$zero)\n"
+                                "@R3\n"
+                                "M=1\n"
+                                "D=1\n"
+                                "(T$test)\n"
+                                "D=D-1\n"
+                                "@T$pos\n"
+                                "D;JGE\n"
+                                "@R1\n"
+                                "M=0\n"
+                                "@T$end\n"
+                                "0;JMP\n"
+                                "(T$pos)\n"
+                                "@R1\n"
+                                "M=1\n"
+                                "(T$end)\n"
+                                "@T$end\n"
+                                "0;JMP\n");
+    assert(loads(fallthrough.code, address_of(fallthrough.symbols, "T$pos")) == 2);
+    for (const hcc::cpu::word input : {0, 5, 0xfffd}) {
+        hcc::cpu::RAM expected, actual;
+        const auto before = run(fallthrough.original, input, expected);
+        const auto after = run(fallthrough.code, input, actual);
+        assert(expected == actual);
+        assert(actual[1] == (input & 0x8000 ? 0 : 1));
+        assert(after < before || input != 0);
+    }
+}
+
+void test_unreachable_blocks()
+{
+    // T$ret escapes as a return address, T$dead is not reached at all
+    auto escaping = optimize("@T$ret\n"
+                             "D=A\n"
+                             "@R5\n"
+                             "M=D\n"
+                             "@F\n"
+                             "0;JMP\n"
+                             "(T$dead)\n"
+                             "@R2\n"
+                             "M=1\n"
+                             "(T$ret)\n"
+                             "@R1\n"
+                             "M=1\n"
+                             "(T$end)\n"
+                             "@T$end\n"
+                             "0;JMP\n"
+                             "(F)\n"
+                             "@R5\n"
+                             "A=M\n"
+                             "0;JMP\n");
+    assert(address_of(escaping.symbols, "T$dead") == -1);
+    assert(address_of(escaping.symbols, "T$ret") != -1);
+    assert(escaping.code.size() < escaping.original.size());
+    hcc::cpu::RAM ram;
+    run(escaping.code, 0, ram);
+    assert(ram[1] == 1 && ram[2] == 0);
+}
+
+int main()
+{
+    test_parse();
+    test_errors();
+    test_global_optimization();
+    test_jump_threading();
+    test_unreachable_blocks();
+}
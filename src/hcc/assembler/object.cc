@@ -0,0 +1,315 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/assembler/object.h"
+#include "hcc/cpu/instruction.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace hcc {
+namespace assembler {
+
+namespace {
+
+const unsigned int VERSION = 1;
+const std::size_t ROM_WORDS = sizeof(cpu::ROM) / sizeof(cpu::word);
+const cpu::word FIRST_VARIABLE = 0x10;
+
+bool unconditional_jump(cpu::word instruction)
+{
+    return (instruction & instruction::COMPUTE)
+           && (instruction & instruction::MASK_JUMP) == instruction::JMP;
+}
+
+// Pieces of objects as if linked, split at labels.
+struct pieces {
+    explicit pieces(const std::vector<object>& objects)
+        : objects(objects)
+    {
+        for (std::size_t i = 0; i < objects.size(); ++i) {
+            const auto& o = objects[i];
+            first.push_back(starts.size());
+            std::vector<cpu::word> local{0};
+            for (const auto& l : o.labels) {
+                if (l.address < o.code.size()) {
+                    local.push_back(l.address);
+                }
+                labels.emplace(l.name, std::make_pair(i, l.address));
+            }
+            local.erase(std::unique(local.begin(), local.end()), local.end());
+            if (o.code.empty()) {
+                local.clear();
+            }
+            for (const auto start : local) {
+                starts.push_back(start);
+                owners.push_back(i);
+            }
+        }
+        first.push_back(starts.size());
+    }
+
+    std::size_t size() const { return starts.size(); }
+
+    // piece containing address of given object, the next object's first at its end
+    std::size_t find(std::size_t owner, cpu::word address) const
+    {
+        if (address >= objects[owner].code.size()) {
+            return first[owner + 1];
+        }
+        const auto begin = starts.begin() + first[owner];
+        const auto end = starts.begin() + first[owner + 1];
+        return std::upper_bound(begin, end, address) - starts.begin() - 1;
+    }
+
+    cpu::word end(std::size_t piece) const
+    {
+        return piece + 1 < first[owners[piece] + 1] ? starts[piece + 1]
+                                                    : objects[owners[piece]].code.size();
+    }
+
+    const std::vector<object>& objects;
+    std::vector<cpu::word> starts; // relative to their objects
+    std::vector<std::size_t> owners;
+    std::vector<std::size_t> first; // piece of every object, and their total
+    std::unordered_map<std::string, std::pair<std::size_t, cpu::word>> labels;
+};
+
+} // namespace {
+
+std::size_t eliminate_dead_code(std::vector<object>& objects)
+{
+    const pieces p{objects};
+    std::vector<bool> reached(p.size(), false);
+    std::vector<std::size_t> work;
+    auto reach = [&](std::size_t piece) {
+        if (piece < p.size() && !reached[piece]) {
+            reached[piece] = true;
+            work.push_back(piece);
+        }
+    };
+
+    reach(0);
+    while (!work.empty()) {
+        const auto piece = work.back();
+        work.pop_back();
+        const auto owner = p.owners[piece];
+        const auto& o = objects[owner];
+        const auto start = p.starts[piece];
+        const auto end = p.end(piece);
+
+        if (!unconditional_jump(o.code[end - 1])) {
+            reach(piece + 1);
+        }
+        const auto first_relocation
+            = std::lower_bound(o.relocations.begin(), o.relocations.end(), start);
+        for (auto it = first_relocation; it != o.relocations.end() && *it < end; ++it) {
+            reach(p.find(owner, o.code[*it]));
+        }
+        const auto first_reference = std::lower_bound(
+            o.references.begin(), o.references.end(), start,
+            [](const object::reference& r, cpu::word address) { return r.address < address; });
+        for (auto it = first_reference; it != o.references.end() && it->address < end; ++it) {
+            const auto label = p.labels.find(it->symbol);
+            if (label != p.labels.end()) {
+                reach(p.find(label->second.first, label->second.second));
+            }
+        }
+    }
+
+    // new addresses of pieces reached
+    std::vector<cpu::word> moved(p.size());
+    std::size_t dropped = 0;
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        cpu::word address = 0;
+        for (auto piece = p.first[i]; piece < p.first[i + 1]; ++piece) {
+            moved[piece] = address;
+            if (reached[piece]) {
+                address += p.end(piece) - p.starts[piece];
+            } else {
+                dropped += p.end(piece) - p.starts[piece];
+            }
+        }
+    }
+    if (dropped == 0) {
+        return 0;
+    }
+
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        const auto& o = objects[i];
+        object result;
+        auto live = [&](cpu::word address) {
+            return address >= o.code.size() || reached[p.find(i, address)];
+        };
+        auto move = [&](cpu::word address) -> cpu::word {
+            if (address >= o.code.size()) {
+                return result.code.size();
+            }
+            const auto piece = p.find(i, address);
+            return moved[piece] + address - p.starts[piece];
+        };
+
+        for (auto piece = p.first[i]; piece < p.first[i + 1]; ++piece) {
+            if (reached[piece]) {
+                result.code.insert(result.code.end(), o.code.begin() + p.starts[piece],
+                                   o.code.begin() + p.end(piece));
+            }
+        }
+        for (const auto& l : o.labels) {
+            if (live(l.address)) {
+                result.labels.push_back({l.name, move(l.address)});
+            }
+        }
+        for (const auto address : o.relocations) {
+            if (live(address)) {
+                result.relocations.push_back(move(address));
+                result.code[result.relocations.back()] = move(o.code[address]);
+            }
+        }
+        for (const auto& r : o.references) {
+            if (live(r.address)) {
+                result.references.push_back({move(r.address), r.symbol});
+            }
+        }
+        objects[i] = std::move(result);
+    }
+    return dropped;
+}
+
+void object::save(std::ostream& out) const
+{
+    out << "hcc-object " << VERSION << '\n';
+    for (std::size_t i = 0; i < code.size(); i += 16) {
+        out << 'c';
+        for (std::size_t j = i; j < code.size() && j < i + 16; ++j) {
+            out << ' ' << std::hex << std::setw(4) << std::setfill('0') << code[j];
+        }
+        out << std::dec << '\n';
+    }
+    for (const auto& l : labels) {
+        out << "l " << l.address << ' ' << l.name << '\n';
+    }
+    for (const auto address : relocations) {
+        out << "r " << address << '\n';
+    }
+    for (const auto& r : references) {
+        out << "x " << r.address << ' ' << r.symbol << '\n';
+    }
+}
+
+// Single pass, items are expected to be sorted already, and refer to code
+// before them.
+object object::load(std::istream& in)
+{
+    object result;
+
+    std::string line;
+    unsigned int version = 0;
+    if (!std::getline(in, line) || !(std::istringstream{line} >> line >> version)
+        || line != "hcc-object") {
+        throw std::runtime_error("Not an object");
+    }
+    if (version != VERSION) {
+        throw std::runtime_error("Unsupported object version " + std::to_string(version));
+    }
+
+    unsigned int line_number = 1;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream ss{line};
+        char kind = 0;
+        unsigned int address = 0;
+        std::string name;
+        bool valid = false;
+        ss >> kind;
+        if (kind == 'c') {
+            valid = true;
+            while (valid && ss >> std::hex >> address) {
+                valid = address <= 0xffff && result.code.size() < ROM_WORDS;
+                result.code.push_back(address);
+            }
+            valid = valid && ss.eof();
+        } else if (kind == 'l') {
+            valid = (ss >> address >> name) && address <= result.code.size()
+                    && (result.labels.empty() || result.labels.back().address <= address);
+            if (valid) {
+                result.labels.push_back({name, static_cast<cpu::word>(address)});
+            }
+        } else if (kind == 'r') {
+            valid = (ss >> address) && address < result.code.size()
+                    && (result.relocations.empty() || result.relocations.back() < address);
+            if (valid) {
+                result.relocations.push_back(address);
+            }
+        } else if (kind == 'x') {
+            valid = (ss >> address >> name) && address < result.code.size()
+                    && (result.references.empty() || result.references.back().address < address);
+            if (valid) {
+                result.references.push_back({static_cast<cpu::word>(address), name});
+            }
+        }
+        if (!valid) {
+            throw std::runtime_error("Malformed object at line " + std::to_string(line_number));
+        }
+    }
+    return result;
+}
+
+std::vector<cpu::word> link(const std::vector<object>& objects, symbol_map* symbols)
+{
+    // first pass: place objects and their labels
+    std::unordered_map<std::string, cpu::word> table;
+    std::vector<cpu::word> bases;
+    std::size_t size = 0;
+    for (const auto& o : objects) {
+        if (size + o.code.size() > ROM_WORDS) {
+            throw std::runtime_error("Program does not fit into ROM");
+        }
+        bases.push_back(size);
+        for (const auto& l : o.labels) {
+            const cpu::word address = size + l.address;
+            if (!table.emplace(l.name, address).second) {
+                throw std::runtime_error("Duplicate label " + l.name);
+            }
+            if (symbols) {
+                symbols->labels.push_back({l.name, address});
+            }
+        }
+        size += o.code.size();
+    }
+
+    // second pass: copy code and resolve references
+    cpu::word variable = FIRST_VARIABLE;
+    std::vector<cpu::word> result;
+    result.reserve(size);
+    for (std::size_t i = 0; i < objects.size(); ++i) {
+        const auto& o = objects[i];
+        const auto base = bases[i];
+        result.insert(result.end(), o.code.begin(), o.code.end());
+        for (const auto address : o.relocations) {
+            result[base + address] += base;
+        }
+        for (const auto& r : o.references) {
+            const auto x = table.emplace(r.symbol, variable);
+            if (x.second) {
+                if (symbols) {
+                    symbols->variables.push_back({r.symbol, variable});
+                }
+                ++variable;
+            }
+            result[base + r.address] = x.first->second;
+        }
+    }
+    if (symbols) {
+        symbols->find_functions(size);
+    }
+    return result;
+}
+
+} // namespace assembler {
+} // namespace hcc {
@@ -0,0 +1,87 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/assembler/symbol_map.h"
+#include "hcc/cpu/cpu.h"
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace hcc {
+namespace assembler {
+
+/**
+ * Relocatable object: machine code of a part of a program, assembled as if
+ * placed at address 0, with what link() needs to place it elsewhere.
+ *
+ * Loads of labels defined in the object hold their address relative to its
+ * start, and are listed as relocations. Loads of other symbols, which are
+ * labels of other objects or static variables, hold 0 and are listed as
+ * references; built-in symbols such as SP or R13 are resolved already.
+ */
+struct object {
+    struct label {
+        std::string name;
+        cpu::word address; // relative
+    };
+
+    struct reference {
+        cpu::word address; // of the load
+        std::string symbol;
+    };
+
+    std::vector<cpu::word> code;
+    std::vector<label> labels; // sorted by address
+    std::vector<cpu::word> relocations; // sorted
+    std::vector<reference> references; // sorted by address
+
+    /**
+     * Text format, first the format version, then one item per line, with
+     * code split into lines of up to 16 hexadecimal words:
+     *   hcc-object 1
+     *   c <word>...
+     *   l <address> <name>
+     *   r <address>
+     *   x <address> <symbol>
+     */
+    void save(std::ostream& out) const;
+
+    /**
+     * @throws std::runtime_error if the input is not an object
+     */
+    static object load(std::istream& in);
+};
+
+/**
+ * Drop code which cannot be reached from address 0 of the first object, and
+ * labels and references in it, as if the objects were linked. Code is split
+ * at labels, and a piece is reached by loads of its labels, and by falling
+ * through from the piece before it, unless that ends with an unconditional
+ * jump. Static variables used only by dropped code are not allocated then.
+ *
+ * Programs which jump to addresses computed from labels, such as jump tables,
+ * are not supported.
+ *
+ * @return number of ROM words dropped
+ */
+std::size_t eliminate_dead_code(std::vector<object>& objects);
+
+/**
+ * Place objects one after another, starting at address 0, and resolve their
+ * references: to labels of other objects, and failing that, to static
+ * variables, allocated from 0x10 upward in the order of their first use. A
+ * single object links into what program::assemble() returns.
+ *
+ * If symbols are given, labels, functions and allocated variables are
+ * recorded there.
+ *
+ * @throws std::runtime_error if a label is defined by more than one object,
+ * or the program does not fit into ROM
+ */
+std::vector<cpu::word> link(const std::vector<object>& objects, symbol_map* symbols = nullptr);
+
+} // namespace assembler {
+} // namespace hcc {
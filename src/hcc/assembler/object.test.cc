@@ -0,0 +1,200 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/asm.h"
+#include "hcc/assembler/object.h"
+#include <cassert>
+#include <sstream>
+#include <stdexcept>
+
+using namespace hcc::assembler;
+using namespace hcc::instruction;
+
+// Main.main loops calling Math.abs, which is in another object.
+program main_program()
+{
+    program p;
+    p.emitLoadSymbolic("Main.main");
+    p.emitInstruction(COMP_ZERO | JMP);
+    p.emitLabel("Main.main"); // 2
+    p.emitLoadSymbolic("x");
+    p.emitInstruction(DEST_M | COMP_ONE);
+    p.emitLoadSymbolic("Math.abs");
+    p.emitInstruction(COMP_ZERO | JMP);
+    p.emitLoadSymbolic("R15");
+    p.emitInstruction(DEST_M | COMP_D);
+    p.emitLoadSymbolic("Main.main");
+    p.emitInstruction(COMP_ZERO | JMP);
+    return p;
+}
+
+program math_program()
+{
+    program p;
+    p.emitLabel("Math.abs"); // 0
+    p.emitLoadSymbolic("y");
+    p.emitInstruction(DEST_M | COMP_ZERO);
+    p.emitLoadSymbolic("x");
+    p.emitInstruction(DEST_M | COMP_ZERO);
+    p.emitLoadSymbolic("Math.abs");
+    p.emitInstruction(COMP_ZERO | JMP);
+    return p;
+}
+
+bool throws(const std::vector<object>& objects)
+{
+    try {
+        link(objects);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void test_assemble()
+{
+    const auto o = main_program().assemble_object();
+    assert(o.code.size() == 10);
+    assert(o.labels.size() == 1 && o.labels[0].name == "Main.main" && o.labels[0].address == 2);
+    assert((o.relocations == std::vector<hcc::cpu::word>{0, 8}));
+    assert(o.code[0] == 2 && o.code[8] == 2 && o.code[6] == 15);
+    assert(o.references.size() == 2);
+    assert(o.references[0].address == 2 && o.references[0].symbol == "x");
+    assert(o.references[1].address == 4 && o.references[1].symbol == "Math.abs");
+
+    // one object links into the program assembled
+    symbol_map symbols;
+    assert(link({o}, &symbols) == main_program().assemble());
+}
+
+void test_link()
+{
+    symbol_map symbols;
+    const auto code = link({main_program().assemble_object(), math_program().assemble_object()},
+                           &symbols);
+    assert(code.size() == 16);
+    assert(code[0] == 2 && code[8] == 2); // relocated in place
+    assert(code[4] == 10 && code[14] == 10); // Math.abs, from both objects
+    assert(code[2] == 0x10 && code[10] == 0x11 && code[12] == 0x10); // x, then y
+
+    assert(symbols.labels.size() == 2);
+    assert(symbols.labels[1].name == "Math.abs" && symbols.labels[1].address == 10);
+    assert(symbols.variables.size() == 2);
+    assert(symbols.variables[0].name == "x" && symbols.variables[1].name == "y");
+    assert(symbols.functions.size() == 2 && symbols.functions[1].end == 16);
+
+    // order matters, the first object starts at 0
+    const auto swapped = link({math_program().assemble_object(),
+                               main_program().assemble_object()});
+    assert(swapped[0] == 0x10 && swapped[6 + 2] == 0x11);
+}
+
+void test_errors()
+{
+    const auto main = main_program().assemble_object();
+    assert(throws({main, main}));
+
+    object huge;
+    huge.code.resize(0x4001);
+    assert(!throws({huge}));
+    assert(throws({huge, huge}));
+
+    program label_named_register;
+    label_named_register.emitLabel("R13");
+    bool thrown = false;
+    try {
+        label_named_register.assemble_object();
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_save_load()
+{
+    const auto o = main_program().assemble_object();
+    std::stringstream ss;
+    o.save(ss);
+    const auto loaded = object::load(ss);
+    assert(loaded.code == o.code);
+    assert(loaded.relocations == o.relocations);
+    assert(loaded.labels.size() == 1 && loaded.labels[0].name == "Main.main"
+           && loaded.labels[0].address == 2);
+    assert(loaded.references.size() == 2 && loaded.references[1].symbol == "Math.abs"
+           && loaded.references[1].address == 4);
+
+    for (const auto text : {"", "hcc-object 2\n", "hcc-object 1\nl 1 a\n",
+                            "hcc-object 1\nc 10000\n", "hcc-object 1\nc 0 1\nr 1\nr 0\n",
+                            "hcc-object 1\nc 0\nx 1 y\n", "hcc-object 1\nq\n"}) {
+        std::istringstream in{text};
+        bool thrown = false;
+        try {
+            object::load(in);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+// Math.abs is never called, nor are Main.dead and Math.max, which use z.
+void test_eliminate()
+{
+    program main;
+    main.emitLoadSymbolic("Main.main");
+    main.emitInstruction(COMP_ZERO | JMP);
+    main.emitLabel("Main.dead"); // 2
+    main.emitLoadSymbolic("z");
+    main.emitInstruction(DEST_M | COMP_ONE);
+    main.emitLoadSymbolic("Math.max");
+    main.emitInstruction(COMP_ZERO | JMP);
+    main.emitLabel("Main.main"); // 6
+    main.emitLoadSymbolic("x");
+    main.emitInstruction(COMP_D | JEQ);
+    main.emitLabel("Main.main$else"); // 8, falls through from above
+    main.emitLoadSymbolic("Math.min");
+    main.emitInstruction(COMP_ZERO | JMP);
+
+    program math;
+    math.emitLabel("Math.max"); // 0
+    math.emitLoadSymbolic("z");
+    math.emitInstruction(DEST_M | COMP_ZERO);
+    math.emitLoadSymbolic("Math.max");
+    math.emitInstruction(COMP_ZERO | JMP);
+    math.emitLabel("Math.min"); // 4
+    math.emitLoadSymbolic("Math.min$loop");
+    math.emitInstruction(COMP_ZERO | JMP);
+    math.emitLabel("Math.min$loop"); // 6
+    math.emitLoadSymbolic("y");
+    math.emitInstruction(DEST_M | COMP_ZERO);
+    math.emitLoadSymbolic("Main.main");
+    math.emitInstruction(COMP_ZERO | JMP);
+    math.emitLabel("Math.end"); // 10
+
+    std::vector<object> objects{main.assemble_object(), math.assemble_object()};
+    assert(eliminate_dead_code(objects) == 8);
+    assert(objects[0].code.size() == 6 && objects[1].code.size() == 6);
+    assert(objects[1].labels.back().name == "Math.end" && objects[1].labels.back().address == 6);
+
+    symbol_map symbols;
+    const auto code = link(objects, &symbols);
+    assert(code.size() == 12);
+    assert(code[0] == 2 && code[4] == 6); // Main.main, Math.min
+    assert(code[6] == 8 && code[10] == 2); // Math.min$loop, Main.main
+    assert(code[2] == 0x10 && code[8] == 0x11); // x, y
+    assert(symbols.variables.size() == 2);
+    assert(symbols.labels.size() == 5);
+
+    // nothing else to drop
+    assert(eliminate_dead_code(objects) == 0);
+    assert(link(objects) == code);
+}
+
+int main()
+{
+    test_assemble();
+    test_link();
+    test_errors();
+    test_save_load();
+    test_eliminate();
+}
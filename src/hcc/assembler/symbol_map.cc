@@ -0,0 +1,174 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/assembler/symbol_map.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+namespace hcc {
+namespace assembler {
+
+namespace {
+
+bool starts_with(const std::string& value, const std::string& prefix)
+{
+    return value.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool is_function(const std::string& label)
+{
+    return label.find('.') != std::string::npos && label.find('$') == std::string::npos
+           && label.find(".return.") == std::string::npos;
+}
+
+// last element starting at or before address
+template <typename T, typename Start>
+const T* find_last(const std::vector<T>& elements, cpu::word address, Start start)
+{
+    const auto it = std::upper_bound(elements.begin(), elements.end(), address,
+                                     [&](cpu::word a, const T& e) { return a < start(e); });
+    return it == elements.begin() ? nullptr : &*(it - 1);
+}
+
+} // namespace {
+
+void symbol_map::find_functions(cpu::word program_size)
+{
+    functions.clear();
+    std::string enclosing;
+    function current{"", 0, 0};
+    auto close = [&](cpu::word end) {
+        if (!current.name.empty() && current.start < end) {
+            current.end = end;
+            functions.push_back(current);
+        }
+    };
+
+    for (const auto& label : labels) {
+        std::string name;
+        if (starts_with(label.name, "__returnAddress")) {
+            name = enclosing;
+        } else if (starts_with(label.name, "__")) {
+            name = label.name;
+        } else if (is_function(label.name)) {
+            name = enclosing = label.name;
+        } else {
+            continue;
+        }
+        if (name != current.name || current.start == label.address) {
+            close(label.address);
+            current = {name, label.address, 0};
+        }
+    }
+    close(program_size);
+}
+
+void symbol_map::add_source(const std::string& function, const std::string& file,
+                            unsigned int first_line, unsigned int last_line)
+{
+    for (const auto& f : functions) {
+        if (f.name != function) {
+            continue;
+        }
+        const auto it = std::upper_bound(
+            sources.begin(), sources.end(), f.start,
+            [](cpu::word start, const source_range& s) { return start < s.start; });
+        sources.insert(it, {f.start, f.end, file, first_line, last_line});
+    }
+}
+
+const symbol_map::symbol* symbol_map::find_label(cpu::word address) const
+{
+    return find_last(labels, address, [](const symbol& s) { return s.address; });
+}
+
+const symbol_map::symbol* symbol_map::find_variable(cpu::word address) const
+{
+    const auto s = find_last(variables, address, [](const symbol& s) { return s.address; });
+    return s && s->address == address ? s : nullptr;
+}
+
+const symbol_map::function* symbol_map::find_function(cpu::word address) const
+{
+    const auto f = find_last(functions, address, [](const function& f) { return f.start; });
+    return f && address < f->end ? f : nullptr;
+}
+
+const symbol_map::source_range* symbol_map::find_source(cpu::word address) const
+{
+    const auto s = find_last(sources, address, [](const source_range& s) { return s.start; });
+    return s && address < s->end ? s : nullptr;
+}
+
+void symbol_map::save(std::ostream& out) const
+{
+    for (const auto& l : labels) {
+        out << "l " << l.address << ' ' << l.name << '\n';
+    }
+    for (const auto& v : variables) {
+        out << "v " << v.address << ' ' << v.name << '\n';
+    }
+    for (const auto& f : functions) {
+        out << "f " << f.start << ' ' << f.end << ' ' << f.name << '\n';
+    }
+    for (const auto& s : sources) {
+        out << "s " << s.start << ' ' << s.end << ' ' << s.first_line << ' ' << s.last_line << ' '
+            << s.file << '\n';
+    }
+}
+
+// Single pass, symbols are expected to be sorted already.
+symbol_map symbol_map::load(std::istream& in)
+{
+    symbol_map result;
+
+    std::string line;
+    unsigned int line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream ss{line};
+        char kind = 0;
+        unsigned int start = 0;
+        unsigned int end = 0;
+        std::string name;
+        bool valid = false;
+        ss >> kind;
+        if (kind == 'l' || kind == 'v') {
+            auto& symbols = kind == 'l' ? result.labels : result.variables;
+            valid = (ss >> start >> name) && start <= 0xffff
+                    && (symbols.empty() || symbols.back().address <= start);
+            if (valid) {
+                symbols.push_back({name, static_cast<cpu::word>(start)});
+            }
+        } else if (kind == 'f') {
+            valid = (ss >> start >> end >> name) && start < end && end <= 0xffff
+                    && (result.functions.empty() || result.functions.back().end <= start);
+            if (valid) {
+                result.functions.push_back(
+                    {name, static_cast<cpu::word>(start), static_cast<cpu::word>(end)});
+            }
+        } else if (kind == 's') {
+            unsigned int first_line = 0;
+            unsigned int last_line = 0;
+            valid = (ss >> start >> end >> first_line >> last_line) && start < end && end <= 0xffff
+                    && (result.sources.empty() || result.sources.back().end <= start)
+                    && std::getline(ss >> std::ws, name) && !name.empty();
+            if (valid) {
+                result.sources.push_back({static_cast<cpu::word>(start),
+                                          static_cast<cpu::word>(end), name, first_line,
+                                          last_line});
+            }
+        }
+        if (!valid) {
+            throw std::runtime_error("Malformed symbol map at line " + std::to_string(line_number));
+        }
+    }
+    return result;
+}
+
+} // namespace assembler {
+} // namespace hcc {
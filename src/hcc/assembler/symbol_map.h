@@ -0,0 +1,80 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace hcc {
+namespace assembler {
+
+/**
+ * Names of ROM and RAM addresses of an assembled program, for tools which
+ * only have the machine code. Every list is sorted by address, so lookups are
+ * binary searches.
+ */
+struct symbol_map {
+    struct symbol {
+        std::string name;
+        cpu::word address;
+    };
+
+    // half-open range of ROM addresses [start, end)
+    struct function {
+        std::string name;
+        cpu::word start;
+        cpu::word end;
+    };
+
+    struct source_range {
+        cpu::word start;
+        cpu::word end;
+        std::string file;
+        unsigned int first_line;
+        unsigned int last_line;
+    };
+
+    std::vector<symbol> labels; // ROM
+    std::vector<symbol> variables; // RAM, allocated by the assembler
+    std::vector<function> functions; // not overlapping
+    std::vector<source_range> sources; // not overlapping
+
+    /**
+     * Split the program into functions at labels. Functions are labeled as
+     * Class.function, and runtime stubs shared by all functions start with
+     * "__". Other labels, including return addresses "__returnAddress...",
+     * are inside of functions.
+     *
+     * @precondition labels are set
+     */
+    void find_functions(cpu::word program_size);
+
+    /**
+     * Attribute the code of given function to source lines.
+     */
+    void add_source(const std::string& function, const std::string& file, unsigned int first_line,
+                    unsigned int last_line);
+
+    // nearest label at or before address
+    const symbol* find_label(cpu::word address) const;
+    const symbol* find_variable(cpu::word address) const;
+    const function* find_function(cpu::word address) const;
+    const source_range* find_source(cpu::word address) const;
+
+    /**
+     * Text format, one symbol per line, with every kind sorted by address:
+     *   l <address> <name>
+     *   v <address> <name>
+     *   f <start> <end> <name>
+     *   s <start> <end> <first line> <last line> <file>
+     */
+    void save(std::ostream& out) const;
+    static symbol_map load(std::istream& in);
+};
+
+} // namespace assembler {
+} // namespace hcc {
@@ -0,0 +1,112 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/asm.h"
+#include "hcc/assembler/symbol_map.h"
+#include <cassert>
+#include <sstream>
+#include <stdexcept>
+
+using namespace hcc::assembler;
+using namespace hcc::instruction;
+
+// Main.main calls Math.abs through a shared stub, and continues at the return
+// address after the stub.
+symbol_map assemble_example()
+{
+    program p;
+    p.emitLoadSymbolic("Main.main");
+    p.emitInstruction(COMP_ZERO | JMP);
+    p.emitLabel("Main.main"); // 2
+    p.emitLoadSymbolic("x");
+    p.emitInstruction(DEST_M | COMP_ONE);
+    p.emitLabel("Main.main$loop"); // 4
+    p.emitLoadSymbolic("__call");
+    p.emitInstruction(COMP_ZERO | JMP);
+    p.emitLabel("__call"); // 6
+    p.emitLoadSymbolic("Math.abs");
+    p.emitInstruction(COMP_ZERO | JMP);
+    p.emitLabel("__returnAddress0"); // 8
+    p.emitLoadSymbolic("y");
+    p.emitInstruction(DEST_M | COMP_ZERO);
+    p.emitLabel("Math.abs"); // 10
+    p.emitLoadSymbolic("R15");
+    p.emitInstruction(DEST_A | COMP_M | JMP);
+
+    symbol_map symbols;
+    assert(p.assemble(&symbols).size() == 12);
+    symbols.add_source("Main.main", "Main.jack", 3, 9);
+    symbols.add_source("Math.abs", "Math.jack", 20, 25);
+    return symbols;
+}
+
+void check(const symbol_map& symbols)
+{
+    assert(symbols.labels.size() == 5);
+    assert(symbols.variables.size() == 2);
+    assert(symbols.functions.size() == 4);
+    assert(symbols.sources.size() == 3);
+
+    assert(!symbols.find_function(0));
+    assert(symbols.find_function(2)->name == "Main.main");
+    assert(symbols.find_function(5)->name == "Main.main");
+    assert(symbols.find_function(6)->name == "__call");
+    assert(symbols.find_function(9)->name == "Main.main");
+    assert(symbols.find_function(9)->start == 8);
+    assert(symbols.find_function(11)->name == "Math.abs");
+    assert(!symbols.find_function(12));
+
+    assert(!symbols.find_label(1));
+    assert(symbols.find_label(2)->name == "Main.main");
+    assert(symbols.find_label(5)->name == "Main.main$loop");
+
+    assert(symbols.find_variable(16)->name == "x");
+    assert(symbols.find_variable(17)->name == "y");
+    assert(!symbols.find_variable(18));
+
+    assert(!symbols.find_source(7));
+    assert(symbols.find_source(8)->file == "Main.jack");
+    assert(symbols.find_source(8)->first_line == 3);
+    assert(symbols.find_source(11)->file == "Math.jack");
+    assert(symbols.find_source(11)->last_line == 25);
+}
+
+void test_assemble()
+{
+    check(assemble_example());
+}
+
+void test_save_load()
+{
+    std::stringstream ss;
+    assemble_example().save(ss);
+    check(symbol_map::load(ss));
+}
+
+void test_malformed()
+{
+    const char* inputs[] = {
+        "l 5 b\nl 4 a\n", // not sorted
+        "f 4 2 Main.main\n",
+        "f 0 4 Main.main\nf 2 6 Math.abs\n", // overlapping
+        "s 0 4 1 2\n", // missing file
+        "x 1 2\n",
+    };
+    for (const auto input : inputs) {
+        std::istringstream ss{input};
+        bool thrown = false;
+        try {
+            symbol_map::load(ss);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+int main()
+{
+    test_assemble();
+    test_save_load();
+    test_malformed();
+}
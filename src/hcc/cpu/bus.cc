@@ -0,0 +1,116 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/bus.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+namespace hcc {
+namespace cpu {
+
+namespace {
+
+const std::size_t ram_size = sizeof(RAM) / sizeof(word);
+
+} // namespace {
+
+void bus::map(word first, word last, device& target)
+{
+    if (first > last || first < ram_size) {
+        throw std::invalid_argument("Devices must be mapped above RAM");
+    }
+    const auto it = std::find_if(mappings.begin(), mappings.end(),
+                                 [&](const mapping& m) { return m.first > first; });
+    const bool overlaps = (it != mappings.end() && it->first <= last)
+        || (it != mappings.begin() && std::prev(it)->last >= first);
+    if (overlaps) {
+        throw std::invalid_argument("Device mapping overlaps another one");
+    }
+    mappings.insert(it, {first, last, &target});
+}
+
+const bus::mapping* bus::find(word address) const
+{
+    for (const auto& m : mappings) {
+        if (address < m.first) {
+            break;
+        }
+        if (address <= m.last) {
+            return &m;
+        }
+    }
+    return nullptr;
+}
+
+word bus::read(word address)
+{
+    const auto m = find(address);
+    if (!m) {
+        throw std::out_of_range("Memory access outside of RAM and devices");
+    }
+    return m->target->read(address - m->first);
+}
+
+void bus::write(word address, word value)
+{
+    const auto m = find(address);
+    if (!m) {
+        throw std::out_of_range("Memory access outside of RAM and devices");
+    }
+    m->target->write(address - m->first, value);
+}
+
+word read_device(bus* io, word address)
+{
+    if (!io) {
+        throw std::out_of_range("Memory access outside of RAM");
+    }
+    return io->read(address);
+}
+
+void write_device(bus* io, word address, word value)
+{
+    if (!io) {
+        throw std::out_of_range("Memory access outside of RAM");
+    }
+    io->write(address, value);
+}
+
+timer::timer()
+    : start(clock::now())
+{
+}
+
+word timer::read(word offset)
+{
+    if (offset != 0) {
+        return high;
+    }
+    using std::chrono::milliseconds;
+    const auto elapsed = std::chrono::duration_cast<milliseconds>(clock::now() - start);
+    const auto ms = static_cast<std::uint32_t>(elapsed.count());
+    high = ms >> 16;
+    return ms & 0xffff;
+}
+
+void timer::write(word, word)
+{
+    start = clock::now();
+    high = 0;
+}
+
+word console::read(word)
+{
+    return 0;
+}
+
+void console::write(word offset, word value)
+{
+    if (offset == 0) {
+        out.put(static_cast<char>(value));
+    }
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,123 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+// conventional addresses of the devices below, right above the keyboard
+const word TIMER = 0x6001;
+const word CONSOLE = 0x6003;
+
+/**
+ * Something mapped into the address space above RAM. Offsets are relative to
+ * the first address of the mapping.
+ */
+struct device {
+    virtual ~device() = default;
+    virtual word read(word offset) = 0;
+    virtual void write(word offset, word value) = 0;
+};
+
+/**
+ * Address space of the machine. RAM, including the screen and the keyboard
+ * register, is plain memory at fixed addresses. Devices are mapped above it,
+ * and the engines only look them up when an address falls outside of RAM, so
+ * the common path costs the same bounds check it always did.
+ */
+struct bus {
+    /**
+     * Map addresses first to last, inclusive, to target.
+     *
+     * @throws std::invalid_argument if the range is inside RAM or overlaps
+     * another mapping
+     */
+    void map(word first, word last, device& target);
+
+    /**
+     * @throws std::out_of_range if nothing is mapped at address
+     */
+    word read(word address);
+    void write(word address, word value);
+
+    bool mapped(word address) const { return find(address) != nullptr; }
+
+private:
+    struct mapping {
+        word first;
+        word last;
+        device* target;
+    };
+
+    const mapping* find(word address) const;
+
+    std::vector<mapping> mappings; // ordered by address
+};
+
+/**
+ * Access M the way the CPU does: RAM directly, anything above it through the
+ * bus, if there is one.
+ *
+ * @throws std::out_of_range if the address is neither in RAM nor mapped
+ */
+word read_device(bus* io, word address);
+void write_device(bus* io, word address, word value);
+
+inline word read_memory(const RAM& ram, bus* io, word address)
+{
+    return address < ram.size() ? ram[address] : read_device(io, address);
+}
+
+inline void write_memory(RAM& ram, bus* io, word address, word value)
+{
+    if (address < ram.size()) {
+        ram[address] = value;
+    } else {
+        write_device(io, address, value);
+    }
+}
+
+/**
+ * Milliseconds since created, or since last written to, as a 32-bit number.
+ * Reading the low word at offset 0 latches the high word at offset 1, so the
+ * two are consistent. Follows the host clock, so runs reading it are not
+ * repeatable.
+ */
+struct timer : device {
+    using clock = std::chrono::steady_clock;
+
+    timer();
+    word read(word offset) override;
+    void write(word offset, word value) override;
+
+private:
+    clock::time_point start;
+    word high = 0;
+};
+
+/**
+ * Output port: every word written at offset 0 is put to the host stream as
+ * one character, without drawing anything on the screen. Reads as zero.
+ */
+struct console : device {
+    explicit console(std::ostream& out)
+        : out(out)
+    {
+    }
+
+    word read(word offset) override;
+    void write(word offset, word value) override;
+
+private:
+    std::ostream& out;
+};
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,180 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/bus.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/interpreter.h"
+#include "hcc/cpu/jit.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+// Counts reads, and remembers writes with their offsets.
+struct probe : device {
+    word read(word offset) override { return offset + ++reads; }
+    void write(word offset, word value) override { writes.push_back(offset << 12 | value); }
+
+    word reads = 0;
+    std::vector<word> writes;
+};
+
+void test_map()
+{
+    probe a, b;
+    bus io;
+    io.map(0x7000, 0x7001, a);
+    io.map(0x6800, 0x6800, b);
+
+    const std::pair<word, word> invalid[] = {
+        {0x5000, 0x7fff}, // inside RAM
+        {KEYBOARD, KEYBOARD}, // keyboard is RAM
+        {0x7001, 0x7002}, // overlaps
+        {0x6000, 0x6900}, // contains
+        {0x7fff, 0x7ffe}, // empty
+    };
+    for (const auto& range : invalid) {
+        bool thrown = false;
+        try {
+            io.map(range.first, range.second, a);
+        } catch (const std::invalid_argument&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    assert(io.mapped(0x7001) && io.mapped(0x6800));
+    assert(!io.mapped(0x7002) && !io.mapped(0x6801) && !io.mapped(KEYBOARD + 1));
+    assert(io.read(0x7001) == 2);
+    io.write(0x6800, 5);
+    assert(b.writes == std::vector<word>{5});
+
+    bool thrown = false;
+    try {
+        io.read(0x7002);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+// loop: @0x7000; D=M; @0x7001; M=D; @0; M=M+1; @loop; 0;JMP
+void device_rom(ROM& rom)
+{
+    const word program[] = {
+        0x7000, COMPUTE | RESERVED | DEST_D | COMP_M,
+        0x7001, COMPUTE | RESERVED | DEST_M | COMP_D,
+        0,      COMPUTE | RESERVED | DEST_M | COMP_M_PLUS_ONE,
+        0,      COMPUTE | RESERVED | COMP_ZERO | JMP,
+    };
+    std::copy(std::begin(program), std::end(program), rom.begin());
+}
+
+// Every engine sees the devices the same way CPU::step() does, no matter
+// where the runs are cut.
+template <typename engine_type>
+void test_engine()
+{
+    std::unique_ptr<ROM> rom{new ROM()};
+    device_rom(*rom);
+
+    probe expected_device;
+    bus expected_io;
+    expected_io.map(0x7000, 0x7001, expected_device);
+    CPU expected_cpu{0, 0, 0};
+    std::unique_ptr<RAM> expected_ram{new RAM()};
+    for (int i = 0; i < 100000; ++i) {
+        expected_cpu.step(*rom, *expected_ram, &expected_io);
+    }
+
+    probe actual_device;
+    bus actual_io;
+    actual_io.map(0x7000, 0x7001, actual_device);
+    CPU actual_cpu{0, 0, 0};
+    std::unique_ptr<RAM> actual_ram{new RAM()};
+    engine_type engine;
+    engine.load(*rom);
+    engine.set_bus(&actual_io);
+    int ticks = 0;
+    for (int chunk = 1; chunk < 1000; chunk += 7) {
+        engine.run(actual_cpu, *actual_ram, 100);
+        engine.run(actual_cpu, *actual_ram, chunk % 3);
+        ticks += 100 + chunk % 3;
+    }
+    engine.run(actual_cpu, *actual_ram, 100000 - ticks);
+
+    assert(actual_cpu.pc == expected_cpu.pc);
+    assert(actual_cpu.a == expected_cpu.a);
+    assert(actual_cpu.d == expected_cpu.d);
+    assert(*actual_ram == *expected_ram);
+    assert(actual_device.reads == expected_device.reads);
+    assert(actual_device.writes == expected_device.writes);
+    assert(expected_device.reads > 10000);
+
+    // without bus, the same program faults at the first device access
+    engine_type plain;
+    plain.load(*rom);
+    CPU cpu{0, 0, 0};
+    bool thrown = false;
+    try {
+        plain.run(cpu, *actual_ram, 100000);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(cpu.pc == 1);
+}
+
+void test_detect_loop()
+{
+    std::unique_ptr<ROM> rom{new ROM()};
+    std::unique_ptr<RAM> ram{new RAM()};
+    // loop: @0x7000; D=M; @loop; 0;JMP
+    (*rom)[0] = 0x7000;
+    (*rom)[1] = COMPUTE | RESERVED | DEST_D | COMP_M;
+    (*rom)[2] = 0;
+    (*rom)[3] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    probe p;
+    bus io;
+    io.map(0x7000, 0x7000, p);
+    CPU cpu{0, 0, 0};
+    std::uint64_t ticks = 0;
+    assert(detect_loop(cpu, *rom, *ram, 1000, ticks, nullptr, &io) == activity::running);
+    assert(ticks == 2);
+    assert(p.reads == 1);
+}
+
+void test_devices()
+{
+    std::ostringstream out;
+    console c{out};
+    timer t;
+    bus io;
+    io.map(TIMER, TIMER + 1, t);
+    io.map(CONSOLE, CONSOLE, c);
+    io.write(CONSOLE, 'h');
+    io.write(CONSOLE, 'i');
+    assert(out.str() == "hi");
+    assert(io.read(CONSOLE) == 0);
+
+    const word low = io.read(TIMER);
+    const word high = io.read(TIMER + 1);
+    assert(high == 0 && low < 10000);
+    io.write(TIMER, 0);
+}
+
+int main()
+{
+    test_map();
+    test_engine<interpreter>();
+    test_engine<jit>();
+    test_detect_loop();
+    test_devices();
+}
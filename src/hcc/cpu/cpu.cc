@@ -2,7 +2,13 @@
 // See LICENSE for details
 #include "hcc/cpu/cpu.h"
 
+#include "hcc/cpu/bus.h"
 #include "hcc/cpu/instruction.h"
+#include "hcc/cpu/screen.h"
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace hcc {
 namespace cpu {
@@ -48,7 +54,7 @@ void CPU::reset()
     d = 0;
 }
 
-void CPU::step(const ROM& rom, RAM& ram)
+void CPU::step(const ROM& rom, RAM& ram, bus* io)
 {
     auto olda = a;
     auto instruction = rom.at(pc);
@@ -57,7 +63,7 @@ void CPU::step(const ROM& rom, RAM& ram)
         // COMP
         word out;
         bool zr, ng;
-        comp(instruction, d, (instruction & FETCH) ? ram.at(olda) : a, out, zr, ng);
+        comp(instruction, d, (instruction & FETCH) ? read_memory(ram, io, olda) : a, out, zr, ng);
 
         // DEST
         if (instruction & DEST_A) {
@@ -67,7 +73,7 @@ void CPU::step(const ROM& rom, RAM& ram)
             d = out;
         }
         if (instruction & DEST_M) {
-            ram.at(olda) = out;
+            write_memory(ram, io, olda, out);
         }
 
         // JUMP
@@ -82,5 +88,64 @@ void CPU::step(const ROM& rom, RAM& ram)
     }
 }
 
+activity detect_loop(CPU& cpu, const ROM& rom, RAM& ram, std::uint64_t limit,
+                     std::uint64_t& ticks, screen_dirty* dirty, bus* io)
+{
+    const CPU start = cpu;
+    bool keyboard = false;
+
+    // first value of every written address
+    std::vector<std::pair<word, word>> written;
+    std::vector<bool> seen(ram.size());
+
+    const auto restored = [&] {
+        for (const auto& entry : written) {
+            if (ram[entry.first] != entry.second) {
+                return false;
+            }
+        }
+        return true;
+    };
+    const auto mark_changes = [&] {
+        for (const auto& entry : written) {
+            if (dirty && ram[entry.first] != entry.second) {
+                dirty->mark(entry.first);
+            }
+        }
+    };
+
+    for (ticks = 0; ticks < limit;) {
+        const auto instruction = rom.at(cpu.pc);
+        if ((instruction & COMPUTE) && (instruction & FETCH) && cpu.a == KEYBOARD) {
+            keyboard = true;
+        }
+        if ((instruction & COMPUTE) && (instruction & DEST_M) && cpu.a < ram.size()
+            && !seen[cpu.a]) {
+            seen[cpu.a] = true;
+            written.emplace_back(cpu.a, ram[cpu.a]);
+        }
+        const bool device = (instruction & COMPUTE) && (instruction & (FETCH | DEST_M))
+            && cpu.a >= ram.size() && io && io->mapped(cpu.a);
+
+        try {
+            cpu.step(rom, ram, io);
+        } catch (const std::out_of_range&) {
+            mark_changes();
+            throw;
+        }
+        ++ticks;
+
+        if (device) {
+            mark_changes();
+            return activity::running;
+        }
+        if (cpu.pc == start.pc && cpu.a == start.a && cpu.d == start.d && restored()) {
+            return keyboard ? activity::idle : activity::halted;
+        }
+    }
+    mark_changes();
+    return activity::running;
+}
+
 } // namespace cpu {
 } // namespace hcc {
@@ -18,17 +18,47 @@ struct RAM : std::array<word, 0x6001> {
     RAM() : std::array<word, 0x6001>{} {}
 };
 
+struct bus;
+struct screen_dirty;
+
 struct CPU {
     word pc; // program counter
     word a; // register A
     word d; // register D
 
     void reset();
-    void step(const ROM& rom, RAM& ram);
+
+    /**
+     * Execute one instruction. Addresses above RAM go to devices mapped on
+     * io, if given.
+     *
+     * @throws std::out_of_range outside of ROM, or outside of RAM and devices
+     */
+    void step(const ROM& rom, RAM& ram, bus* io = nullptr);
 };
 
 void comp(word instr, word x, word y, word& out, bool& zr, bool& ng);
 bool jump(word instr, bool zr, bool ng);
 
+// memory mapped keyboard register
+const word KEYBOARD = 0x6000;
+
+enum class activity {
+    running, // not caught in a loop, as far as we know
+    idle, // looping without changing anything, until the keyboard changes
+    halted, // looping without changing anything, forever
+};
+
+/**
+ * Step the CPU at most limit times, looking for a loop which brings registers
+ * and RAM back to the state they were in when called. Such a loop repeats
+ * until the keyboard changes, or forever if it does not read the keyboard.
+ * Stops right after the loop closes; ticks receives the number of steps taken.
+ * If dirty is given, screen rows changed on the way are marked in it.
+ * Devices on io are never assumed to be idle, touching one ends the search.
+ */
+activity detect_loop(CPU& cpu, const ROM& rom, RAM& ram, std::uint64_t limit,
+                     std::uint64_t& ticks, screen_dirty* dirty = nullptr, bus* io = nullptr);
+
 } // namespace cpu {
 } // namespace hcc {
@@ -0,0 +1,91 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/cpu.h"
+#include "hcc/cpu/instruction.h"
+#include <cassert>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+activity detect(const ROM& rom, std::uint64_t warmup, std::uint64_t& ticks)
+{
+    CPU cpu;
+    cpu.reset();
+    RAM ram;
+    for (std::uint64_t i = 0; i < warmup; ++i) {
+        cpu.step(rom, ram);
+    }
+    return detect_loop(cpu, rom, ram, 100, ticks);
+}
+
+// (loop) @loop; 0;JMP
+void test_halt()
+{
+    ROM rom;
+    rom[0] = 0;
+    rom[1] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    std::uint64_t ticks = 0;
+    assert(detect(rom, 0, ticks) == activity::halted);
+    assert(ticks == 2);
+    assert(detect(rom, 1, ticks) == activity::halted);
+    assert(ticks == 2);
+}
+
+// (loop) @KBD; D=M; @loop; D;JEQ
+void test_keyboard()
+{
+    ROM rom;
+    rom[0] = KEYBOARD;
+    rom[1] = COMPUTE | RESERVED | DEST_D | COMP_M;
+    rom[2] = 0;
+    rom[3] = COMPUTE | RESERVED | COMP_D | JEQ;
+
+    std::uint64_t ticks = 0;
+    assert(detect(rom, 0, ticks) == activity::idle);
+    assert(ticks == 4);
+    assert(detect(rom, 6, ticks) == activity::idle);
+    assert(ticks == 4);
+}
+
+// Writes which leave RAM as it was do not count, like a call pushing and
+// popping the same return address.
+// (loop) @100; M=M+1; M=M-1; @loop; 0;JMP
+void test_restored_writes()
+{
+    ROM rom;
+    rom[0] = 100;
+    rom[1] = COMPUTE | RESERVED | DEST_M | COMP_M_PLUS_ONE;
+    rom[2] = COMPUTE | RESERVED | DEST_M | COMP_M_MINUS_ONE;
+    rom[3] = 0;
+    rom[4] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    std::uint64_t ticks = 0;
+    assert(detect(rom, 0, ticks) == activity::halted);
+    assert(ticks == 5);
+    assert(detect(rom, 7, ticks) == activity::halted);
+    assert(ticks == 5);
+}
+
+// (loop) @100; M=M+1; @loop; 0;JMP
+void test_counter()
+{
+    ROM rom;
+    rom[0] = 100;
+    rom[1] = COMPUTE | RESERVED | DEST_M | COMP_M_PLUS_ONE;
+    rom[2] = 0;
+    rom[3] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    std::uint64_t ticks = 0;
+    assert(detect(rom, 4, ticks) == activity::running);
+    assert(ticks == 100);
+}
+
+int main()
+{
+    test_halt();
+    test_keyboard();
+    test_restored_writes();
+    test_counter();
+}
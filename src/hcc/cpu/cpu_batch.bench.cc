@@ -0,0 +1,106 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/cpu_batch.h"
+#include "hcc/cpu/instruction.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+namespace {
+
+const std::uint64_t TICKS = 1 << 24; // in total, for every measurement
+const int RUNS = 3; // of every measurement, the fastest one counts
+
+// Counts down from R2 over and over, adding to R1, so lanes with different
+// R2 leave the loop at different times.
+ROM countdown_rom()
+{
+    ROM rom;
+    // @2; D=M; @0; M=D; loop: @1; M=M+1; @0; MD=M-1; @loop; D;JGT; @0; 0;JMP
+    rom[0] = 2;
+    rom[1] = COMPUTE | RESERVED | DEST_D | COMP_M;
+    rom[2] = 0;
+    rom[3] = COMPUTE | RESERVED | DEST_M | COMP_D;
+    rom[4] = 1;
+    rom[5] = COMPUTE | RESERVED | DEST_M | COMP_M_PLUS_ONE;
+    rom[6] = 0;
+    rom[7] = COMPUTE | RESERVED | DEST_M | DEST_D | COMP_M_MINUS_ONE;
+    rom[8] = 4;
+    rom[9] = COMPUTE | RESERVED | COMP_D | JGT;
+    rom[10] = 0;
+    rom[11] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+    return rom;
+}
+
+word input(std::size_t lane, bool divergent)
+{
+    return divergent ? 1 + lane * 37 % 61 : 30;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Millions of ticks per second, stepping every machine on its own.
+double scalar(const ROM& rom, std::size_t lanes, bool divergent)
+{
+    std::vector<CPU> cpus(lanes);
+    std::vector<std::unique_ptr<RAM>> rams;
+    for (std::size_t l = 0; l < lanes; ++l) {
+        rams.emplace_back(new RAM());
+        (*rams[l])[2] = input(l, divergent);
+        cpus[l].reset();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t l = 0; l < lanes; ++l) {
+        for (std::uint64_t i = 0; i < TICKS / lanes; ++i) {
+            cpus[l].step(rom, *rams[l]);
+        }
+    }
+    return TICKS / seconds_since(start) / 1e6;
+}
+
+// Millions of ticks per second, running all machines as lanes of one batch.
+double batch(const ROM& rom, std::size_t lanes, bool divergent)
+{
+    cpu_batch b{rom, lanes};
+    for (std::size_t l = 0; l < lanes; ++l) {
+        b.memory(l, 2) = input(l, divergent);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    b.run(TICKS / lanes);
+    return TICKS / seconds_since(start) / 1e6;
+}
+
+template <typename F>
+double best(F measure)
+{
+    double result = 0;
+    for (int i = 0; i < RUNS; ++i) {
+        result = std::max(result, measure());
+    }
+    return result;
+}
+
+} // namespace {
+
+int main()
+{
+    const auto rom = countdown_rom();
+    std::cout << "Million ticks per second, " << TICKS << " ticks in total\n"
+              << "lanes       scalar  batch same  batch divergent\n";
+    for (const std::size_t lanes : {1, 4, 16, 64, 256}) {
+        std::cout << std::setw(5) << lanes << std::fixed << std::setprecision(1) << std::setw(13)
+                  << best([&] { return scalar(rom, lanes, true); }) << std::setw(12)
+                  << best([&] { return batch(rom, lanes, false); }) << std::setw(17)
+                  << best([&] { return batch(rom, lanes, true); }) << '\n';
+    }
+}
@@ -0,0 +1,447 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/cpu_batch.h"
+
+#include "hcc/cpu/instruction.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace hcc {
+namespace cpu {
+
+using namespace instruction;
+
+namespace {
+
+const std::size_t ram_size = sizeof(RAM) / sizeof(word);
+
+// Lanes run one by one when fewer than one in this many share the program
+// counter executed next.
+const std::size_t DIVERGED = 2;
+
+// Ticks each lane runs on its own before lanes are regrouped.
+const std::uint64_t SLICE = 1024;
+
+// Lanes processed at once, one word each.
+const std::size_t WIDTH = 8;
+
+// all ones if flag is set
+word mask(word instruction, word flag)
+{
+    return (instruction & flag) ? 0xffff : 0;
+}
+
+#if defined(__SSE2__)
+
+using vector = __m128i;
+
+vector load(const word* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+void store(word* p, vector v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+vector splat(word w) { return _mm_set1_epi16(static_cast<short>(w)); }
+vector bit_and(vector x, vector y) { return _mm_and_si128(x, y); }
+vector bit_or(vector x, vector y) { return _mm_or_si128(x, y); }
+vector bit_xor(vector x, vector y) { return _mm_xor_si128(x, y); }
+vector add(vector x, vector y) { return _mm_add_epi16(x, y); }
+vector equal(vector x, vector y) { return _mm_cmpeq_epi16(x, y); }
+vector negative(vector x) { return _mm_srai_epi16(x, 15); }
+bool none(vector x) { return _mm_movemask_epi8(x) == 0; }
+bool all(vector x) { return _mm_movemask_epi8(x) == 0xffff; }
+
+// x where s is all ones, y where it is zero
+vector select(vector s, vector x, vector y)
+{
+    return _mm_or_si128(_mm_and_si128(s, x), _mm_andnot_si128(s, y));
+}
+
+#else
+
+struct vector {
+    word w[WIDTH];
+};
+
+vector load(const word* p)
+{
+    vector v;
+    std::copy(p, p + WIDTH, v.w);
+    return v;
+}
+
+void store(word* p, vector v) { std::copy(v.w, v.w + WIDTH, p); }
+
+vector splat(word w)
+{
+    vector v;
+    std::fill(v.w, v.w + WIDTH, w);
+    return v;
+}
+
+template <typename F>
+vector lanewise(vector x, vector y, F f)
+{
+    for (std::size_t i = 0; i < WIDTH; ++i) {
+        x.w[i] = f(x.w[i], y.w[i]);
+    }
+    return x;
+}
+
+vector bit_and(vector x, vector y) { return lanewise(x, y, [](word i, word j) { return i & j; }); }
+vector bit_or(vector x, vector y) { return lanewise(x, y, [](word i, word j) { return i | j; }); }
+vector bit_xor(vector x, vector y) { return lanewise(x, y, [](word i, word j) { return i ^ j; }); }
+vector add(vector x, vector y) { return lanewise(x, y, [](word i, word j) { return i + j; }); }
+
+vector equal(vector x, vector y)
+{
+    return lanewise(x, y, [](word i, word j) { return (i == j) ? 0xffff : 0; });
+}
+
+vector negative(vector x)
+{
+    return lanewise(x, x, [](word i, word) { return (i & 0x8000) ? 0xffff : 0; });
+}
+
+bool none(vector x) { return std::all_of(x.w, x.w + WIDTH, [](word i) { return i == 0; }); }
+bool all(vector x) { return std::all_of(x.w, x.w + WIDTH, [](word i) { return i == 0xffff; }); }
+
+// x where s is all ones, y where it is zero
+vector select(vector s, vector x, vector y)
+{
+    return bit_or(bit_and(s, x), bit_and(bit_xor(s, splat(0xffff)), y));
+}
+
+#endif
+
+} // namespace {
+
+cpu_batch::cpu_batch(const ROM& rom_, std::size_t lanes_)
+    : rom(rom_.begin(), rom_.end())
+    , lanes(lanes_)
+    , stride((lanes + WIDTH - 1) / WIDTH * WIDTH)
+    , pc(stride)
+    , a(stride)
+    , d(stride)
+    , bank(ram_size * stride)
+    , faulted_(lanes)
+    , remaining(lanes)
+    , selected(stride)
+    , m(stride)
+    , out(stride)
+    , taken(stride)
+{
+    reset();
+}
+
+void cpu_batch::reset()
+{
+    std::fill(pc.begin(), pc.end(), 0);
+    std::fill(a.begin(), a.end(), 0);
+    std::fill(d.begin(), d.end(), 0);
+    std::fill(faulted_.begin(), faulted_.end(), false);
+}
+
+CPU cpu_batch::get_cpu(std::size_t lane) const
+{
+    // registers are padded, check against the real lanes
+    if (lane >= lanes) {
+        throw std::out_of_range("cpu_batch::get_cpu");
+    }
+    return {pc[lane], a[lane], d[lane]};
+}
+
+void cpu_batch::set_cpu(std::size_t lane, const CPU& cpu)
+{
+    if (lane >= lanes) {
+        throw std::out_of_range("cpu_batch::set_cpu");
+    }
+    pc[lane] = cpu.pc;
+    a[lane] = cpu.a;
+    d[lane] = cpu.d;
+}
+
+void cpu_batch::run(std::uint64_t ticks)
+{
+    for (std::size_t l = 0; l < lanes; ++l) {
+        remaining[l] = faulted_[l] ? 0 : ticks;
+    }
+
+    for (;;) {
+        // lowest program counter among lanes with ticks left, how many lanes
+        // are there, and the next higher one, where other lanes wait
+        unsigned int next = 0x10000;
+        unsigned int after = 0x10000;
+        std::size_t sharing = 0;
+        std::size_t active = 0;
+        for (std::size_t l = 0; l < lanes; ++l) {
+            if (remaining[l] > 0) {
+                ++active;
+                if (pc[l] < next) {
+                    after = next;
+                    next = pc[l];
+                    sharing = 0;
+                } else if (pc[l] > next && pc[l] < after) {
+                    after = pc[l];
+                }
+                sharing += pc[l] == next;
+            }
+        }
+        if (active == 0) {
+            return;
+        }
+
+        if (sharing == 1 || sharing * DIVERGED < active) {
+            // a group would leave most lanes idle, run them one by one for a
+            // while and see if they meet again
+            for (std::size_t l = 0; l < lanes; ++l) {
+                if (remaining[l] > 0) {
+                    run_lane(l, std::min<std::uint64_t>(remaining[l], SLICE));
+                }
+            }
+            continue;
+        }
+
+        std::uint64_t group_ticks = std::numeric_limits<std::uint64_t>::max();
+        for (std::size_t l = 0; l < lanes; ++l) {
+            const bool member = remaining[l] > 0 && pc[l] == next;
+            selected[l] = member ? 0xffff : 0;
+            if (member) {
+                group_ticks = std::min(group_ticks, remaining[l]);
+            }
+        }
+        run_group(next, after, group_ticks);
+    }
+}
+
+// Whether A is the same on all selected lanes, and its value if so.
+bool cpu_batch::shared_a(word& value) const
+{
+    const auto first = std::find(selected.begin(), selected.end(), 0xffff);
+    if (first == selected.end()) {
+        return false;
+    }
+    value = a[first - selected.begin()];
+    const vector v = splat(value);
+    for (std::size_t l = 0; l < stride; l += WIDTH) {
+        const vector s = load(&selected[l]);
+        if (!all(select(s, equal(load(&a[l]), v), s))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Executes instructions on the selected lanes in lockstep, the same way
+// CPU::step() does, from program counter start until they take different
+// branches, reach program counter stop, or run given number of ticks.
+void cpu_batch::run_group(word start, unsigned int stop, std::uint64_t ticks)
+{
+    word* const sel = selected.data();
+    std::size_t members = std::count(selected.begin(), selected.end(), 0xffff);
+    auto fault = [&](std::size_t lane, word at) {
+        sel[lane] = 0;
+        pc[lane] = at;
+        faulted_[lane] = true;
+        remaining[lane] = 0;
+        --members;
+    };
+
+    word p = start;
+    word a_value = 0;
+    bool a_shared = shared_a(a_value);
+    std::uint64_t done = 0;
+    for (; done < ticks && p != stop && members > 0; ++done) {
+        if (p >= rom.size()) {
+            for (std::size_t l = 0; l < lanes; ++l) {
+                if (sel[l]) {
+                    fault(l, p);
+                }
+            }
+            break;
+        }
+
+        const word instruction = rom[p];
+        if (!(instruction & COMPUTE)) {
+            const vector value = splat(instruction);
+            for (std::size_t l = 0; l < stride; l += WIDTH) {
+                store(&a[l], select(load(&sel[l]), value, load(&a[l])));
+            }
+            a_value = instruction;
+            a_shared = true;
+            ++p;
+            continue;
+        }
+
+        // a row of RAM holds M of every lane, unless the lanes disagree on A or
+        // some of them access outside of RAM
+        word* const row = (a_shared && a_value < ram_size) ? &bank[a_value * stride] : nullptr;
+
+        // M is read first, lanes reading outside of RAM fault right away
+        if ((instruction & FETCH) && !row) {
+            for (std::size_t l = 0; l < lanes; ++l) {
+                if (sel[l] && a[l] >= ram_size) {
+                    fault(l, p);
+                } else if (sel[l]) {
+                    m[l] = bank[a[l] * stride + l];
+                }
+            }
+            if (members == 0) {
+                break;
+            }
+        }
+
+        const vector keep_x = splat(~mask(instruction, ALU_ZX));
+        const vector negate_x = splat(mask(instruction, ALU_NX));
+        const vector keep_y = splat(~mask(instruction, ALU_ZY));
+        const vector negate_y = splat(mask(instruction, ALU_NY));
+        const vector sum = splat(mask(instruction, ALU_F));
+        const vector negate_out = splat(mask(instruction, ALU_NO));
+        const vector jump_neg = splat(mask(instruction, JUMP_NEG));
+        const vector jump_zero = splat(mask(instruction, JUMP_ZERO));
+        const vector jump_pos = splat(mask(instruction, JUMP_POS));
+        const bool jumps = instruction & MASK_JUMP;
+        bool any_taken = false;
+        bool all_taken = true;
+        for (std::size_t l = 0; l < stride; l += WIDTH) {
+            const vector s = load(&sel[l]);
+            const vector old_a = load(&a[l]);
+            const vector old_d = load(&d[l]);
+
+            // ALU, branch free
+            const vector y_source
+                = !(instruction & FETCH) ? old_a : row ? load(row + l) : load(&m[l]);
+            const vector x = bit_xor(bit_and(old_d, keep_x), negate_x);
+            const vector y = bit_xor(bit_and(y_source, keep_y), negate_y);
+            const vector result
+                = bit_xor(select(sum, add(x, y), bit_and(x, y)), negate_out);
+
+            // destinations, in the same order as CPU::step()
+            if (instruction & DEST_A) {
+                store(&a[l], select(s, result, old_a));
+            }
+            if (instruction & DEST_D) {
+                store(&d[l], select(s, result, old_d));
+            }
+            if ((instruction & DEST_M) && row) {
+                store(row + l, select(s, result, load(row + l)));
+            } else if (instruction & DEST_M) {
+                // written lane by lane below, at old A
+                store(&m[l], old_a);
+                store(&out[l], result);
+            }
+
+            if (jumps) {
+                const vector ng = negative(result);
+                const vector zr = equal(result, splat(0));
+                const vector pos = equal(bit_or(ng, zr), splat(0));
+                const vector t = bit_and(
+                    bit_or(bit_or(bit_and(jump_neg, ng), bit_and(jump_zero, zr)),
+                           bit_and(jump_pos, pos)),
+                    s);
+                store(&taken[l], t);
+                any_taken = any_taken || !none(t);
+                all_taken = all_taken && all(equal(t, s));
+            }
+        }
+
+        if ((instruction & DEST_M) && !row) {
+            for (std::size_t l = 0; l < lanes; ++l) {
+                if (sel[l] && m[l] >= ram_size) {
+                    fault(l, p);
+                } else if (sel[l]) {
+                    bank[m[l] * stride + l] = out[l];
+                }
+            }
+        }
+        if (instruction & DEST_A) {
+            a_shared = shared_a(a_value);
+        }
+
+        if (!jumps || !any_taken) {
+            ++p;
+        } else if (all_taken && a_shared) {
+            p = a_value;
+        } else {
+            // lanes go separate ways, regroup them
+            for (std::size_t l = 0; l < lanes; ++l) {
+                if (sel[l]) {
+                    pc[l] = taken[l] ? a[l] : p + 1;
+                    remaining[l] -= done + 1;
+                }
+            }
+            return;
+        }
+    }
+
+    for (std::size_t l = 0; l < lanes; ++l) {
+        if (sel[l]) {
+            pc[l] = p;
+            remaining[l] -= done;
+        }
+    }
+}
+
+// Executes given number of instructions on one lane, the same way
+// CPU::step() does.
+void cpu_batch::run_lane(std::size_t lane, std::uint64_t ticks)
+{
+    const word* const code = rom.data();
+    word* const memory = bank.data() + lane; // memory[address * stride]
+    word lane_pc = pc[lane];
+    word lane_a = a[lane];
+    word lane_d = d[lane];
+    bool fault = false;
+    std::uint64_t done = 0;
+    for (; done < ticks; ++done) {
+        if (lane_pc >= rom.size()) {
+            fault = true;
+            break;
+        }
+        const word instruction = code[lane_pc];
+        if (!(instruction & COMPUTE)) {
+            lane_a = instruction;
+            ++lane_pc;
+            continue;
+        }
+
+        if ((instruction & FETCH) && lane_a >= ram_size) {
+            fault = true;
+            break;
+        }
+        word out;
+        bool zr, ng;
+        comp(instruction, lane_d, (instruction & FETCH) ? memory[lane_a * stride] : lane_a, out, zr,
+             ng);
+        const word old_a = lane_a;
+        if (instruction & DEST_A) {
+            lane_a = out;
+        }
+        if (instruction & DEST_D) {
+            lane_d = out;
+        }
+        if (instruction & DEST_M) {
+            if (old_a >= ram_size) {
+                fault = true;
+                break;
+            }
+            memory[old_a * stride] = out;
+        }
+        lane_pc = jump(instruction, zr, ng) ? lane_a : lane_pc + 1;
+    }
+
+    pc[lane] = lane_pc;
+    a[lane] = lane_a;
+    d[lane] = lane_d;
+    if (fault) {
+        faulted_[lane] = true;
+        remaining[lane] = 0;
+    } else {
+        remaining[lane] -= done;
+    }
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,80 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * Runs many independent machines sharing one ROM. Registers are kept in
+ * structure-of-arrays form and RAM is interleaved by lane, so that lanes
+ * accessing the same address touch adjacent words.
+ *
+ * Lanes at the same program counter run together as a group. The group
+ * executes one instruction at a time across all of its lanes, eight lanes
+ * at a time with SSE2 where available. While the lanes agree on A, M is one
+ * contiguous row of RAM, read and written the same way; otherwise it is
+ * gathered lane by lane. The group runs until its lanes take different
+ * branches, or until it reaches the program counter where other lanes wait.
+ * Lanes are then regrouped, starting with the lowest program counter, so
+ * that lanes branching over a piece of code wait for the others to catch up.
+ * When only a few lanes share that program counter, lanes run one by one for
+ * a while instead.
+ *
+ * Where CPU::step() would throw, the lane is marked as faulted and stops, its
+ * state is left as CPU::step() leaves it.
+ */
+struct cpu_batch {
+    cpu_batch(const ROM& rom, std::size_t lanes);
+
+    std::size_t size() const { return lanes; }
+
+    /**
+     * Reset registers of all lanes and clear the faults. RAM is kept.
+     */
+    void reset();
+
+    /**
+     * Execute given number of instructions on every lane.
+     */
+    void run(std::uint64_t ticks);
+
+    /** Accessors */
+    CPU get_cpu(std::size_t lane) const;
+    void set_cpu(std::size_t lane, const CPU& cpu);
+    word& memory(std::size_t lane, word address) { return bank.at(address * stride + lane); }
+    word memory(std::size_t lane, word address) const { return bank.at(address * stride + lane); }
+    bool faulted(std::size_t lane) const { return faulted_.at(lane); }
+
+private:
+    void run_group(word start, unsigned int stop, std::uint64_t ticks);
+    bool shared_a(word& value) const;
+    void run_lane(std::size_t lane, std::uint64_t ticks);
+
+    std::vector<word> rom;
+    std::size_t lanes;
+    std::size_t stride; // lanes rounded up to whole SIMD vectors
+
+    // per lane state, padding lanes are never selected
+    std::vector<word> pc;
+    std::vector<word> a;
+    std::vector<word> d;
+    std::vector<word> bank; // address-major, bank[address * stride + lane]
+    std::vector<bool> faulted_;
+    std::vector<std::uint64_t> remaining;
+
+    // scratch, all-ones for lanes in the running group
+    std::vector<word> selected;
+    std::vector<word> m;
+    std::vector<word> out;
+    std::vector<word> taken;
+};
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,97 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/cpu_batch.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/testing.h"
+#include <cassert>
+#include <memory>
+#include <random>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+// Run every lane from a different state and compare it with an independent
+// CPU::step() run, including faults.
+void compare(const ROM& rom, std::mt19937& generator, std::size_t lanes, int chunks)
+{
+    std::uniform_int_distribution<word> any;
+    std::uniform_int_distribution<int> chunk(1, 500);
+
+    cpu_batch batch{rom, lanes};
+    std::vector<CPU> cpus(lanes);
+    std::vector<std::unique_ptr<RAM>> rams;
+    std::vector<bool> faulted(lanes);
+    for (std::size_t l = 0; l < lanes; ++l) {
+        rams.emplace_back(new RAM());
+        cpus[l].reset();
+        cpus[l].d = any(generator);
+        for (word address = 0; address < 0x100; ++address) {
+            (*rams[l])[address] = batch.memory(l, address) = any(generator);
+        }
+        batch.set_cpu(l, cpus[l]);
+    }
+
+    for (int i = 0; i < chunks; ++i) {
+        const int ticks = chunk(generator);
+        batch.run(ticks);
+        for (std::size_t l = 0; l < lanes; ++l) {
+            if (!faulted[l]) {
+                faulted[l] = !testing::reference_run(cpus[l], rom, *rams[l], ticks);
+            }
+            assert(faulted[l] == batch.faulted(l));
+            testing::assert_equal(cpus[l], batch.get_cpu(l));
+        }
+    }
+
+    for (std::size_t l = 0; l < lanes; ++l) {
+        for (unsigned int address = 0; address < rams[l]->size(); ++address) {
+            assert((*rams[l])[address] == batch.memory(l, address));
+        }
+    }
+}
+
+void test_random_programs()
+{
+    std::mt19937 generator{42};
+    for (int i = 0; i < 50; ++i) {
+        compare(testing::random_rom(generator), generator, 1 + i % 17, 10);
+    }
+}
+
+// Lanes count down from different values, then meet in a common loop.
+void test_divergence()
+{
+    ROM rom;
+    // @0; D=M; loop: @loop; D=D-1;JGT; @1; M=M+1; @end; end: 0;JMP
+    rom[0] = 0;
+    rom[1] = COMPUTE | RESERVED | DEST_D | COMP_M;
+    rom[2] = 2;
+    rom[3] = COMPUTE | RESERVED | DEST_D | COMP_D_MINUS_ONE | JGT;
+    rom[4] = 1;
+    rom[5] = COMPUTE | RESERVED | DEST_M | COMP_M_PLUS_ONE;
+    rom[6] = 7;
+    rom[7] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    const std::size_t lanes = 8;
+    cpu_batch batch{rom, lanes};
+    for (std::size_t l = 0; l < lanes; ++l) {
+        batch.memory(l, 0) = 10 * l + 1;
+    }
+    batch.run(1000);
+    for (std::size_t l = 0; l < lanes; ++l) {
+        assert(!batch.faulted(l));
+        assert(batch.get_cpu(l).pc == 7);
+        assert(batch.get_cpu(l).d == 0);
+        assert(batch.memory(l, 1) == 1);
+    }
+
+    std::mt19937 generator{4242};
+    compare(rom, generator, lanes, 20);
+}
+
+int main()
+{
+    test_random_programs();
+    test_divergence();
+}
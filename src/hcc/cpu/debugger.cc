@@ -0,0 +1,94 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/debugger.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/screen.h"
+
+using namespace hcc::instruction;
+
+namespace hcc {
+namespace cpu {
+
+const unsigned int debugger::read;
+const unsigned int debugger::write;
+const unsigned int debugger::page_words;
+
+void debugger::set_breakpoint(word address, bool enabled)
+{
+    if (address >= breakpoints.size()) {
+        if (!enabled) {
+            return;
+        }
+        breakpoints.resize(address + 1, false);
+    }
+    if (breakpoints[address] == enabled) {
+        return;
+    }
+    breakpoints[address] = enabled;
+    if (enabled) {
+        ++breakpoint_count;
+    } else {
+        --breakpoint_count;
+    }
+}
+
+void debugger::set_watchpoint(word address, unsigned int access)
+{
+    auto& p = pages[address / page_words];
+    if (!p) {
+        if (!access) {
+            return;
+        }
+        p.reset(new watch_page());
+        ++watched_pages;
+    }
+
+    const auto offset = address % page_words;
+    const bool was_watched = p->read[offset] || p->write[offset];
+    p->read[offset] = access & read;
+    p->write[offset] = access & write;
+    if (!was_watched && access) {
+        ++p->count;
+    } else if (was_watched && !access) {
+        --p->count;
+    }
+    if (p->count == 0) {
+        p.reset();
+        --watched_pages;
+    }
+}
+
+stop debugger::run(CPU& cpu, const ROM& rom, RAM& ram, std::uint64_t ticks, screen_dirty* dirty,
+                   bus* io)
+{
+    bool step_over = stopped && cpu.pc == stopped_at;
+    stopped = false;
+
+    for (std::uint64_t executed = 0; executed < ticks; ++executed) {
+        if (!step_over && breakpoint(cpu.pc)) {
+            stopped = true;
+            stopped_at = cpu.pc;
+            return {stop_reason::breakpoint, executed, cpu.pc};
+        }
+        step_over = false;
+
+        const word instruction = rom.at(cpu.pc);
+        const word address = cpu.a;
+        unsigned int access = 0;
+        if (instruction & COMPUTE) {
+            access = ((instruction & FETCH) ? read : 0) | ((instruction & DEST_M) ? write : 0);
+        }
+
+        cpu.step(rom, ram, io);
+        if (dirty && (access & write)) {
+            dirty->mark(address);
+        }
+        if (access & watchpoint(address)) {
+            return {stop_reason::watchpoint, executed + 1, address};
+        }
+    }
+    return {stop_reason::none, ticks, 0};
+}
+
+} // namespace cpu {
+} // namespace hcc {
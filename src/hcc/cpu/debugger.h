@@ -0,0 +1,97 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+struct bus;
+struct screen_dirty;
+
+// why debugger::run() returned
+enum class stop_reason {
+    none, // ticks ran out
+    breakpoint,
+    watchpoint,
+};
+
+struct stop {
+    stop_reason reason;
+    std::uint64_t ticks; // instructions executed
+    word address; // ROM address of the breakpoint, or the watched address accessed
+};
+
+/**
+ * Slow engine checking breakpoints before every instruction, and watchpoints
+ * on every memory access. The fast engines know nothing about either, so that
+ * they cost nothing until some are set and this engine is used instead, see
+ * empty().
+ */
+struct debugger {
+    // kinds of accesses watched, combined as bits
+    static const unsigned int read = 1;
+    static const unsigned int write = 2;
+
+    void set_breakpoint(word address, bool enabled);
+    bool breakpoint(word address) const
+    {
+        return address < breakpoints.size() && breakpoints[address];
+    }
+
+    /**
+     * Watch accesses to address, or stop watching it if access is zero.
+     * Addresses above RAM watch devices.
+     */
+    void set_watchpoint(word address, unsigned int access);
+    unsigned int watchpoint(word address) const
+    {
+        const auto& p = pages[address / page_words];
+        if (!p) {
+            return 0;
+        }
+        const auto offset = address % page_words;
+        return (p->read[offset] ? read : 0) | (p->write[offset] ? write : 0);
+    }
+
+    // no breakpoints and no watchpoints
+    bool empty() const { return breakpoint_count == 0 && watched_pages == 0; }
+
+    /**
+     * Execute up to ticks instructions, as CPU::step() does. Stops before an
+     * instruction at a breakpoint, except when the last run stopped there, so
+     * that running again steps over it. Stops after an instruction accessing a
+     * watched address. If dirty is given, screen rows changed are marked in
+     * it.
+     */
+    stop run(CPU& cpu, const ROM& rom, RAM& ram, std::uint64_t ticks, screen_dirty* dirty = nullptr,
+             bus* io = nullptr);
+
+private:
+    static const unsigned int page_words = 256;
+
+    // allocated only for pages with something watched
+    struct watch_page {
+        std::bitset<page_words> read;
+        std::bitset<page_words> write;
+        unsigned int count = 0;
+    };
+
+    std::vector<bool> breakpoints; // by ROM address
+    unsigned int breakpoint_count = 0;
+    std::unique_ptr<watch_page> pages[0x10000 / page_words];
+    unsigned int watched_pages = 0;
+
+    // a breakpoint where the last run stopped
+    bool stopped = false;
+    word stopped_at = 0;
+};
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,103 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/debugger.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/screen.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+// loop: @100; M=M+1; D=M; @0x4000; M=D; @loop; 0;JMP
+void counter_rom(ROM& rom)
+{
+    const word program[] = {
+        100,    COMPUTE | RESERVED | DEST_M | COMP_M_PLUS_ONE,
+        COMPUTE | RESERVED | DEST_D | COMP_M,
+        0x4000, COMPUTE | RESERVED | DEST_M | COMP_D,
+        0,      COMPUTE | RESERVED | COMP_ZERO | JMP,
+    };
+    std::copy(std::begin(program), std::end(program), rom.begin());
+}
+
+void test_points()
+{
+    debugger d;
+    assert(d.empty());
+
+    d.set_breakpoint(10, true);
+    d.set_breakpoint(10, true);
+    assert(!d.empty() && d.breakpoint(10) && !d.breakpoint(11) && !d.breakpoint(0x7fff));
+    d.set_breakpoint(10, false);
+    d.set_breakpoint(5000, false);
+    assert(d.empty());
+
+    d.set_watchpoint(0x4000, debugger::write);
+    d.set_watchpoint(0x40ff, debugger::read | debugger::write);
+    assert(!d.empty());
+    assert(d.watchpoint(0x4000) == debugger::write);
+    assert(d.watchpoint(0x40ff) == (debugger::read | debugger::write));
+    assert(d.watchpoint(0x4001) == 0 && d.watchpoint(0x4100) == 0);
+    d.set_watchpoint(0x4000, 0);
+    assert(!d.empty());
+    d.set_watchpoint(0x40ff, 0);
+    d.set_watchpoint(0x1234, 0);
+    assert(d.empty());
+}
+
+// Runs match CPU::step(), and stop where asked to.
+void test_run()
+{
+    std::unique_ptr<ROM> rom{new ROM()};
+    counter_rom(*rom);
+
+    CPU expected_cpu{0, 0, 0};
+    std::unique_ptr<RAM> expected_ram{new RAM()};
+    for (int i = 0; i < 1000; ++i) {
+        expected_cpu.step(*rom, *expected_ram);
+    }
+
+    debugger d;
+    CPU cpu{0, 0, 0};
+    std::unique_ptr<RAM> ram{new RAM()};
+    auto s = d.run(cpu, *rom, *ram, 1000);
+    assert(s.reason == stop_reason::none && s.ticks == 1000);
+    assert(cpu.pc == expected_cpu.pc && cpu.a == expected_cpu.a && cpu.d == expected_cpu.d);
+    assert(*ram == *expected_ram);
+
+    // stops before the instruction, and steps over it when run again
+    d.set_breakpoint(3, true);
+    s = d.run(cpu, *rom, *ram, 1000);
+    assert(s.reason == stop_reason::breakpoint && s.address == 3 && cpu.pc == 3);
+    assert(s.ticks == 4);
+    s = d.run(cpu, *rom, *ram, 1000);
+    assert(s.reason == stop_reason::breakpoint && s.ticks == 7 && cpu.pc == 3);
+    d.set_breakpoint(3, false);
+
+    // stops after the access, and marks the screen
+    screen_dirty dirty;
+    dirty.take();
+    d.set_watchpoint(0x4000, debugger::write);
+    s = d.run(cpu, *rom, *ram, 1000, &dirty);
+    assert(s.reason == stop_reason::watchpoint && s.address == 0x4000 && cpu.pc == 5);
+    assert(s.ticks == 2);
+    assert((*ram)[0x4000] == (*ram)[100]);
+    assert(dirty.take()[0]);
+
+    // reads are not writes
+    d.set_watchpoint(0x4000, 0);
+    d.set_watchpoint(100, debugger::read);
+    s = d.run(cpu, *rom, *ram, 1000);
+    assert(s.reason == stop_reason::watchpoint && s.address == 100 && cpu.pc == 2);
+    assert(s.ticks == 4);
+}
+
+int main()
+{
+    test_points();
+    test_run();
+}
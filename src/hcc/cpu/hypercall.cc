@@ -0,0 +1,453 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/hypercall.h"
+#include "hcc/cpu/screen.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace hcc {
+namespace cpu {
+
+namespace {
+
+// registers of hcc's calling convention
+const word R11 = 11; // frame of the current function
+const word R12 = 12; // arguments of the current function
+const word R13 = 13;
+const word R14 = 14;
+const word R15 = 15; // return value
+
+// end of the stack, start of the heap
+const word HEAP = 2048;
+
+// The Jack code never gets this far in a loop, unless RAM is corrupted and it
+// never returns.
+const unsigned int max_iterations = 0x10000;
+
+// Jack compares by subtracting and jumping on the sign, so comparisons wrap
+// around, and so must these.
+bool less(word x, word y)
+{
+    return static_cast<word>(x - y) & 0x8000;
+}
+
+word negate(word x)
+{
+    return static_cast<word>(-x);
+}
+
+// Math.abs
+word absolute(word x)
+{
+    return less(x, 0) ? negate(x) : x;
+}
+
+// ((x<0)&(y>0))|((x>0)&(y<0))
+bool opposite_signs(word x, word y)
+{
+    return (less(x, 0) && less(0, y)) || (less(0, x) && less(y, 0));
+}
+
+/**
+ * RAM as the Jack code sees it, where every access outside of RAM faults, and
+ * the writes are logged so that they can be undone.
+ */
+struct memory {
+    RAM& ram;
+    std::vector<std::pair<word, word>>& undo;
+    screen_dirty* dirty;
+
+    word read(word address) const { return ram.at(address); }
+
+    void write(word address, word value)
+    {
+        auto& target = ram.at(address);
+        undo.emplace_back(address, target);
+        target = value;
+    }
+
+    void rollback()
+    {
+        for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+            ram[it->first] = it->second;
+        }
+        undo.clear();
+    }
+};
+
+// Each of these returns false where the Jack code would not return.
+
+// Math.multiply
+bool multiply(const memory& m, word two_to_the, word x, word y, word& result)
+{
+    const bool negative = opposite_signs(x, y);
+    x = absolute(x);
+    y = absolute(y);
+    if (less(x, y)) {
+        std::swap(x, y);
+    }
+
+    const word table = m.read(two_to_the);
+    word sum = 0;
+    word bit = 0;
+    for (unsigned int i = 0; less(bit, y); ++i) {
+        if (i == max_iterations) {
+            return false;
+        }
+        const word power = m.read(table + i);
+        if (less(0, power & y)) {
+            sum += x;
+            bit += power;
+        }
+        x += x;
+    }
+
+    result = negative ? negate(sum) : sum;
+    return true;
+}
+
+// Math.divide, which uses Math.arr as scratch memory
+bool divide(memory& m, word two_to_the, word arr, word x, word y, word& result)
+{
+    // Sys.error(3), or doubling -32768 forever
+    if (y == 0 || y == 0x8000) {
+        return false;
+    }
+
+    const bool negative = opposite_signs(x, y);
+    const word table = m.read(two_to_the);
+    const word scratch = m.read(arr);
+    m.write(scratch, absolute(y));
+    x = absolute(x);
+
+    word j = 0;
+    bool done = false;
+    for (unsigned int n = 0; !done; ++n) {
+        if (n == max_iterations) {
+            return false;
+        }
+        const word current = m.read(scratch + j);
+        done = less(32767 - current, current);
+        if (!done) {
+            m.write(scratch + j + 1, current + current);
+            done = less(x, m.read(scratch + j + 1));
+            if (!done) {
+                ++j;
+            }
+        }
+    }
+
+    word sum = 0;
+    for (; less(0xffff, j); --j) {
+        if (!less(x, m.read(scratch + j))) {
+            sum += m.read(table + j);
+            x -= m.read(scratch + j);
+        }
+    }
+
+    result = negative ? negate(sum) : sum;
+    return true;
+}
+
+// Memory.alloc, first fit from the free list at the start of the heap
+bool alloc(memory& m, word size, word& result)
+{
+    // Sys.error(5)
+    if (less(size, 1)) {
+        return false;
+    }
+
+    word i = HEAP;
+    for (unsigned int n = 0; less(m.read(i), size); ++n) {
+        if (n == max_iterations) {
+            return false;
+        }
+        i = m.read(i + 1);
+    }
+
+    // Sys.error(6)
+    if (less(16379, i + size)) {
+        return false;
+    }
+
+    const word length = m.read(i);
+    if (less(size + 2, length)) {
+        m.write(i + size + 2, length - size - 2);
+        const word next = m.read(i + 1);
+        m.write(i + size + 3, next == static_cast<word>(i + 2) ? i + size + 4 : next);
+        m.write(i + 1, i + size + 2);
+    }
+    m.write(i, 0);
+
+    result = i + 2;
+    return true;
+}
+
+struct screen_statics {
+    word two_to_the;
+    word arr;
+    word video;
+    word color;
+    word bits;
+};
+
+// Screen.drawPixel, through Screen.updateLocation
+bool draw_pixel(memory& m, const screen_statics& s, word x, word y)
+{
+    // Sys.error(7)
+    if (less(x, 0) || less(511, x) || less(y, 0) || less(255, y)) {
+        return false;
+    }
+
+    word off = 0;
+    word scaled = 0;
+    word row = 0;
+    if (!divide(m, s.two_to_the, s.arr, x, 16, off) || !multiply(m, s.two_to_the, off, 16, scaled)
+        || !multiply(m, s.two_to_the, y, 32, row)) {
+        return false;
+    }
+    const word bit = x - scaled;
+    const word address = m.read(s.video) + row + off;
+    const word value = m.read(m.read(s.bits) + bit);
+    const word old = m.read(address);
+    m.write(address, m.read(s.color) ? old | value : old & ~value);
+    if (m.dirty) {
+        m.dirty->mark(address);
+    }
+    return true;
+}
+
+// Screen.drawConditional
+bool draw_conditional(memory& m, const screen_statics& s, word x, word y, bool swap)
+{
+    return swap ? draw_pixel(m, s, y, x) : draw_pixel(m, s, x, y);
+}
+
+// Screen.drawLine, Bresenham's algorithm along the longer axis
+bool draw_line(memory& m, const screen_statics& s, word x1, word y1, word x2, word y2)
+{
+    // Sys.error(8)
+    if (less(x1, 0) || less(511, x2) || less(y1, 0) || less(255, y2)) {
+        return false;
+    }
+
+    word dx = absolute(x2 - x1);
+    word dy = absolute(y2 - y1);
+    const bool swap = less(dx, dy);
+    if ((swap && less(y2, y1)) || (!swap && less(x2, x1))) {
+        std::swap(x1, x2);
+        std::swap(y1, y2);
+    }
+
+    word x, y, g;
+    bool f;
+    if (swap) {
+        std::swap(dx, dy);
+        y = y1;
+        x = x1;
+        g = y2;
+        f = less(x2, x1);
+    } else {
+        y = x1;
+        x = y1;
+        g = x2;
+        f = less(y2, y1);
+    }
+
+    word c = 0;
+    word h = 0;
+    word i = 0;
+    if (!multiply(m, s.two_to_the, 2, dy, h) || !multiply(m, s.two_to_the, 2, dy - dx, i)) {
+        return false;
+    }
+    c = h - dx;
+    if (!draw_conditional(m, s, y, x, swap)) {
+        return false;
+    }
+
+    for (unsigned int n = 0; less(y, g); ++n) {
+        if (n == max_iterations) {
+            return false;
+        }
+        if (less(c, 0)) {
+            c += h;
+        } else {
+            c += i;
+            x += f ? 0xffff : 1;
+        }
+        ++y;
+        if (!draw_conditional(m, s, y, x, swap)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char* name(int f)
+{
+    static const char* const names[] = {
+        "Math.multiply", "Math.divide", "Memory.alloc", "Screen.drawLine",
+    };
+    return names[f];
+}
+
+} // namespace {
+
+hypercalls::hypercalls(const symbols& labels, const symbols& variables)
+{
+    if (labels.find("__returnHelper") == labels.end()) {
+        throw std::runtime_error("Program does not use the calling convention of hcc");
+    }
+
+    const auto find_variable = [&](const char* name, word& address) {
+        const auto it = variables.find(name);
+        if (it == variables.end()) {
+            return false;
+        }
+        address = it->second;
+        return true;
+    };
+    const auto add = [&](const char* name, function f, bool found) {
+        const auto it = labels.find(name);
+        if (found && it != labels.end()) {
+            entries.emplace_back(it->second, f);
+        }
+    };
+
+    const bool math = find_variable("Math.twoToThe", two_to_the);
+    const bool scratch = find_variable("Math.arr", arr);
+    const bool screen = find_variable("Screen.video", video) && find_variable("Screen.color", color)
+        && find_variable("Screen.bits", bits);
+    add("Math.multiply", function::multiply, math);
+    add("Math.divide", function::divide, math && scratch);
+    add("Memory.alloc", function::alloc, true);
+    add("Screen.drawLine", function::draw_line, math && scratch && screen);
+    std::sort(entries.begin(), entries.end());
+}
+
+std::vector<word> hypercalls::addresses() const
+{
+    std::vector<word> result;
+    for (const auto& entry : entries) {
+        result.push_back(entry.first);
+    }
+    return result;
+}
+
+const std::pair<word, hypercalls::function>* hypercalls::find(word address) const
+{
+    const auto it = std::lower_bound(entries.begin(), entries.end(), address,
+                                     [](const std::pair<word, function>& entry, word address) {
+                                         return entry.first < address;
+                                     });
+    return it != entries.end() && it->first == address ? &*it : nullptr;
+}
+
+bool hypercalls::call(CPU& cpu, RAM& ram, screen_dirty* dirty)
+{
+    const auto entry = find(cpu.pc);
+    return entry && execute(entry->second, cpu, ram, dirty);
+}
+
+bool hypercalls::execute(function f, CPU& cpu, RAM& ram, screen_dirty* dirty)
+{
+    undo.clear();
+    memory m{ram, undo, dirty};
+    try {
+        const word frame = ram[R11];
+        const word args = ram[R12];
+        const auto arg = [&](word i) { return m.read(args + i); };
+
+        word result = 0;
+        bool returns = false;
+        switch (f) {
+        case function::multiply:
+            returns = multiply(m, two_to_the, arg(0), arg(1), result);
+            break;
+        case function::divide:
+            returns = divide(m, two_to_the, arr, arg(0), arg(1), result);
+            break;
+        case function::alloc:
+            returns = alloc(m, arg(0), result);
+            break;
+        case function::draw_line:
+            returns = draw_line(m, {two_to_the, arr, video, color, bits}, arg(0), arg(1), arg(2),
+                                arg(3));
+            break;
+        }
+        if (!returns) {
+            m.rollback();
+            return false;
+        }
+
+        // __returnHelper: restore R0..R6, R12 and R11 saved below the frame, then jump
+        word saved[10];
+        for (word i = 0; i < 10; ++i) {
+            saved[i] = m.read(frame - 1 - i);
+        }
+        ram[R15] = result;
+        for (word i = 0; i < 7; ++i) {
+            ram[i] = saved[i];
+        }
+        ram[R12] = saved[7];
+        ram[R11] = saved[8];
+        ram[R13] = frame - 10;
+        cpu.d = saved[8];
+        cpu.a = saved[9];
+        cpu.pc = saved[9];
+    } catch (const std::out_of_range&) {
+        // the Jack code faults somewhere
+        m.rollback();
+        return false;
+    }
+    undo.clear();
+    return true;
+}
+
+bool hypercalls::validate(CPU& cpu, const ROM& rom, RAM& ram, screen_dirty* dirty)
+{
+    const auto entry = find(cpu.pc);
+    if (!entry) {
+        return false;
+    }
+
+    CPU expected_cpu = cpu;
+    std::unique_ptr<RAM> expected{new RAM(ram)};
+    if (!execute(entry->second, expected_cpu, *expected, dirty)) {
+        return false;
+    }
+
+    // the Jack code, until it returns into the caller's frame
+    const word args = ram[R12];
+    const word caller_frame = expected_cpu.d;
+    for (unsigned long steps = 0; cpu.pc != expected_cpu.pc || ram[R11] != caller_frame; ++steps) {
+        if (steps == 1ul << 24) {
+            throw hypercall_mismatch(name(static_cast<int>(entry->second)));
+        }
+        cpu.step(rom, ram);
+    }
+
+    const auto same = [&](word first, word last) {
+        return std::equal(ram.begin() + first, ram.begin() + last, expected->begin() + first);
+    };
+    const bool match = cpu.a == expected_cpu.a && cpu.d == expected_cpu.d && same(0, R14)
+        && same(R14 + 1, std::min(args, HEAP)) && same(HEAP, ram.size());
+    if (!match) {
+        throw hypercall_mismatch(name(static_cast<int>(entry->second)));
+    }
+    return true;
+}
+
+hook hypercalls::make_hook(const ROM* rom)
+{
+    if (rom) {
+        return [this, rom](CPU& cpu, RAM& ram, screen_dirty* dirty) {
+            return validate(cpu, *rom, ram, dirty);
+        };
+    }
+    return [this](CPU& cpu, RAM& ram, screen_dirty* dirty) { return call(cpu, ram, dirty); };
+}
+
+} // namespace cpu {
+} // namespace hcc {
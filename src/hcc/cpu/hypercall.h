@@ -0,0 +1,103 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+#include "hcc/cpu/interpreter.h"
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+struct screen_dirty;
+
+/**
+ * Thrown when a function executed natively leaves the machine differently
+ * than its Jack code.
+ */
+struct hypercall_mismatch : std::runtime_error {
+    explicit hypercall_mismatch(const std::string& function)
+        : std::runtime_error("Native " + function + " differs from its Jack code")
+        , function(function)
+    {
+    }
+
+    std::string function;
+};
+
+/**
+ * Native equivalents of the hottest functions of src/stdlib: Math.multiply,
+ * Math.divide, Memory.alloc and Screen.drawLine. Each of them changes RAM as
+ * its Jack code would, then returns to the caller the way __returnHelper does,
+ * leaving the registers and the stack below the arguments exactly as the Jack
+ * code does. The stack above is dead after the return and is left alone, and
+ * so is the scratch register R14.
+ *
+ * Calls which the Jack code would not return from, because of Sys.error(),
+ * a fault or an endless loop, are declined and left to the Jack code.
+ *
+ * Only programs compiled from Jack by hcc are supported, as the functions are
+ * recognised by labels, and the calling convention is that of hcc's backend.
+ */
+struct hypercalls {
+    using symbols = std::map<std::string, word>;
+
+    /**
+     * Find the functions and their static variables by names, as in the
+     * symbol map written by hcc -g. Functions which are missing are not
+     * executed natively.
+     *
+     * @throws std::runtime_error if the program does not use hcc's calling
+     * convention
+     */
+    hypercalls(const symbols& labels, const symbols& variables);
+
+    // entry points of the functions found
+    std::vector<word> addresses() const;
+
+    /**
+     * Execute the function starting at cpu.pc natively, and return from it.
+     * Screen rows changed are marked in dirty, if given.
+     *
+     * @return false if declined, leaving everything untouched
+     */
+    bool call(CPU& cpu, RAM& ram, screen_dirty* dirty);
+
+    /**
+     * Execute the function both natively on a copy of the machine, and by
+     * CPU::step() from rom, then compare the two.
+     *
+     * @throws hypercall_mismatch naming the function if they differ
+     */
+    bool validate(CPU& cpu, const ROM& rom, RAM& ram, screen_dirty* dirty);
+
+    /**
+     * Hook for interpreter::set_hook() calling call(), or validate() with
+     * rom, if given. The hook refers to this object and rom.
+     */
+    hook make_hook(const ROM* rom = nullptr);
+
+private:
+    enum class function { multiply, divide, alloc, draw_line };
+
+    const std::pair<word, function>* find(word address) const;
+    bool execute(function f, CPU& cpu, RAM& ram, screen_dirty* dirty);
+
+    std::vector<std::pair<word, function>> entries;
+    std::vector<std::pair<word, word>> undo; // (address, old value), reused by calls
+
+    // addresses of static variables
+    word two_to_the = 0;
+    word arr = 0;
+    word video = 0;
+    word color = 0;
+    word bits = 0;
+};
+
+} // namespace cpu {
+} // namespace hcc {
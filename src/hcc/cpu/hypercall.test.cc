@@ -0,0 +1,222 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/asm.h"
+#include "hcc/cpu/cpu.h"
+#include "hcc/cpu/hypercall.h"
+#include "hcc/cpu/interpreter.h"
+#include "hcc/cpu/jit.h"
+#include "hcc/cpu/screen.h"
+#include "hcc/jack/ast.h"
+#include "hcc/jack/parser.h"
+#include "hcc/jack/tokenizer.h"
+#include "hcc/ssa/ssa.h"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace hcc::cpu;
+
+// Stores results from 3000 on, then 1 into 2999 when done.
+const char* const main_class = R"(
+class Main {
+    function void main() {
+        var Array values, a, b;
+        var int i, j, k;
+        let values = Array.new(9);
+        let values[0] = 0;
+        let values[1] = 1;
+        let values[2] = -1;
+        let values[3] = 7;
+        let values[4] = -300;
+        let values[5] = 181;
+        let values[6] = 32767;
+        let values[7] = -32767;
+        let values[8] = -32768;
+        let k = 3000;
+        while (i < 9) {
+            let j = 0;
+            while (j < 9) {
+                do Memory.poke(k, values[i] * values[j]);
+                if (~(values[j] = 0) & ~(values[j] = -32768)) {
+                    do Memory.poke(k + 1, values[i] / values[j]);
+                }
+                let k = k + 2;
+                let j = j + 1;
+            }
+            let i = i + 1;
+        }
+        let i = 1;
+        while (i < 40) {
+            let a = Array.new(i);
+            let b = Array.new(41 - i);
+            do Memory.poke(k, a);
+            do Memory.poke(k + 1, b);
+            do a.dispose();
+            let k = k + 2;
+            let i = i + 1;
+        }
+        let i = 0;
+        while (i < 8) {
+            do Screen.setColor(i < 4);
+            do Screen.drawLine(i * 9, 100 - i, 511 - i, 250);
+            do Screen.drawLine(500, i * 30, 3 + i, 200 - i);
+            do Screen.drawLine(256 + i, 0, 256 - (i * 20), 255);
+            do Screen.drawLine(i, 128, 500, 128);
+            do Screen.drawLine(i * 50, 10, i * 50, 240);
+            let i = i + 1;
+        }
+        do Memory.poke(2999, 1);
+        return;
+    }
+}
+)";
+
+struct program {
+    ROM rom;
+    hypercalls::symbols labels;
+    hypercalls::symbols variables;
+};
+
+std::unique_ptr<program> compile()
+{
+    std::vector<hcc::jack::Class> classes;
+    std::istringstream main_input{main_class};
+    hcc::jack::tokenizer main_tokens{std::istreambuf_iterator<char>(main_input),
+                                     std::istreambuf_iterator<char>()};
+    classes.push_back(parse(main_tokens));
+    for (const auto name : {"Array", "Keyboard", "Math", "Memory", "Output", "Screen", "String",
+                            "Sys"}) {
+        std::ifstream input{std::string(STDLIB_DIR "/") + name + ".jack"};
+        assert(input);
+        hcc::jack::tokenizer tokens{std::istreambuf_iterator<char>(input),
+                                    std::istreambuf_iterator<char>()};
+        classes.push_back(parse(tokens));
+    }
+
+    // as hcc does
+    hcc::ssa::unit u;
+    for (const auto& class_ : classes) {
+        u.translate_from_jack(class_);
+    }
+    for (auto& subroutine_entry : u.subroutines) {
+        auto& subroutine = subroutine_entry.second;
+        subroutine.dead_code_elimination();
+        subroutine.copy_propagation();
+        subroutine.dead_code_elimination();
+        subroutine.ssa_deconstruct();
+        subroutine.allocate_registers();
+    }
+    hcc::assembler::program out;
+    u.translate_to_asm(out);
+    out.local_optimization();
+    out.global_optimization();
+
+    std::unique_ptr<program> result{new program()};
+    hcc::assembler::symbol_map symbols;
+    const auto code = out.assemble(&symbols);
+    assert(code.size() <= result->rom.size());
+    std::copy(code.begin(), code.end(), result->rom.begin());
+    for (const auto& label : symbols.labels) {
+        result->labels.emplace(label.name, label.address);
+    }
+    for (const auto& variable : symbols.variables) {
+        result->variables.emplace(variable.name, variable.address);
+    }
+    return result;
+}
+
+// Run until Main.main is done, and return the number of ticks.
+template <typename engine_type>
+std::uint64_t run(engine_type& engine, const ROM& rom, RAM& ram)
+{
+    engine.load(rom);
+    CPU cpu;
+    cpu.reset();
+    std::uint64_t ticks = 0;
+    while (ram[2999] != 1) {
+        assert(ticks < 1000000000);
+        engine.run(cpu, ram, 10000);
+        ticks += 10000;
+    }
+    return ticks;
+}
+
+// Results and the screen of the Jack code, the native code, and both validated.
+void test_program(const program& p)
+{
+    hypercalls calls{p.labels, p.variables};
+    assert(calls.addresses().size() == 4);
+
+    std::unique_ptr<RAM> expected{new RAM()};
+    interpreter plain;
+    const auto plain_ticks = run(plain, p.rom, *expected);
+
+    std::unique_ptr<RAM> native{new RAM()};
+    jit fast;
+    fast.set_hook(calls.addresses(), calls.make_hook());
+    const auto native_ticks = run(fast, p.rom, *native);
+
+    std::unique_ptr<RAM> validated{new RAM()};
+    interpreter checked;
+    checked.set_hook(calls.addresses(), calls.make_hook(&p.rom));
+    run(checked, p.rom, *validated);
+
+    // the heap, the results and the screen
+    for (const RAM* ram : {native.get(), validated.get()}) {
+        assert(std::equal(expected->begin() + 2048, expected->end(), ram->begin() + 2048));
+    }
+    assert(native_ticks * 10 < plain_ticks);
+
+    // lines were drawn
+    assert(std::count(expected->begin() + SCREEN, expected->begin() + KEYBOARD, 0) < 8000);
+}
+
+// Declined calls are left to the Jack code, which reports the error.
+void test_declined(const program& p)
+{
+    hypercalls calls{p.labels, p.variables};
+    std::unique_ptr<RAM> ram{new RAM()};
+    interpreter plain;
+    run(plain, p.rom, *ram);
+
+    // a call into Math.divide(5, 0) with a made up frame
+    CPU cpu{p.labels.at("Math.divide"), 0, 0};
+    (*ram)[11] = 400;
+    (*ram)[12] = 388;
+    (*ram)[388] = 5;
+    (*ram)[389] = 0;
+    const RAM before = *ram;
+    assert(!calls.call(cpu, *ram, nullptr));
+    assert(*ram == before);
+    assert(cpu.pc == p.labels.at("Math.divide"));
+
+    // an allocation too big for the heap
+    cpu.pc = p.labels.at("Memory.alloc");
+    (*ram)[388] = 20000;
+    assert(!calls.call(cpu, *ram, nullptr));
+}
+
+void test_convention()
+{
+    bool thrown = false;
+    try {
+        hypercalls{{{"Math.multiply", 100}}, {}};
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+int main()
+{
+    const auto p = compile();
+    test_program(*p);
+    test_declined(*p);
+    test_convention();
+}
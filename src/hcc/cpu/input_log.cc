@@ -0,0 +1,69 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/input_log.h"
+
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace hcc {
+namespace cpu {
+
+void input_log::record(std::uint64_t tick, word key)
+{
+    // several changes at the same tick, only the last one is seen
+    if (!events.empty() && events.back().tick == tick) {
+        events.pop_back();
+    }
+    const word previous = events.empty() ? 0 : events.back().key;
+    if (key != previous) {
+        events.push_back({tick, key});
+    }
+}
+
+void input_log::save(std::ostream& out) const
+{
+    for (const auto& e : events) {
+        out << "k " << e.tick << ' ' << e.key << '\n';
+    }
+}
+
+input_log input_log::load(std::istream& in)
+{
+    input_log result;
+
+    std::string line;
+    unsigned int line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream ss{line};
+        char kind = 0;
+        std::uint64_t tick = 0;
+        unsigned int key = 0;
+        const bool valid = (ss >> kind >> tick >> key) && kind == 'k' && key <= 0xffff
+            && (result.events.empty() || result.events.back().tick < tick);
+        if (!valid) {
+            throw std::runtime_error("Malformed input log at line " + std::to_string(line_number));
+        }
+        result.events.push_back({tick, static_cast<word>(key)});
+    }
+    return result;
+}
+
+std::uint64_t input_replay::apply(std::uint64_t tick, RAM& ram)
+{
+    while (next < log.events.size() && log.events[next].tick <= tick) {
+        ram[KEYBOARD] = log.events[next++].key;
+    }
+    if (finished()) {
+        return std::numeric_limits<std::uint64_t>::max();
+    }
+    return log.events[next].tick - tick;
+}
+
+} // namespace cpu {
+} // namespace hcc {
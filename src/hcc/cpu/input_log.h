@@ -0,0 +1,66 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * Changes of the keyboard register during a run, each stamped with the number
+ * of instructions executed before it. A run started from the same state and
+ * given the same changes at the same ticks executes the same way, no matter
+ * how fast.
+ */
+struct input_log {
+    struct event {
+        std::uint64_t tick;
+        word key;
+    };
+
+    std::vector<event> events; // ordered by tick, key differs from the one before
+
+    /**
+     * Note the keyboard register as seen at tick, which is not before the
+     * last one noted. Only changes are kept; the register starts as zero.
+     */
+    void record(std::uint64_t tick, word key);
+
+    /**
+     * Text format, one change per line: "k <tick> <key>".
+     */
+    void save(std::ostream& out) const;
+    static input_log load(std::istream& in);
+};
+
+/**
+ * Plays a log back into the keyboard register.
+ */
+struct input_replay {
+    explicit input_replay(const input_log& log)
+        : log(log)
+    {
+    }
+
+    /**
+     * Apply all changes due at or before tick, and return the number of ticks
+     * until the next one, or UINT64_MAX if there is none.
+     */
+    std::uint64_t apply(std::uint64_t tick, RAM& ram);
+
+    bool finished() const { return next == log.events.size(); }
+
+private:
+    const input_log& log;
+    std::size_t next = 0;
+};
+
+} // namespace cpu {
+} // namespace hcc {
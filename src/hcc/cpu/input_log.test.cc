@@ -0,0 +1,129 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/input_log.h"
+#include "hcc/cpu/instruction.h"
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+void test_record()
+{
+    input_log log;
+    log.record(0, 0); // register starts as zero
+    log.record(10, 'a');
+    log.record(20, 'a');
+    log.record(30, 0);
+    log.record(40, 'b');
+    log.record(40, 'c'); // only the last one at the same tick
+    log.record(50, 'c');
+    assert(log.events.size() == 3);
+    assert(log.events[0].tick == 10 && log.events[0].key == 'a');
+    assert(log.events[1].tick == 30 && log.events[1].key == 0);
+    assert(log.events[2].tick == 40 && log.events[2].key == 'c');
+
+    log.record(60, 0);
+    log.record(60, 'c'); // changed back within the same tick
+    assert(log.events.size() == 3);
+}
+
+void test_save_load()
+{
+    input_log expected;
+    expected.record(5, 140);
+    expected.record(1ull << 40, 0);
+    std::stringstream file;
+    expected.save(file);
+    assert(file.str() == "k 5 140\nk 1099511627776 0\n");
+
+    const auto actual = input_log::load(file);
+    assert(actual.events.size() == 2);
+    assert(actual.events[1].tick == 1ull << 40 && actual.events[1].key == 0);
+
+    const char* inputs[] = {
+        "x 1 2\n", // unknown kind
+        "k 1\n", // missing key
+        "k 1 65536\n", // key out of range
+        "k 5 1\nk 5 2\n", // not ordered
+    };
+    for (const auto input : inputs) {
+        std::istringstream ss{input};
+        bool thrown = false;
+        try {
+            input_log::load(ss);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+// Adds the keyboard register into RAM[0] in a loop:
+// loop: @KEYBOARD; D=M; @0; M=D+M; @loop; 0;JMP
+void adder(ROM& rom)
+{
+    rom[0] = KEYBOARD;
+    rom[1] = COMPUTE | RESERVED | DEST_D | COMP_M;
+    rom[2] = 0;
+    rom[3] = COMPUTE | RESERVED | DEST_M | COMP_D_PLUS_M;
+    rom[4] = 0;
+    rom[5] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+}
+
+// A run replayed in chunks of any size ends in the same state as the
+// recorded one.
+void test_replay()
+{
+    std::unique_ptr<ROM> rom{new ROM()};
+    adder(*rom);
+
+    std::mt19937 generator{42};
+    std::uniform_int_distribution<std::uint64_t> chunk_size{1, 100};
+    std::uniform_int_distribution<word> any_key{0, 3};
+
+    // keys change between chunks, as they do in the emulator
+    const std::uint64_t total = 100000;
+    input_log log;
+    std::unique_ptr<RAM> recorded{new RAM()};
+    CPU recorded_cpu{0, 0, 0};
+    for (std::uint64_t tick = 0; tick < total;) {
+        (*recorded)[KEYBOARD] = any_key(generator);
+        log.record(tick, (*recorded)[KEYBOARD]);
+        const auto n = std::min(chunk_size(generator), total - tick);
+        for (std::uint64_t i = 0; i < n; ++i) {
+            recorded_cpu.step(*rom, *recorded);
+        }
+        tick += n;
+    }
+    assert(log.events.size() > 100);
+
+    std::unique_ptr<RAM> replayed{new RAM()};
+    CPU replayed_cpu{0, 0, 0};
+    input_replay replay{log};
+    for (std::uint64_t tick = 0; tick < total;) {
+        const auto until = replay.apply(tick, *replayed);
+        const auto n = std::min({chunk_size(generator) * 10, until, total - tick});
+        for (std::uint64_t i = 0; i < n; ++i) {
+            replayed_cpu.step(*rom, *replayed);
+        }
+        tick += n;
+    }
+    assert(replay.finished());
+    assert(replayed_cpu.pc == recorded_cpu.pc);
+    assert(replayed_cpu.d == recorded_cpu.d);
+    assert(*replayed == *recorded);
+    assert((*replayed)[0] != 0);
+}
+
+int main()
+{
+    test_record();
+    test_save_load();
+    test_replay();
+}
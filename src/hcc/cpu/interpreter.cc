@@ -0,0 +1,469 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/interpreter.h"
+
+#include "hcc/cpu/bus.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/screen.h"
+#include "hcc/cpu/trace.h"
+
+#include <array>
+#include <stdexcept>
+#include <utility>
+
+namespace hcc {
+namespace cpu {
+
+using namespace instruction;
+
+namespace {
+
+// The 28 computations from the TECS book, these get specialised handlers.
+constexpr word documented[] = {
+    COMP_ZERO,       COMP_ONE,         COMP_MINUS_ONE,   COMP_D,           COMP_A,
+    COMP_NOT_D,      COMP_NOT_A,       COMP_MINUS_D,     COMP_MINUS_A,     COMP_D_PLUS_ONE,
+    COMP_A_PLUS_ONE, COMP_D_MINUS_ONE, COMP_A_MINUS_ONE, COMP_D_PLUS_A,    COMP_D_MINUS_A,
+    COMP_A_MINUS_D,  COMP_D_AND_A,     COMP_D_OR_A,      COMP_M,           COMP_NOT_M,
+    COMP_MINUS_M,    COMP_M_PLUS_ONE,  COMP_M_MINUS_ONE, COMP_D_PLUS_M,    COMP_D_MINUS_M,
+    COMP_M_MINUS_D,  COMP_D_AND_M,     COMP_D_OR_M,
+};
+constexpr std::size_t documented_count = sizeof(documented) / sizeof(documented[0]);
+
+// (comp, dest, jump) part of C-instruction
+constexpr word MASK_HANDLER = MASK_COMP | MASK_DEST | MASK_JUMP;
+
+template <word Comp>
+word alu(word x, word y)
+{
+    if (Comp & ALU_ZX) {
+        x = 0;
+    }
+    if (Comp & ALU_NX) {
+        x = ~x;
+    }
+    if (Comp & ALU_ZY) {
+        y = 0;
+    }
+    if (Comp & ALU_NY) {
+        y = ~y;
+    }
+    word out = (Comp & ALU_F) ? x + y : x & y;
+    if (Comp & ALU_NO) {
+        out = ~out;
+    }
+    return out;
+}
+
+template <word Jump>
+bool condition(word out)
+{
+    const bool zr = (out == 0);
+    const bool ng = (out & (1 << 15));
+    return ((Jump & JUMP_NEG) && ng) || ((Jump & JUMP_ZERO) && zr)
+           || ((Jump & JUMP_POS) && !ng && !zr);
+}
+
+// Mirrors CPU::step(), including the order in which destinations are written.
+template <word Instruction, bool Fused>
+bool execute(CPU& cpu, RAM& ram, bus* io, const micro_op& op)
+{
+    if (Fused) {
+        cpu.a = op.constant;
+    }
+    const word address = cpu.a;
+    const word out = alu<Instruction & MASK_COMP>(
+        cpu.d, (Instruction & FETCH) ? read_memory(ram, io, address) : cpu.a);
+    if (Instruction & DEST_A) {
+        cpu.a = out;
+    }
+    if (Instruction & DEST_D) {
+        cpu.d = out;
+    }
+    if (Instruction & DEST_M) {
+        write_memory(ram, io, address, out);
+    }
+    return condition<Instruction & MASK_JUMP>(out);
+}
+
+template <bool Fused>
+bool execute_generic(CPU& cpu, RAM& ram, bus* io, const micro_op& op)
+{
+    if (Fused) {
+        cpu.a = op.constant;
+    }
+    const word address = cpu.a;
+    word out;
+    bool zr, ng;
+    comp(op.instruction, cpu.d, (op.instruction & FETCH) ? read_memory(ram, io, address) : cpu.a,
+         out, zr, ng);
+    if (op.instruction & DEST_A) {
+        cpu.a = out;
+    }
+    if (op.instruction & DEST_D) {
+        cpu.d = out;
+    }
+    if (op.instruction & DEST_M) {
+        write_memory(ram, io, address, out);
+    }
+    return jump(op.instruction, zr, ng);
+}
+
+bool execute_load(CPU& cpu, RAM&, bus*, const micro_op& op)
+{
+    cpu.a = op.instruction;
+    return false;
+}
+
+using handler_table = std::array<handler, MASK_HANDLER + 1>;
+
+template <bool Fused, std::size_t... I>
+handler_table make_handler_table(std::index_sequence<I...>)
+{
+    handler_table table;
+    table.fill(&execute_generic<Fused>);
+    // Every I enumerates one (comp, dest | jump) pair
+    using expand = int[];
+    (void)expand{0, (table[documented[I >> 6] | (I & 0x3f)] =
+                         &execute<documented[I >> 6] | (I & 0x3f), Fused>,
+                     0)...};
+    return table;
+}
+
+using handler_indices = std::make_index_sequence<documented_count * ((MASK_DEST | MASK_JUMP) + 1)>;
+const handler_table handlers = make_handler_table<false>(handler_indices());
+const handler_table fused_handlers = make_handler_table<true>(handler_indices());
+
+// Longer blocks save dispatch, but are executed one by one when the tick
+// budget runs out in the middle.
+const word max_block_length = 64;
+
+bool is_jump(word instruction)
+{
+    return (instruction & COMPUTE) && (instruction & MASK_JUMP);
+}
+
+bool writes(const micro_op& op)
+{
+    return (op.instruction & COMPUTE) && (op.instruction & DEST_M);
+}
+
+// Execute op, marking the screen row it changes.
+bool execute_tracked(CPU& cpu, RAM& ram, bus* io, const micro_op& op, screen_dirty& dirty)
+{
+    const word address = op.fused ? op.constant : cpu.a;
+    if (!writes(op) || address < SCREEN || address >= KEYBOARD) {
+        return op.execute(cpu, ram, io, op);
+    }
+    const word old = ram[address];
+    const bool taken = op.execute(cpu, ram, io, op);
+    if (ram[address] != old) {
+        dirty.mark(address);
+    }
+    return taken;
+}
+
+// Execute op at address pc and record it, as two instructions if it is
+// fused. Should the C-instruction throw, the A-instruction before it is
+// recorded already, as if traced by CPU::step().
+bool execute_traced(CPU& cpu, RAM& ram, bus* io, const micro_op& op, screen_dirty* dirty,
+                    word pc, trace& recorder)
+{
+    word old_a = cpu.a;
+    if (op.fused) {
+        recorder.record(pc, old_a, CPU{0, op.constant, cpu.d}, false, 0);
+        old_a = op.constant;
+        ++pc;
+    }
+    const bool taken =
+        dirty ? execute_tracked(cpu, ram, io, op, *dirty) : op.execute(cpu, ram, io, op);
+    const bool write = writes(op);
+    recorder.record(pc, old_a, cpu, write, write ? ram[old_a] : 0);
+    return taken;
+}
+
+bool step(const std::vector<micro_op>& code, CPU& cpu, RAM& ram, bus* io, screen_dirty* dirty,
+          trace* recorder)
+{
+    if (cpu.pc >= code.size()) {
+        throw std::out_of_range("Program counter outside of ROM");
+    }
+    const auto& op = code[cpu.pc];
+    bool taken;
+    if (recorder) {
+        taken = execute_traced(cpu, ram, io, op, dirty, cpu.pc, *recorder);
+    } else {
+        taken = dirty ? execute_tracked(cpu, ram, io, op, *dirty) : op.execute(cpu, ram, io, op);
+    }
+    cpu.pc = taken ? cpu.a : cpu.pc + 1;
+    return taken;
+}
+
+// Only the last micro-op can jump, so the program counter is not maintained
+// inside of the block. Should anything throw, point it to the faulting
+// instruction, as CPU::step() would.
+// Blocks writing into M are slowed down by tracking only if asked for.
+bool execute(const block& b, CPU& cpu, RAM& ram, bus* io, screen_dirty* dirty, trace* recorder)
+{
+    bool taken = false;
+    auto op = b.ops.data();
+    const auto last = op + b.ops.size();
+    try {
+        if (recorder) {
+            word pc = b.start;
+            for (; op != last; ++op) {
+                taken = execute_traced(cpu, ram, io, *op, dirty, pc, *recorder);
+                pc += op->fused ? 2 : 1;
+            }
+        } else if (dirty && b.writes) {
+            for (; op != last; ++op) {
+                taken = execute_tracked(cpu, ram, io, *op, *dirty);
+            }
+        } else {
+            for (; op != last; ++op) {
+                taken = op->execute(cpu, ram, io, *op);
+            }
+        }
+    } catch (const std::out_of_range&) {
+        word pc = b.start;
+        for (auto it = b.ops.data(); it != op; ++it) {
+            pc += it->fused ? 2 : 1;
+        }
+        cpu.pc = pc + (op->fused ? 1 : 0);
+        throw;
+    }
+    return taken;
+}
+
+} // namespace {
+
+micro_op decode(word instruction)
+{
+    if (instruction & COMPUTE) {
+        return {handlers[instruction & MASK_HANDLER], instruction, 0, false};
+    } else {
+        return {&execute_load, instruction, 0, false};
+    }
+}
+
+micro_op decode_fused(word constant, word instruction)
+{
+    return {fused_handlers[instruction & MASK_HANDLER], instruction, constant, true};
+}
+
+void interpreter::load(const ROM& rom)
+{
+    code.clear();
+    code.reserve(rom.size());
+    for (const auto instruction : rom) {
+        code.push_back(decode(instruction));
+    }
+    flush();
+    if (profiling) {
+        set_profiling(true);
+    }
+}
+
+void interpreter::write(word address, word instruction)
+{
+    code.at(address) = decode(instruction);
+    flush();
+}
+
+void interpreter::flush()
+{
+    if (profiling) {
+        for (const auto& b : blocks) {
+            fold(*b, executions);
+        }
+    }
+    blocks.clear();
+    cache.assign(code.size(), nullptr);
+}
+
+block* interpreter::lookup(word address)
+{
+    if (address >= cache.size()) {
+        throw std::out_of_range("Program counter outside of ROM");
+    }
+    auto& b = cache[address];
+    if (!b) {
+        b = translate(address);
+    }
+    return b;
+}
+
+block* interpreter::translate(word address)
+{
+    std::unique_ptr<block> b{new block};
+    b->start = address;
+    b->length = 0;
+
+    b->hooked = hooked(address);
+
+    // hooked addresses always start a block
+    unsigned int pc = address;
+    while (pc < code.size() && b->length < max_block_length
+           && (pc == address || !hooked(pc))) {
+        const word instruction = code[pc].instruction;
+        const bool fuse = !(instruction & COMPUTE) && pc + 1 < code.size()
+                          && (code[pc + 1].instruction & COMPUTE) && !hooked(pc + 1)
+                          && b->length + 2 <= max_block_length;
+        if (fuse) {
+            const word next = code[pc + 1].instruction;
+            b->ops.push_back(decode_fused(instruction, next));
+            b->length += 2;
+            pc += 2;
+            if (is_jump(next)) {
+                break;
+            }
+        } else {
+            b->ops.push_back(code[pc]);
+            b->length += 1;
+            pc += 1;
+            if (is_jump(instruction)) {
+                break;
+            }
+        }
+    }
+
+    for (const auto& op : b->ops) {
+        b->writes = b->writes || writes(op);
+    }
+
+    blocks.push_back(std::move(b));
+    return blocks.back().get();
+}
+
+void interpreter::run(CPU& cpu, RAM& ram, std::uint64_t ticks, screen_dirty* dirty)
+{
+    block* current = nullptr;
+    block** link = nullptr;
+    while (ticks > 0) {
+        if (!current) {
+            current = lookup(cpu.pc);
+            if (link) {
+                *link = current;
+            }
+        }
+
+        if (current->hooked && on_hook(cpu, ram, dirty)) {
+            if (recorder) {
+                recorder->skip(1);
+            }
+            --ticks;
+            current = nullptr;
+            link = nullptr;
+            continue;
+        }
+
+        if (current->length > ticks) {
+            // not enough ticks for the whole block
+            for (; ticks > 0; --ticks) {
+                const word pc = cpu.pc;
+                const bool taken = step(code, cpu, ram, io, dirty, recorder);
+                if (profiling) {
+                    count(pc, taken, cpu.pc);
+                }
+            }
+            return;
+        }
+        ticks -= current->length;
+
+        const bool taken = execute(*current, cpu, ram, io, dirty, recorder);
+        if (profiling) {
+            count(*current, taken, cpu.a);
+        }
+        if (taken) {
+            cpu.pc = cpu.a;
+            link = &current->taken;
+        } else {
+            cpu.pc = current->start + current->length;
+            link = &current->fallthrough;
+        }
+
+        // follow the chain, unless a computed jump went elsewhere this time
+        current = *link;
+        if (current && current->start != cpu.pc) {
+            current = nullptr;
+        }
+    }
+}
+
+void interpreter::set_hook(const std::vector<word>& addresses, hook h)
+{
+    hooks.assign(h ? sizeof(ROM) / sizeof(word) : 0, false);
+    for (const auto address : addresses) {
+        if (address < hooks.size()) {
+            hooks[address] = true;
+        }
+    }
+    on_hook = std::move(h);
+    flush();
+}
+
+void interpreter::set_profiling(bool enabled)
+{
+    profiling = enabled;
+    if (enabled) {
+        executions.assign(code.size(), 0);
+        jumps.clear();
+        for (auto& b : blocks) {
+            b->executions = 0;
+            b->last_target_count = nullptr;
+        }
+    }
+}
+
+// Most jumps always go to the same target, which saves the hash lookup.
+void interpreter::count(block& b, bool taken, word target)
+{
+    ++b.executions;
+    if (!taken) {
+        return;
+    }
+    if (!b.last_target_count || b.last_target != target) {
+        const word from = b.start + b.length - 1;
+        b.last_target = target;
+        b.last_target_count = &jumps[std::uint32_t{from} << 16 | target];
+    }
+    ++*b.last_target_count;
+}
+
+void interpreter::count(word address, bool taken, word target)
+{
+    ++executions[address];
+    if (taken) {
+        ++jumps[std::uint32_t{address} << 16 | target];
+    }
+}
+
+void interpreter::fold(const block& b, std::vector<std::uint64_t>& counts) const
+{
+    for (unsigned int address = b.start; address < b.start + b.length; ++address) {
+        counts[address] += b.executions;
+    }
+}
+
+profile interpreter::get_profile() const
+{
+    profile result;
+    result.executions = executions;
+    result.executions.resize(code.size());
+    for (const auto& b : blocks) {
+        fold(*b, result.executions);
+    }
+    for (std::size_t address = 0; address < code.size(); ++address) {
+        const auto instruction = code[address].instruction;
+        if (result.executions[address] && (instruction & COMPUTE) && (instruction & MASK_JUMP)) {
+            result.branches.push_back(static_cast<word>(address));
+        }
+    }
+    for (const auto& jump : jumps) {
+        result.jumps[{static_cast<word>(jump.first >> 16), static_cast<word>(jump.first)}] =
+            jump.second;
+    }
+    return result;
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,158 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+#include "hcc/cpu/profile.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+struct bus;
+struct micro_op;
+struct screen_dirty;
+struct trace;
+
+/**
+ * Execute one micro-op, except for updating the program counter.
+ *
+ * @return true if the jump is taken
+ */
+using handler = bool (*)(CPU& cpu, RAM& ram, bus* io, const micro_op& op);
+
+/**
+ * Called when execution reaches a hooked address, instead of executing the
+ * instruction there. Screen rows it changes are to be marked in dirty, if
+ * given.
+ *
+ * @return false to have the instruction executed after all
+ */
+using hook = std::function<bool(CPU& cpu, RAM& ram, screen_dirty* dirty)>;
+
+struct micro_op {
+    handler execute;
+    word instruction;
+    word constant; // loaded into A first, if fused
+    bool fused; // A-instruction fused with the following C-instruction
+};
+
+/**
+ * Decode an instruction into a micro-op. Every documented (comp, dest, jump)
+ * combination gets its own specialised handler, undocumented computations fall
+ * back to a generic one.
+ */
+micro_op decode(word instruction);
+
+/**
+ * Decode an A-instruction loading constant followed by a C-instruction into
+ * a single micro-op.
+ *
+ * @precondition constant is A-instruction, instruction is C-instruction
+ */
+micro_op decode_fused(word constant, word instruction);
+
+/**
+ * Straight-line run of instructions where only the last one may jump.
+ */
+struct block {
+    word start; // ROM address of the first instruction
+    word length; // number of instructions (ticks), not micro-ops
+    std::vector<micro_op> ops;
+    bool writes = false; // some micro-op writes into M
+    bool hooked = false; // starts at hooked address, no other address in it is
+
+    // chained successors, filled in lazily
+    block* fallthrough = nullptr;
+    block* taken = nullptr;
+
+    // profiling: times executed, and counter of the last taken jump target
+    std::uint64_t executions = 0;
+    word last_target = 0;
+    std::uint64_t* last_target_count = nullptr;
+};
+
+/**
+ * Alternative to CPU::step() which decodes the ROM only once and then
+ * executes translated basic blocks, chained directly to their successors.
+ * Results are bit-exact with CPU::step().
+ */
+struct interpreter {
+    interpreter() = default;
+    interpreter(const ROM& rom) { load(rom); }
+
+    /**
+     * Decode the ROM and drop all translated blocks, and profile counts.
+     */
+    void load(const ROM& rom);
+
+    /**
+     * Write one instruction into ROM, invalidating all translated blocks.
+     */
+    void write(word address, word instruction);
+
+    /**
+     * Execute given number of instructions. If dirty is given, screen rows
+     * changed by the program are marked in it.
+     */
+    void run(CPU& cpu, RAM& ram, std::uint64_t ticks, screen_dirty* dirty = nullptr);
+
+    /**
+     * Send accesses above RAM to devices mapped on io, or fault on them if
+     * null, as by default.
+     */
+    void set_bus(bus* io_) { io = io_; }
+
+    /**
+     * Call h whenever execution reaches one of addresses, instead of the
+     * instruction there. A call which returns true counts as one tick.
+     * Hooks are kept across load(), but translated blocks are dropped. An
+     * empty h removes all hooks.
+     */
+    void set_hook(const std::vector<word>& addresses, hook h);
+    bool hooked(word address) const { return address < hooks.size() && hooks[address]; }
+
+    /**
+     * Count executions per ROM address and taken jumps from now on, or stop
+     * counting. Enabling clears the counts. Counting is done per block, a
+     * block interrupted by an exception is not counted.
+     */
+    void set_profiling(bool enabled);
+    profile get_profile() const;
+
+    /**
+     * Record every instruction executed from now on into t, or stop
+     * recording if null. Blocks record instruction by instruction, fused
+     * ones as two. Hooked calls are accounted for as skipped.
+     */
+    void set_trace(trace* t) { recorder = t; }
+
+private:
+    block* lookup(word address);
+    block* translate(word address);
+    void flush();
+    void count(block& b, bool taken, word target);
+    void count(word address, bool taken, word target);
+    void fold(const block& b, std::vector<std::uint64_t>& counts) const;
+
+    std::vector<micro_op> code;
+    std::vector<block*> cache;
+    std::vector<std::unique_ptr<block>> blocks;
+    bus* io = nullptr;
+    std::vector<bool> hooks; // by ROM address
+    hook on_hook;
+
+    trace* recorder = nullptr;
+
+    bool profiling = false;
+    std::vector<std::uint64_t> executions; // not counted in blocks
+    std::unordered_map<std::uint32_t, std::uint64_t> jumps; // from << 16 | to
+};
+
+} // namespace cpu {
+} // namespace hcc {
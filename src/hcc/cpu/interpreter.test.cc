@@ -0,0 +1,316 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/interpreter.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/testing.h"
+#include "hcc/cpu/screen.h"
+#include <algorithm>
+#include <cassert>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+// Step both implementations side by side, including the exceptions thrown.
+void compare_single_steps(const ROM& rom, int ticks)
+{
+    interpreter interp{rom};
+    std::mt19937 generator; // chunks of one tick are not random
+    testing::compare_chunks(rom, generator, ticks, 1,
+        [&](CPU& cpu, RAM& ram, std::uint64_t ticks) { interp.run(cpu, ram, ticks); });
+}
+
+void test_random_programs()
+{
+    std::mt19937 generator{42};
+    for (int i = 0; i < 200; ++i) {
+        compare_single_steps(testing::random_rom(generator), 1000);
+    }
+}
+
+// Every possible C-instruction, on interesting register values.
+void test_all_instructions()
+{
+    const word values[] = {0, 1, 0x7fff, 0x8000, 0xffff, 0x1234};
+    ROM rom;
+    RAM expected_ram, actual_ram;
+    for (unsigned int instruction = COMPUTE; instruction <= 0xffff; ++instruction) {
+        const auto op = decode(instruction);
+        rom[0] = instruction;
+        for (const auto a : values) {
+            for (const auto d : values) {
+                CPU expected_cpu{0, a, d};
+                CPU actual_cpu{0, a, d};
+                if (a < expected_ram.size()) {
+                    expected_ram[a] = actual_ram[a] = d ^ 0x5555;
+                }
+
+                bool expected_throw = false;
+                bool actual_throw = false;
+                try {
+                    expected_cpu.step(rom, expected_ram);
+                } catch (const std::out_of_range&) {
+                    expected_throw = true;
+                }
+                try {
+                    actual_cpu.pc = op.execute(actual_cpu, actual_ram, nullptr, op)
+                                        ? actual_cpu.a
+                                        : actual_cpu.pc + 1;
+                } catch (const std::out_of_range&) {
+                    actual_throw = true;
+                }
+
+                assert(expected_throw == actual_throw);
+                testing::assert_equal(expected_cpu, actual_cpu);
+                assert(a >= expected_ram.size() || expected_ram[a] == actual_ram[a]);
+            }
+        }
+    }
+}
+
+// Run both implementations in chunks of random size, so that blocks are
+// entered at all sorts of positions and cut short by the tick budget.
+void compare_chunks(const ROM& rom, std::mt19937& generator)
+{
+    interpreter interp{rom};
+    testing::compare_chunks(rom, generator, 20, 200,
+        [&](CPU& cpu, RAM& ram, std::uint64_t ticks) { interp.run(cpu, ram, ticks); });
+}
+
+void test_random_chunks()
+{
+    std::mt19937 generator{4242};
+    for (int i = 0; i < 200; ++i) {
+        compare_chunks(testing::random_rom(generator), generator);
+    }
+}
+
+// Fused A- and C-instruction is the same as two steps.
+void test_fused_instructions()
+{
+    const word constants[] = {0, 1, 0x5fff, 0x6000, 0x6001, 0x7fff};
+    ROM rom;
+    RAM expected_ram, actual_ram;
+    for (unsigned int instruction = COMPUTE; instruction <= 0xffff; ++instruction) {
+        rom[1] = instruction;
+        for (const auto constant : constants) {
+            const auto op = decode_fused(constant, instruction);
+            rom[0] = constant;
+            CPU expected_cpu{0, 42, 0x1234};
+            CPU actual_cpu{0, 42, 0x1234};
+            if (constant < expected_ram.size()) {
+                expected_ram[constant] = actual_ram[constant] = 0x5555;
+            }
+
+            bool expected_throw = false;
+            bool actual_throw = false;
+            try {
+                expected_cpu.step(rom, expected_ram);
+                expected_cpu.step(rom, expected_ram);
+            } catch (const std::out_of_range&) {
+                expected_throw = true;
+            }
+            try {
+                actual_cpu.pc = op.execute(actual_cpu, actual_ram, nullptr, op) ? actual_cpu.a : 2;
+            } catch (const std::out_of_range&) {
+                actual_throw = true;
+                actual_cpu.pc = 1;
+            }
+
+            assert(expected_throw == actual_throw);
+            testing::assert_equal(expected_cpu, actual_cpu);
+            assert(constant >= expected_ram.size()
+                   || expected_ram[constant] == actual_ram[constant]);
+        }
+    }
+}
+
+// Running many ticks at once is the same as running them one by one.
+void test_run()
+{
+    ROM rom;
+    // D = 0; loop: D = D + 1; @loop; 0;JMP
+    rom[0] = COMPUTE | RESERVED | DEST_D | COMP_ZERO;
+    rom[1] = COMPUTE | RESERVED | DEST_D | COMP_D_PLUS_ONE;
+    rom[2] = 1;
+    rom[3] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    interpreter interp{rom};
+    CPU cpu;
+    cpu.reset();
+    RAM ram;
+    interp.run(cpu, ram, 1 + 3 * 1000);
+    assert(cpu.d == 1000);
+    assert(cpu.pc == 1);
+}
+
+// Writing into ROM invalidates translated blocks.
+void test_write()
+{
+    ROM rom;
+    // loop: D = D + 1; @loop; 0;JMP
+    rom[0] = COMPUTE | RESERVED | DEST_D | COMP_D_PLUS_ONE;
+    rom[1] = 0;
+    rom[2] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    interpreter interp{rom};
+    CPU cpu;
+    cpu.reset();
+    RAM ram;
+    interp.run(cpu, ram, 3 * 10);
+    assert(cpu.d == 10);
+
+    // loop: D = D - 1; @loop; 0;JMP
+    interp.write(0, COMPUTE | RESERVED | DEST_D | COMP_D_MINUS_ONE);
+    interp.run(cpu, ram, 3 * 10);
+    assert(cpu.d == 0);
+}
+
+// Every changed screen row is marked, tracking does not change results.
+void test_screen_tracking()
+{
+    std::mt19937 generator{4242};
+    std::uniform_int_distribution<int> chunk(1, 500);
+    for (int i = 0; i < 50; ++i) {
+        const ROM rom = testing::random_rom(generator);
+        interpreter interp{rom};
+        screen_dirty dirty;
+        dirty.take();
+        CPU expected_cpu, actual_cpu;
+        RAM expected_ram, actual_ram;
+        expected_cpu.reset();
+        actual_cpu.reset();
+
+        for (int j = 0; j < 20; ++j) {
+            const RAM before = actual_ram;
+            const int ticks = chunk(generator);
+            const bool expected_throw = !testing::reference_run(expected_cpu, rom, expected_ram, ticks);
+            bool actual_throw = false;
+            try {
+                interp.run(actual_cpu, actual_ram, ticks, &dirty);
+            } catch (const std::out_of_range&) {
+                actual_throw = true;
+            }
+
+            assert(expected_throw == actual_throw);
+            testing::assert_equal(expected_cpu, actual_cpu);
+            assert(expected_ram == actual_ram);
+
+            const auto rows = dirty.take();
+            for (unsigned int address = SCREEN; address < KEYBOARD; ++address) {
+                if (before[address] != actual_ram[address]) {
+                    assert(rows[(address - SCREEN) / SCREEN_ROW_WORDS]);
+                }
+            }
+            if (expected_throw) {
+                break;
+            }
+        }
+    }
+
+    // writing the same value does not mark the row
+    ROM rom;
+    rom[0] = SCREEN + 5 * SCREEN_ROW_WORDS;
+    rom[1] = COMPUTE | RESERVED | DEST_M | COMP_MINUS_ONE;
+    rom[2] = SCREEN + 7 * SCREEN_ROW_WORDS + 31;
+    rom[3] = COMPUTE | RESERVED | DEST_M | COMP_ZERO;
+    interpreter interp{rom};
+    screen_dirty dirty;
+    dirty.take();
+    CPU cpu;
+    cpu.reset();
+    RAM ram;
+    interp.run(cpu, ram, 4, &dirty);
+    const auto rows = dirty.take();
+    assert(rows.count() == 1);
+    assert(rows[5]);
+    assert(dirty.take().none());
+}
+
+// Profile counts match a count made by single stepping, also when the tick
+// budget ends in the middle of a block.
+void test_profile()
+{
+    std::mt19937 generator{424242};
+    std::uniform_int_distribution<int> chunk(1, 500);
+    for (int i = 0; i < 50; ++i) {
+        const ROM rom = testing::random_rom(generator);
+        interpreter interp{rom};
+        interp.set_profiling(true);
+        CPU expected_cpu, actual_cpu;
+        RAM expected_ram, actual_ram;
+        expected_cpu.reset();
+        actual_cpu.reset();
+        profile expected;
+        expected.executions.assign(rom.size(), 0);
+
+        bool faulted = false;
+        for (int j = 0; j < 20 && !faulted; ++j) {
+            const int ticks = chunk(generator);
+            CPU before = expected_cpu;
+            try {
+                for (int k = 0; k < ticks; ++k) {
+                    before = expected_cpu;
+                    expected_cpu.step(rom, expected_ram);
+                    ++expected.executions[before.pc];
+                    const bool jump = (rom[before.pc] & COMPUTE) && (rom[before.pc] & MASK_JUMP);
+                    if (jump && expected.executions[before.pc] == 1) {
+                        expected.branches.push_back(before.pc);
+                    }
+                    if (jump && expected_cpu.pc == expected_cpu.a) {
+                        // either taken, or the target happens to be the next address
+                        if (expected_cpu.a != before.pc + 1) {
+                            ++expected.jumps[{before.pc, expected_cpu.pc}];
+                        }
+                    }
+                }
+            } catch (const std::out_of_range&) {
+                faulted = true;
+            }
+            try {
+                interp.run(actual_cpu, actual_ram, ticks);
+            } catch (const std::out_of_range&) {
+            }
+        }
+        if (faulted) {
+            // partially executed block is not counted
+            continue;
+        }
+
+        auto actual = interp.get_profile();
+        assert(actual.executions == expected.executions);
+        std::sort(expected.branches.begin(), expected.branches.end());
+        assert(actual.branches == expected.branches);
+        for (auto it = actual.jumps.begin(); it != actual.jumps.end();) {
+            // taken jumps to the next address look like fallthrough
+            if (it->first.second == it->first.first + 1) {
+                it = actual.jumps.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        assert(actual.jumps == expected.jumps);
+
+        std::stringstream ss;
+        actual.save(ss);
+        const auto loaded = profile::load(ss);
+        assert(loaded.executions == actual.executions);
+        assert(loaded.branches == actual.branches);
+        assert(loaded.jumps == actual.jumps);
+    }
+}
+
+int main()
+{
+    test_random_programs();
+    test_random_chunks();
+    test_all_instructions();
+    test_fused_instructions();
+    test_run();
+    test_write();
+    test_screen_tracking();
+    test_profile();
+}
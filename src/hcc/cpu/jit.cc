@@ -0,0 +1,473 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/jit.h"
+
+#include "hcc/cpu/instruction.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define HCC_JIT_X86_64 1
+#include <sys/mman.h>
+#endif
+
+namespace hcc {
+namespace cpu {
+
+using namespace instruction;
+
+namespace {
+
+const word max_block_length = 64;
+
+// Blocks executed fewer times than this are left to the interpreter.
+const std::uint8_t hot_threshold = 16;
+
+bool is_jump(word instruction)
+{
+    return (instruction & COMPUTE) && (instruction & MASK_JUMP);
+}
+
+#ifdef HCC_JIT_X86_64
+
+// Shared between the generated code and run(). Register assignment inside of
+// generated code:
+//   rbp  jit_state*
+//   rbx  dispatch table
+//   r12  RAM
+//   r13d A
+//   r14d D
+//   r15  ticks left
+//   eax, ecx, edx scratch, eax holds the next program counter when leaving
+struct jit_state {
+    word* ram;
+    const void* const* table;
+    std::uint64_t ticks;
+    std::uint32_t pc;
+    std::uint32_t a;
+    std::uint32_t d;
+    std::uint32_t fault;
+};
+
+using entry_function = void (*)(jit_state*);
+
+const std::uint32_t ram_size = sizeof(RAM) / sizeof(word);
+
+const std::size_t buffer_size = 16 << 20;
+
+// Generous upper bounds for the size of generated code
+const std::size_t max_instruction_size = 96;
+const std::size_t max_block_overhead = 64;
+
+// Layout of the beginning of the buffer
+const std::size_t enter_offset = 0;
+const std::size_t exit_offset = 64;
+const std::size_t fault_offset = 128;
+const std::size_t stubs_size = 192;
+
+std::uint8_t disp(std::size_t offset)
+{
+    return static_cast<std::uint8_t>(offset);
+}
+
+struct emitter {
+    std::uint8_t* p;
+
+    void bytes(std::initializer_list<std::uint8_t> values)
+    {
+        for (const auto value : values) {
+            *p++ = value;
+        }
+    }
+
+    void imm32(std::uint32_t value)
+    {
+        std::memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+
+    void rel32(const std::uint8_t* target)
+    {
+        imm32(static_cast<std::uint32_t>(target - (p + 4)));
+    }
+
+    // Emit a placeholder for a rel32 operand, to be patched later.
+    std::uint8_t* forward()
+    {
+        const auto at = p;
+        imm32(0);
+        return at;
+    }
+
+    static void patch(std::uint8_t* at, const std::uint8_t* target)
+    {
+        const auto value = static_cast<std::uint32_t>(target - (at + 4));
+        std::memcpy(at, &value, sizeof(value));
+    }
+};
+
+void emit_stubs(std::uint8_t* buffer)
+{
+    emitter e{buffer + enter_offset};
+    e.bytes({0x53}); // push rbx
+    e.bytes({0x55}); // push rbp
+    e.bytes({0x41, 0x54}); // push r12
+    e.bytes({0x41, 0x55}); // push r13
+    e.bytes({0x41, 0x56}); // push r14
+    e.bytes({0x41, 0x57}); // push r15
+    e.bytes({0x48, 0x89, 0xfd}); // mov rbp, rdi
+    e.bytes({0x4c, 0x8b, 0x65, disp(offsetof(jit_state, ram))}); // mov r12, [rbp + ram]
+    e.bytes({0x48, 0x8b, 0x5d, disp(offsetof(jit_state, table))}); // mov rbx, [rbp + table]
+    e.bytes({0x4c, 0x8b, 0x7d, disp(offsetof(jit_state, ticks))}); // mov r15, [rbp + ticks]
+    e.bytes({0x44, 0x8b, 0x6d, disp(offsetof(jit_state, a))}); // mov r13d, [rbp + a]
+    e.bytes({0x44, 0x8b, 0x75, disp(offsetof(jit_state, d))}); // mov r14d, [rbp + d]
+    e.bytes({0x8b, 0x45, disp(offsetof(jit_state, pc))}); // mov eax, [rbp + pc]
+    e.bytes({0xff, 0x24, 0xc3}); // jmp [rbx + rax * 8]
+
+    e.p = buffer + exit_offset;
+    e.bytes({0x89, 0x45, disp(offsetof(jit_state, pc))}); // mov [rbp + pc], eax
+    e.bytes({0x44, 0x89, 0x6d, disp(offsetof(jit_state, a))}); // mov [rbp + a], r13d
+    e.bytes({0x44, 0x89, 0x75, disp(offsetof(jit_state, d))}); // mov [rbp + d], r14d
+    e.bytes({0x4c, 0x89, 0x7d, disp(offsetof(jit_state, ticks))}); // mov [rbp + ticks], r15
+    e.bytes({0x41, 0x5f}); // pop r15
+    e.bytes({0x41, 0x5e}); // pop r14
+    e.bytes({0x41, 0x5d}); // pop r13
+    e.bytes({0x41, 0x5c}); // pop r12
+    e.bytes({0x5d}); // pop rbp
+    e.bytes({0x5b}); // pop rbx
+    e.bytes({0xc3}); // ret
+
+    e.p = buffer + fault_offset;
+    e.bytes({0xc7, 0x45, disp(offsetof(jit_state, fault))}); // mov dword [rbp + fault], 1
+    e.imm32(1);
+    e.bytes({0xe9}); // jmp exit
+    e.rel32(buffer + exit_offset);
+}
+
+// Condition code for cmovcc, after "test ax, ax"
+std::uint8_t condition_code(word jump)
+{
+    switch (jump) {
+    case JGT:
+        return 0xf; // g
+    case JEQ:
+        return 0x4; // e
+    case JGE:
+        return 0xd; // ge
+    case JLT:
+        return 0xc; // l
+    case JNE:
+        return 0x5; // ne
+    case JLE:
+        return 0xe; // le
+    default:
+        throw std::logic_error("Not a conditional jump");
+    }
+}
+
+#endif
+
+} // namespace {
+
+#ifdef HCC_JIT_X86_64
+
+bool jit::supported()
+{
+    return true;
+}
+
+jit::jit()
+    : buffer(nullptr)
+    , buffer_used(0)
+{
+    void* memory = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (memory == MAP_FAILED) {
+        // leave everything to the interpreter
+        return;
+    }
+    buffer = static_cast<std::uint8_t*>(memory);
+    emit_stubs(buffer);
+    mprotect(buffer, buffer_size, PROT_READ | PROT_EXEC);
+}
+
+jit::~jit()
+{
+    if (buffer) {
+        munmap(buffer, buffer_size);
+    }
+}
+
+void jit::translate(word address)
+{
+    const word length = block_length(address);
+    if (buffer_used + length * max_instruction_size + max_block_overhead > buffer_size) {
+        flush();
+    }
+
+    if (mprotect(buffer, buffer_size, PROT_READ | PROT_WRITE) != 0) {
+        return;
+    }
+
+    const auto exit = buffer + exit_offset;
+    const auto fault = buffer + fault_offset;
+    std::vector<std::pair<std::uint8_t*, word>> fault_sites;
+    emitter e{buffer + buffer_used};
+    const auto entry = e.p;
+
+    // only execute the whole block
+    e.bytes({0x49, 0x81, 0xff}); // cmp r15, length
+    e.imm32(length);
+    e.bytes({0x0f, 0x82}); // jb cut
+    const auto cut = e.forward();
+    e.bytes({0x49, 0x81, 0xef}); // sub r15, length
+    e.imm32(length);
+
+    const unsigned int end = address + length;
+    for (unsigned int pc = address; pc < end; ++pc) {
+        const word instruction = rom[pc];
+        if (!(instruction & COMPUTE)) {
+            e.bytes({0x41, 0xbd}); // mov r13d, constant
+            e.imm32(instruction);
+            continue;
+        }
+
+        // x
+        if (instruction & ALU_ZX) {
+            e.bytes({0x31, 0xc0}); // xor eax, eax
+        } else {
+            e.bytes({0x44, 0x89, 0xf0}); // mov eax, r14d
+        }
+        if (instruction & ALU_NX) {
+            e.bytes({0xf7, 0xd0}); // not eax
+        }
+
+        // y, M is read even when zeroed, as CPU::step() does
+        if (instruction & FETCH) {
+            e.bytes({0x41, 0x81, 0xfd}); // cmp r13d, RAM size
+            e.imm32(ram_size);
+            e.bytes({0x0f, 0x83}); // jae fault
+            fault_sites.emplace_back(e.forward(), pc);
+        }
+        if (instruction & ALU_ZY) {
+            e.bytes({0x31, 0xc9}); // xor ecx, ecx
+        } else if (instruction & FETCH) {
+            e.bytes({0x43, 0x0f, 0xb7, 0x0c, 0x6c}); // movzx ecx, word [r12 + r13 * 2]
+        } else {
+            e.bytes({0x44, 0x89, 0xe9}); // mov ecx, r13d
+        }
+        if (instruction & ALU_NY) {
+            e.bytes({0xf7, 0xd1}); // not ecx
+        }
+
+        // out
+        if (instruction & ALU_F) {
+            e.bytes({0x01, 0xc8}); // add eax, ecx
+        } else {
+            e.bytes({0x21, 0xc8}); // and eax, ecx
+        }
+        if (instruction & ALU_NO) {
+            e.bytes({0xf7, 0xd0}); // not eax
+        }
+        e.bytes({0x0f, 0xb7, 0xc0}); // movzx eax, ax
+
+        // dest, with the same result as CPU::step(), but checked before any
+        // register changes, so that the instruction can be executed again
+        if (instruction & DEST_M) {
+            e.bytes({0x44, 0x89, 0xea}); // mov edx, r13d
+            e.bytes({0x81, 0xfa}); // cmp edx, RAM size
+            e.imm32(ram_size);
+            e.bytes({0x0f, 0x83}); // jae fault
+            fault_sites.emplace_back(e.forward(), pc);
+        }
+        if (instruction & DEST_A) {
+            e.bytes({0x41, 0x89, 0xc5}); // mov r13d, eax
+        }
+        if (instruction & DEST_D) {
+            e.bytes({0x41, 0x89, 0xc6}); // mov r14d, eax
+        }
+        if (instruction & DEST_M) {
+            e.bytes({0x66, 0x41, 0x89, 0x04, 0x54}); // mov [r12 + rdx * 2], ax
+        }
+    }
+
+    // next program counter
+    const word last = rom[end - 1];
+    if (!is_jump(last)) {
+        e.bytes({0xb8}); // mov eax, end
+        e.imm32(end);
+    } else if ((last & MASK_JUMP) == JMP) {
+        e.bytes({0x44, 0x89, 0xe8}); // mov eax, r13d
+    } else {
+        e.bytes({0x66, 0x85, 0xc0}); // test ax, ax
+        e.bytes({0xb8}); // mov eax, end
+        e.imm32(end);
+        e.bytes({0x41, 0x0f, static_cast<std::uint8_t>(0x40 | condition_code(last & MASK_JUMP)),
+                 0xc5}); // cmovcc eax, r13d
+    }
+
+    // chain through the dispatch table
+    e.bytes({0x3d}); // cmp eax, ROM size
+    e.imm32(table.size());
+    e.bytes({0x0f, 0x83}); // jae exit
+    e.rel32(exit);
+    e.bytes({0xff, 0x24, 0xc3}); // jmp [rbx + rax * 8]
+
+    // out of line paths
+    emitter::patch(cut, e.p);
+    e.bytes({0xb8}); // mov eax, address
+    e.imm32(address);
+    e.bytes({0xe9}); // jmp exit
+    e.rel32(exit);
+    // give back ticks of the instructions not executed, including the faulting one
+    for (const auto& site : fault_sites) {
+        emitter::patch(site.first, e.p);
+        e.bytes({0x49, 0x81, 0xc7}); // add r15, end - pc
+        e.imm32(end - site.second);
+        e.bytes({0xb8}); // mov eax, pc
+        e.imm32(site.second);
+        e.bytes({0xe9}); // jmp fault
+        e.rel32(fault);
+    }
+
+    buffer_used = e.p - buffer;
+    mprotect(buffer, buffer_size, PROT_READ | PROT_EXEC);
+    table[address] = entry;
+}
+
+void jit::run(CPU& cpu, RAM& ram, std::uint64_t ticks)
+{
+    if (!buffer) {
+        fallback.run(cpu, ram, ticks);
+        return;
+    }
+
+    const void* const exit = buffer + exit_offset;
+    entry_function enter;
+    const void* const enter_address = buffer + enter_offset;
+    std::memcpy(&enter, &enter_address, sizeof(enter));
+
+    while (ticks > 0) {
+        if (cpu.pc < table.size() && table[cpu.pc] != exit) {
+            jit_state state{ram.data(), table.data(), ticks, cpu.pc, cpu.a, cpu.d, 0};
+            enter(&state);
+            cpu.pc = state.pc;
+            cpu.a = state.a;
+            cpu.d = state.d;
+            ticks = state.ticks;
+            if (state.fault) {
+                // outside of RAM, left to the interpreter to reach a device or throw
+                fallback.run(cpu, ram, 1);
+                --ticks;
+                continue;
+            }
+            if (cpu.pc < table.size() && table[cpu.pc] != exit) {
+                // not enough ticks for the whole block
+                fallback.run(cpu, ram, ticks);
+                return;
+            }
+            continue;
+        }
+
+        // executed by interpreter, which also reports program counter outside of ROM
+        // hooks are left to the interpreter
+        if (cpu.pc < table.size() && !fallback.hooked(cpu.pc)
+            && ++hotness[cpu.pc] >= hot_threshold) {
+            translate(cpu.pc);
+            if (table[cpu.pc] != exit) {
+                continue;
+            }
+        }
+        const std::uint64_t length = cpu.pc < table.size() ? block_length(cpu.pc) : 1;
+        const auto n = std::min(ticks, length);
+        fallback.run(cpu, ram, n);
+        ticks -= n;
+    }
+}
+
+void jit::flush()
+{
+    table.assign(rom.size(), buffer ? buffer + exit_offset : nullptr);
+    hotness.assign(rom.size(), 0);
+    buffer_used = stubs_size;
+}
+
+#else
+
+bool jit::supported()
+{
+    return false;
+}
+
+jit::jit()
+    : buffer(nullptr)
+    , buffer_used(0)
+{
+}
+
+jit::~jit()
+{
+}
+
+void jit::translate(word)
+{
+}
+
+void jit::run(CPU& cpu, RAM& ram, std::uint64_t ticks)
+{
+    fallback.run(cpu, ram, ticks);
+}
+
+void jit::flush()
+{
+}
+
+#endif
+
+jit::jit(const ROM& rom)
+    : jit()
+{
+    load(rom);
+}
+
+void jit::load(const ROM& rom_)
+{
+    fallback.load(rom_);
+    rom.assign(rom_.begin(), rom_.end());
+    flush();
+}
+
+void jit::set_hook(const std::vector<word>& addresses, hook h)
+{
+    fallback.set_hook(addresses, std::move(h));
+    flush();
+}
+
+void jit::write(word address, word instruction)
+{
+    fallback.write(address, instruction);
+    rom.at(address) = instruction;
+    flush();
+}
+
+word jit::block_length(word address) const
+{
+    word length = 0;
+    for (unsigned int pc = address; pc < rom.size() && length < max_block_length; ++pc) {
+        if (pc != address && fallback.hooked(pc)) {
+            break;
+        }
+        ++length;
+        if (is_jump(rom[pc])) {
+            break;
+        }
+    }
+    return length;
+}
+
+} // namespace cpu {
+} // namespace hcc {
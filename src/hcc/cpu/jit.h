@@ -0,0 +1,77 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+#include "hcc/cpu/interpreter.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * Translates hot basic blocks into x86-64 machine code. Blocks are chained
+ * through a dispatch table indexed by ROM address, targets which have not
+ * been translated (yet) are executed by the interpreter. Results are
+ * bit-exact with CPU::step().
+ *
+ * On other platforms, everything is executed by the interpreter.
+ */
+struct jit {
+    jit();
+    jit(const ROM& rom);
+    ~jit();
+
+    jit(const jit&) = delete;
+    jit& operator=(const jit&) = delete;
+
+    /**
+     * Whether native code is generated on this platform.
+     */
+    static bool supported();
+
+    /**
+     * Load the ROM and drop all translated code.
+     */
+    void load(const ROM& rom);
+
+    /**
+     * Write one instruction into ROM, dropping all translated code.
+     */
+    void write(word address, word instruction);
+
+    /**
+     * Execute given number of instructions.
+     */
+    void run(CPU& cpu, RAM& ram, std::uint64_t ticks);
+
+    /**
+     * Send accesses above RAM to devices mapped on io. Generated code only
+     * checks the bounds of RAM, accesses above it are done by the
+     * interpreter.
+     */
+    void set_bus(bus* io) { fallback.set_bus(io); }
+
+    /**
+     * See interpreter::set_hook(). Hooked addresses are never translated,
+     * they always start a block executed by the interpreter.
+     */
+    void set_hook(const std::vector<word>& addresses, hook h);
+
+private:
+    word block_length(word address) const;
+    void translate(word address);
+    void flush();
+
+    interpreter fallback;
+    std::vector<word> rom;
+    std::vector<std::uint8_t> hotness;
+    std::vector<const void*> table;
+    std::uint8_t* buffer;
+    std::size_t buffer_used;
+};
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,92 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/jit.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/testing.h"
+#include <cassert>
+#include <random>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+// Run the jit against CPU::step() in chunks of random size.
+void compare_chunks(const ROM& rom, std::mt19937& generator, int chunks, int max_chunk = 2000)
+{
+    jit j{rom};
+    testing::compare_chunks(rom, generator, chunks, max_chunk,
+        [&](CPU& cpu, RAM& ram, std::uint64_t ticks) { j.run(cpu, ram, ticks); });
+}
+
+void test_random_programs()
+{
+    std::mt19937 generator{42};
+    for (int i = 0; i < 300; ++i) {
+        compare_chunks(testing::random_rom(generator), generator, 20);
+    }
+}
+
+// Every (comp, dest) combination, in a hot loop.
+void test_all_computations()
+{
+    ROM rom;
+    unsigned int pc = 0;
+    for (word comp = 0; comp <= (MASK_COMP >> 6); ++comp) {
+        for (word dest = 0; dest <= (MASK_DEST >> 3); ++dest) {
+            rom[pc++] = 100 + (comp & 0x3);
+            rom[pc++] = COMPUTE | RESERVED | comp << 6 | dest << 3;
+        }
+    }
+    rom[pc++] = 0;
+    rom[pc++] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    std::mt19937 generator{4242};
+    compare_chunks(rom, generator, 40, 5000);
+}
+
+// Every jump condition on both signs and zero.
+void test_all_jumps()
+{
+    std::mt19937 generator{424242};
+    for (word jump = 0; jump <= MASK_JUMP; ++jump) {
+        // loop: @0x3000; D=D+A; @loop; D;<jump>; @0; 0;JMP
+        ROM rom;
+        rom[0] = 0x3000;
+        rom[1] = COMPUTE | RESERVED | DEST_D | COMP_D_PLUS_A;
+        rom[2] = 0;
+        rom[3] = COMPUTE | RESERVED | COMP_D | jump;
+        rom[4] = 0;
+        rom[5] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+        compare_chunks(rom, generator, 10);
+    }
+}
+
+// Writing into ROM drops translated code.
+void test_write()
+{
+    ROM rom;
+    // loop: D = D + 1; @loop; 0;JMP
+    rom[0] = COMPUTE | RESERVED | DEST_D | COMP_D_PLUS_ONE;
+    rom[1] = 0;
+    rom[2] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+
+    jit j{rom};
+    CPU cpu;
+    cpu.reset();
+    RAM ram;
+    j.run(cpu, ram, 3 * 100);
+    assert(cpu.d == 100);
+
+    // loop: D = D - 1; @loop; 0;JMP
+    j.write(0, COMPUTE | RESERVED | DEST_D | COMP_D_MINUS_ONE);
+    j.run(cpu, ram, 3 * 100);
+    assert(cpu.d == 0);
+}
+
+int main()
+{
+    test_random_programs();
+    test_all_computations();
+    test_all_jumps();
+    test_write();
+}
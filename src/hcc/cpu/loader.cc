@@ -0,0 +1,134 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/loader.h"
+#include "hcc/util/mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace hcc {
+namespace cpu {
+
+namespace {
+
+const char MAGIC[8] = {'H', 'A', 'C', 'K', '_', 'R', 'O', 'M'};
+const word VERSION = 1;
+const std::size_t HEADER_WORDS = 4;
+
+word get_word(const unsigned char* data)
+{
+    return data[0] | data[1] << 8;
+}
+
+// FNV-1a, over the little endian bytes
+std::uint32_t checksum(const unsigned char* data, std::size_t size)
+{
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the number of instructions, or -1 if malformed.
+long load_binary(const unsigned char* data, std::size_t size, ROM& rom)
+{
+    const auto header = data + sizeof(MAGIC);
+    if (size < sizeof(MAGIC) + 2 * HEADER_WORDS || get_word(header) != VERSION) {
+        return -1;
+    }
+    const std::size_t count = get_word(header + 2);
+    const std::uint32_t hash = get_word(header + 4) | std::uint32_t{get_word(header + 6)} << 16;
+    const auto code = header + 2 * HEADER_WORDS;
+    if (count > rom.size() || size != sizeof(MAGIC) + 2 * (HEADER_WORDS + count)
+        || checksum(code, 2 * count) != hash) {
+        return -1;
+    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    std::memcpy(rom.data(), code, 2 * count);
+#else
+    for (std::size_t i = 0; i < count; ++i) {
+        rom[i] = get_word(code + 2 * i);
+    }
+#endif
+    return count;
+}
+
+// Returns the number of instructions, or -1 if malformed.
+long load_text(const unsigned char* data, std::size_t size, ROM& rom)
+{
+    const auto end = data + size;
+    std::size_t count = 0;
+    while (data != end && count != rom.size()) {
+        const auto newline = std::find(data, end, '\n');
+        const auto length = newline - data;
+        if (length == 16) {
+            word instruction = 0;
+            for (unsigned int i = 0; i < 16; ++i) {
+                const unsigned int digit = data[i] - '0';
+                if (digit > 1) {
+                    return -1;
+                }
+                instruction = instruction << 1 | digit;
+            }
+            rom[count++] = instruction;
+        } else if (length != 0) {
+            return -1;
+        }
+        data = newline == end ? end : newline + 1;
+    }
+    return count;
+}
+
+} // namespace {
+
+bool load(const std::string& filename, ROM& rom)
+{
+    const util::mapped_file file{filename};
+    if (!file.opened()) {
+        return false;
+    }
+
+    const auto data = reinterpret_cast<const unsigned char*>(file.data());
+    const bool binary = file.size() >= sizeof(MAGIC)
+        && std::equal(MAGIC, MAGIC + sizeof(MAGIC), data);
+    const auto count = binary ? load_binary(data, file.size(), rom)
+                              : load_text(data, file.size(), rom);
+    if (count < 0) {
+        return false;
+    }
+
+    // clear the rest
+    std::fill(rom.begin() + count, rom.end(), 0);
+    return true;
+}
+
+void save_binary(std::ostream& out, const word* program, std::size_t size)
+{
+    if (size > sizeof(ROM) / sizeof(word)) {
+        throw std::runtime_error("Program does not fit into ROM");
+    }
+
+    std::string data;
+    data.reserve(2 * size);
+    for (std::size_t i = 0; i < size; ++i) {
+        data.push_back(static_cast<char>(program[i]));
+        data.push_back(static_cast<char>(program[i] >> 8));
+    }
+    const auto hash = checksum(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    const word header[HEADER_WORDS] = {VERSION, static_cast<word>(size), static_cast<word>(hash),
+                                       static_cast<word>(hash >> 16)};
+
+    out.write(MAGIC, sizeof(MAGIC));
+    for (const word w : header) {
+        out.put(static_cast<char>(w));
+        out.put(static_cast<char>(w >> 8));
+    }
+    out << data;
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,33 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * Load a program, either in .hack format, one instruction per line written as
+ * 16 binary digits, or in the binary format written by save_binary(), told
+ * apart by its magic. The file is mapped into memory rather than read. The
+ * rest of the ROM is cleared. Returns false if the file could not be read or
+ * is malformed.
+ */
+bool load(const std::string& filename, ROM& rom);
+
+/**
+ * Binary format: magic "HACK_ROM", then format version, number of
+ * instructions, and FNV-1a checksum of the instructions as two words, low
+ * first, then the instructions, all as 16-bit little endian numbers.
+ *
+ * @throws std::runtime_error if the program does not fit into ROM
+ */
+void save_binary(std::ostream& out, const word* program, std::size_t size);
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,102 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/loader.h"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace hcc::cpu;
+
+const std::vector<word> program = {0x0000, 0xffff, 0x8001, 0x1234, 0xec10};
+
+void write_file(const std::string& filename, const std::string& contents)
+{
+    std::ofstream output{filename, std::ios::binary};
+    output << contents;
+    assert(output);
+}
+
+std::string binary_image(const std::vector<word>& code)
+{
+    std::ostringstream output;
+    save_binary(output, code.data(), code.size());
+    return output.str();
+}
+
+// Both formats load the same, and clear the rest of the ROM.
+void test_formats()
+{
+    std::unique_ptr<ROM> expected{new ROM()};
+    std::copy(program.begin(), program.end(), expected->begin());
+
+    write_file("loader.test.hack", "0000000000000000\n"
+                                   "1111111111111111\n"
+                                   "\n"
+                                   "1000000000000001\n"
+                                   "0001001000110100\n"
+                                   "1110110000010000");
+    std::unique_ptr<ROM> rom{new ROM()};
+    rom->fill(42);
+    assert(load("loader.test.hack", *rom));
+    assert(*rom == *expected);
+
+    const auto image = binary_image(program);
+    assert(image.size() == 16 + 2 * program.size());
+    assert(image.compare(0, 8, "HACK_ROM") == 0);
+    write_file("loader.test.bin", image);
+    rom->fill(42);
+    assert(load("loader.test.bin", *rom));
+    assert(*rom == *expected);
+
+    // empty program
+    write_file("loader.test.bin", binary_image({}));
+    assert(load("loader.test.bin", *rom));
+    assert(*rom == ROM());
+    write_file("loader.test.hack", "");
+    assert(load("loader.test.hack", *rom));
+}
+
+void test_malformed()
+{
+    std::unique_ptr<ROM> rom{new ROM()};
+    assert(!load("loader.test.missing", *rom));
+
+    write_file("loader.test.hack", "0000000000000000\n000000000000000\n");
+    assert(!load("loader.test.hack", *rom));
+    write_file("loader.test.hack", "000000000000000x\n");
+    assert(!load("loader.test.hack", *rom));
+
+    const auto image = binary_image(program);
+    write_file("loader.test.bin", image.substr(0, image.size() - 1));
+    assert(!load("loader.test.bin", *rom));
+    write_file("loader.test.bin", image + '\0');
+    assert(!load("loader.test.bin", *rom));
+    auto corrupted = image;
+    corrupted[20] ^= 1;
+    write_file("loader.test.bin", corrupted);
+    assert(!load("loader.test.bin", *rom));
+    auto version = image;
+    version[8] = 2;
+    write_file("loader.test.bin", version);
+    assert(!load("loader.test.bin", *rom));
+
+    bool thrown = false;
+    try {
+        binary_image(std::vector<word>(0x8001));
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+int main()
+{
+    test_formats();
+    test_malformed();
+}
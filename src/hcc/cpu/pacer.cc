@@ -0,0 +1,91 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/pacer.h"
+
+#include <algorithm>
+
+namespace hcc {
+namespace cpu {
+
+const pacer::clock::duration pacer::slice = std::chrono::milliseconds(1);
+const std::uint64_t pacer::unthrottled_slice;
+const pacer::clock::duration pacer::max_lag = std::chrono::milliseconds(100);
+const pacer::clock::duration pacer::window = std::chrono::milliseconds(500);
+
+pacer::pacer(std::uint64_t frequency)
+{
+    start(frequency, clock::now());
+}
+
+void pacer::start(std::uint64_t frequency, clock::time_point now)
+{
+    frequency_ = frequency;
+    slice_ticks = frequency ? std::max<std::uint64_t>(1, ticks_at(slice)) : unthrottled_slice;
+    epoch = now;
+    executed = 0;
+    window_start = now;
+    window_ticks = 0;
+    achieved_ = 0;
+}
+
+std::uint64_t pacer::ticks_at(clock::duration elapsed) const
+{
+    using namespace std::chrono;
+    const auto ns = duration_cast<nanoseconds>(elapsed).count();
+    if (ns <= 0) {
+        return 0;
+    }
+    // split to avoid overflow for long runs at high frequencies
+    const auto seconds = static_cast<std::uint64_t>(ns) / 1000000000;
+    const auto rest = static_cast<std::uint64_t>(ns) % 1000000000;
+    return seconds * frequency_ + rest * frequency_ / 1000000000;
+}
+
+pacer::clock::duration pacer::time_of(std::uint64_t ticks) const
+{
+    using namespace std::chrono;
+    const auto seconds = ticks / frequency_;
+    const auto rest = ticks % frequency_;
+    return duration_cast<clock::duration>(nanoseconds(seconds * 1000000000
+                                                      + (rest * 1000000000 + frequency_ - 1)
+                                                            / frequency_));
+}
+
+std::uint64_t pacer::budget(clock::time_point now)
+{
+    if (!frequency_) {
+        return slice_ticks;
+    }
+
+    if (now - epoch > time_of(executed) + max_lag) {
+        // fell behind, start over from here
+        epoch = now;
+        executed = 0;
+    }
+    const auto due = ticks_at(now - epoch);
+    return (due > executed) ? std::min(due - executed, slice_ticks) : 0;
+}
+
+pacer::clock::time_point pacer::due() const
+{
+    if (!frequency_) {
+        return epoch;
+    }
+    return epoch + time_of(executed + slice_ticks);
+}
+
+void pacer::advance(std::uint64_t ticks, clock::time_point now)
+{
+    executed += ticks;
+    window_ticks += ticks;
+
+    const auto elapsed = now - window_start;
+    if (elapsed >= window) {
+        achieved_ = window_ticks / std::chrono::duration<double>(elapsed).count();
+        window_start = now;
+        window_ticks = 0;
+    }
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,80 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * Keeps a CPU running at a given clock frequency. The caller asks for a
+ * budget, executes that many instructions in one batch, reports them back and
+ * sleeps until the next batch is due. Time is passed in explicitly, taken
+ * from a monotonic clock.
+ *
+ * When the host cannot keep up, the schedule slips instead of building up an
+ * ever growing backlog, so a pause does not turn into a burst afterwards.
+ */
+struct pacer {
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * Frequency in Hz, zero means unthrottled.
+     */
+    explicit pacer(std::uint64_t frequency = 0);
+
+    std::uint64_t frequency() const { return frequency_; }
+
+    /**
+     * Change the frequency and start a new schedule at given time.
+     */
+    void start(std::uint64_t frequency, clock::time_point now);
+
+    /**
+     * Number of instructions due at given time, at most one slice.
+     */
+    std::uint64_t budget(clock::time_point now);
+
+    /**
+     * Time when the next slice will be due.
+     */
+    clock::time_point due() const;
+
+    /**
+     * Record instructions executed.
+     */
+    void advance(std::uint64_t ticks, clock::time_point now);
+
+    /**
+     * Frequency achieved in the last measurement window, in Hz.
+     */
+    double achieved() const { return achieved_; }
+
+    // largest batch, in time and in instructions when unthrottled
+    static const clock::duration slice;
+    static const std::uint64_t unthrottled_slice = 1 << 20;
+
+    // how far behind the schedule may fall before it slips
+    static const clock::duration max_lag;
+
+    // how often is achieved frequency measured
+    static const clock::duration window;
+
+private:
+    std::uint64_t ticks_at(clock::duration elapsed) const;
+    clock::duration time_of(std::uint64_t ticks) const;
+
+    std::uint64_t frequency_;
+    std::uint64_t slice_ticks;
+    clock::time_point epoch;
+    std::uint64_t executed; // since epoch
+
+    clock::time_point window_start;
+    std::uint64_t window_ticks;
+    double achieved_;
+};
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,73 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/pacer.h"
+#include <cassert>
+
+using hcc::cpu::pacer;
+using std::chrono::milliseconds;
+
+void test_schedule()
+{
+    const auto t0 = pacer::clock::now();
+    pacer p;
+    p.start(1000000, t0);
+    assert(p.frequency() == 1000000);
+
+    // nothing due right away, one slice after a millisecond
+    assert(p.budget(t0) == 0);
+    assert(p.due() == t0 + milliseconds(1));
+    assert(p.budget(t0 + milliseconds(1)) == 1000);
+    p.advance(1000, t0 + milliseconds(1));
+    assert(p.budget(t0 + milliseconds(1)) == 0);
+    assert(p.due() == t0 + milliseconds(2));
+
+    // at most one slice at a time, the rest stays due
+    assert(p.budget(t0 + milliseconds(5)) == 1000);
+    p.advance(700, t0 + milliseconds(5));
+    assert(p.budget(t0 + milliseconds(5)) == 1000);
+    p.advance(3300, t0 + milliseconds(5));
+    assert(p.budget(t0 + milliseconds(5)) == 0);
+}
+
+void test_slip()
+{
+    const auto t0 = pacer::clock::now();
+    pacer p;
+    p.start(1000000, t0);
+
+    // a long stall is not made up for
+    assert(p.budget(t0 + milliseconds(1000)) == 0);
+    assert(p.budget(t0 + milliseconds(1001)) == 1000);
+}
+
+void test_achieved()
+{
+    const auto t0 = pacer::clock::now();
+    pacer p;
+    p.start(1000000, t0);
+    assert(p.achieved() == 0);
+    p.advance(250000, t0 + milliseconds(250));
+    assert(p.achieved() == 0);
+    p.advance(250000, t0 + milliseconds(500));
+    assert(p.achieved() > 999999 && p.achieved() < 1000001);
+}
+
+void test_unthrottled()
+{
+    const auto t0 = pacer::clock::now();
+    pacer p;
+    p.start(0, t0);
+    assert(p.budget(t0) == pacer::unthrottled_slice);
+    p.advance(pacer::unthrottled_slice, t0);
+    assert(p.budget(t0) == pacer::unthrottled_slice);
+    assert(p.due() <= t0);
+}
+
+int main()
+{
+    test_schedule();
+    test_slip();
+    test_achieved();
+    test_unthrottled();
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/profile.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace hcc {
+namespace cpu {
+
+namespace {
+
+const std::size_t rom_size = sizeof(ROM) / sizeof(word);
+
+} // namespace {
+
+std::uint64_t profile::taken(word address) const
+{
+    std::uint64_t result = 0;
+    for (auto it = jumps.lower_bound({address, 0}); it != jumps.end() && it->first.first == address;
+         ++it) {
+        result += it->second;
+    }
+    return result;
+}
+
+void profile::save(std::ostream& out) const
+{
+    for (std::size_t address = 0; address < executions.size(); ++address) {
+        if (executions[address]) {
+            out << "x " << address << ' ' << executions[address] << '\n';
+        }
+    }
+    for (const auto address : branches) {
+        out << "b " << address << '\n';
+    }
+    for (const auto& jump : jumps) {
+        out << "j " << jump.first.first << ' ' << jump.first.second << ' ' << jump.second << '\n';
+    }
+}
+
+profile profile::load(std::istream& in)
+{
+    profile result;
+    result.executions.assign(rom_size, 0);
+
+    std::string line;
+    unsigned int line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream ss{line};
+        char kind = 0;
+        unsigned int from = 0;
+        unsigned int to = 0;
+        std::uint64_t count = 0;
+        bool valid = false;
+        if ((ss >> kind) && kind == 'x') {
+            valid = (ss >> from >> count) && from < result.executions.size();
+            if (valid) {
+                result.executions[from] += count;
+            }
+        } else if (kind == 'b') {
+            valid = (ss >> from) && from < result.executions.size();
+            if (valid) {
+                result.branches.push_back(static_cast<word>(from));
+            }
+        } else if (kind == 'j') {
+            valid = (ss >> from >> to >> count) && from <= 0xffff && to <= 0xffff;
+            if (valid) {
+                result.jumps[{static_cast<word>(from), static_cast<word>(to)}] += count;
+            }
+        }
+        if (!valid) {
+            throw std::runtime_error("Malformed profile at line " + std::to_string(line_number));
+        }
+    }
+    std::sort(result.branches.begin(), result.branches.end());
+    result.branches.erase(std::unique(result.branches.begin(), result.branches.end()),
+                          result.branches.end());
+    return result;
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,40 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * Execution counts of a program: how many times each ROM address was
+ * executed, which of the executed instructions are jumps, and how many times
+ * each jump was taken to each target. A jump at some address was not taken
+ * as many times as it was executed, minus the times it was taken.
+ */
+struct profile {
+    std::vector<std::uint64_t> executions; // indexed by ROM address
+    std::vector<word> branches; // addresses of executed jumps, ascending
+    std::map<std::pair<word, word>, std::uint64_t> jumps; // (from, to) -> times taken
+
+    std::uint64_t taken(word address) const;
+
+    /**
+     * Text format, one count per line: "x <address> <count>" for executions,
+     * "b <address>" for executed jumps and "j <from> <to> <count>" for taken
+     * jumps. Zero counts are left out.
+     */
+    void save(std::ostream& out) const;
+    static profile load(std::istream& in);
+};
+
+} // namespace cpu {
+} // namespace hcc {
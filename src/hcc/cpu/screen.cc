@@ -0,0 +1,185 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/screen.h"
+
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace hcc {
+namespace cpu {
+
+void expand_scalar(const word* words, std::size_t count, std::uint32_t* pixels,
+                   std::uint32_t black, std::uint32_t white)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        const word value = words[i];
+        for (unsigned int bit = 0; bit < 16; ++bit) {
+            *pixels++ = ((value >> bit) & 1) ? black : white;
+        }
+    }
+}
+
+#if defined(__SSE2__)
+
+// Broadcast the word into four lanes, pick one bit per lane and turn the lanes
+// with the bit set into all ones, which select black over white.
+void expand(const word* words, std::size_t count, std::uint32_t* pixels, std::uint32_t black,
+            std::uint32_t white)
+{
+    const __m128i background = _mm_set1_epi32(white);
+    const __m128i difference = _mm_set1_epi32(white ^ black);
+    const __m128i bits[4] = {
+        _mm_set_epi32(1 << 3, 1 << 2, 1 << 1, 1 << 0),
+        _mm_set_epi32(1 << 7, 1 << 6, 1 << 5, 1 << 4),
+        _mm_set_epi32(1 << 11, 1 << 10, 1 << 9, 1 << 8),
+        _mm_set_epi32(1 << 15, 1 << 14, 1 << 13, 1 << 12),
+    };
+
+    for (std::size_t i = 0; i < count; ++i) {
+        const __m128i value = _mm_set1_epi32(words[i]);
+        for (const auto& mask : bits) {
+            const __m128i set = _mm_cmpeq_epi32(_mm_and_si128(value, mask), mask);
+            const __m128i out = _mm_xor_si128(background, _mm_and_si128(set, difference));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels), out);
+            pixels += 4;
+        }
+    }
+}
+
+#else
+
+void expand(const word* words, std::size_t count, std::uint32_t* pixels, std::uint32_t black,
+            std::uint32_t white)
+{
+    expand_scalar(words, count, pixels, black, white);
+}
+
+#endif
+
+namespace {
+
+const std::size_t ROW_BYTES = SCREEN_WIDTH / 8;
+
+// Images put the leftmost pixel into the most significant bit of a byte, Hack
+// into the least significant one.
+struct reversed_bits {
+    reversed_bits()
+    {
+        for (unsigned int i = 0; i < 256; ++i) {
+            unsigned int r = 0;
+            for (unsigned int bit = 0; bit < 8; ++bit) {
+                r |= ((i >> bit) & 1) << (7 - bit);
+            }
+            table[i] = r;
+        }
+    }
+
+    unsigned char table[256];
+};
+
+const reversed_bits reversed;
+
+// One row, eight pixels per byte with set bits black, xor-ed with invert.
+void pack_row(const word* row, unsigned char invert, std::string& out)
+{
+    for (unsigned int i = 0; i < SCREEN_ROW_WORDS; ++i) {
+        out.push_back(reversed.table[row[i] & 0xff] ^ invert);
+        out.push_back(reversed.table[row[i] >> 8] ^ invert);
+    }
+}
+
+struct crc_table {
+    crc_table()
+    {
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+
+    std::uint32_t table[256];
+};
+
+const crc_table crc;
+
+void put_u32(std::string& out, std::uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>(value >> shift));
+    }
+}
+
+// length, type, data and CRC of type and data
+void write_chunk(std::ostream& out, const char* type, const std::string& data)
+{
+    std::string chunk{type};
+    chunk += data;
+    std::uint32_t c = 0xffffffff;
+    for (const unsigned char byte : chunk) {
+        c = crc.table[(c ^ byte) & 0xff] ^ (c >> 8);
+    }
+    std::string length;
+    put_u32(length, data.size());
+    put_u32(chunk, c ^ 0xffffffff);
+    out << length << chunk;
+}
+
+} // namespace {
+
+void write_pbm(std::ostream& out, const word* words)
+{
+    std::string data;
+    data.reserve(SCREEN_HEIGHT * ROW_BYTES);
+    for (unsigned int y = 0; y < SCREEN_HEIGHT; ++y) {
+        pack_row(words + y * SCREEN_ROW_WORDS, 0, data);
+    }
+    out << "P4\n" << SCREEN_WIDTH << ' ' << SCREEN_HEIGHT << '\n' << data;
+}
+
+void write_png(std::ostream& out, const word* words)
+{
+    out << "\x89PNG\r\n\x1a\n";
+
+    std::string header;
+    put_u32(header, SCREEN_WIDTH);
+    put_u32(header, SCREEN_HEIGHT);
+    header += std::string{1, 0, 0, 0, 0}; // bit depth, grayscale, deflate, no filter, no interlace
+    write_chunk(out, "IHDR", header);
+
+    // rows prefixed by filter type none, white is one in grayscale
+    std::string image;
+    image.reserve(SCREEN_HEIGHT * (1 + ROW_BYTES));
+    for (unsigned int y = 0; y < SCREEN_HEIGHT; ++y) {
+        image.push_back(0);
+        pack_row(words + y * SCREEN_ROW_WORDS, 0xff, image);
+    }
+
+    // zlib stream of a single stored deflate block, which fits up to 65535 bytes
+    static_assert(SCREEN_HEIGHT * (1 + ROW_BYTES) <= 0xffff, "image fits into one block");
+    std::string data{"\x78\x01"};
+    data.push_back(1); // final block, stored
+    data.push_back(static_cast<char>(image.size()));
+    data.push_back(static_cast<char>(image.size() >> 8));
+    data.push_back(static_cast<char>(~image.size()));
+    data.push_back(static_cast<char>(~image.size() >> 8));
+    data += image;
+    std::uint32_t a = 1;
+    std::uint32_t b = 0;
+    for (const unsigned char byte : image) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(data, b << 16 | a);
+    write_chunk(out, "IDAT", data);
+
+    write_chunk(out, "IEND", "");
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,102 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace hcc {
+namespace cpu {
+
+// memory mapped screen, one bit per pixel, 32 words per row
+const word SCREEN = 0x4000;
+const unsigned int SCREEN_WIDTH = 512;
+const unsigned int SCREEN_HEIGHT = 256;
+const unsigned int SCREEN_ROW_WORDS = SCREEN_WIDTH / 16;
+
+// copy of the screen memory map
+using screen_frame = std::array<word, SCREEN_HEIGHT * SCREEN_ROW_WORDS>;
+
+/**
+ * Expand screen words into 32-bit pixels, least significant bit first, set
+ * bits in black and clear bits in white. Pixels are native endian 0xAARRGGBB
+ * values, as in Cairo's FORMAT_RGB24 and FORMAT_ARGB32 image surfaces.
+ *
+ * Uses SSE2 where available, expand_scalar() otherwise.
+ */
+void expand(const word* words, std::size_t count, std::uint32_t* pixels,
+            std::uint32_t black = 0xff000000, std::uint32_t white = 0xffffffff);
+void expand_scalar(const word* words, std::size_t count, std::uint32_t* pixels,
+                   std::uint32_t black = 0xff000000, std::uint32_t white = 0xffffffff);
+
+/**
+ * Write the screen, given as SCREEN_HEIGHT rows of SCREEN_ROW_WORDS words, as
+ * a black and white image. Bits are reordered a byte at a time, straight from
+ * the words, never expanded into pixels.
+ *
+ * PBM is the binary P4 variant. PNG is 1-bit grayscale, with the image data
+ * stored uncompressed in its zlib stream, so that no library is needed.
+ */
+void write_pbm(std::ostream& out, const word* words);
+void write_png(std::ostream& out, const word* words);
+
+/**
+ * One bit per screen row, set when the CPU changes anything in the row and
+ * collected by whoever draws the screen, possibly on another thread.
+ */
+struct screen_dirty {
+    using rows = std::bitset<SCREEN_HEIGHT>;
+
+    screen_dirty() { mark_all(); }
+
+    /**
+     * Mark the row containing address, if it is a screen address.
+     */
+    void mark(word address)
+    {
+        if (address < SCREEN || address >= KEYBOARD) {
+            return;
+        }
+        const unsigned int row = (address - SCREEN) / SCREEN_ROW_WORDS;
+        auto& chunk = bits[row / 64];
+        const std::uint64_t bit = std::uint64_t{1} << (row % 64);
+        // rows usually change many times before they are drawn
+        if (!(chunk.load(std::memory_order_relaxed) & bit)) {
+            chunk.fetch_or(bit, std::memory_order_release);
+        }
+    }
+
+    void mark_all()
+    {
+        for (auto& chunk : bits) {
+            chunk.store(~std::uint64_t{0}, std::memory_order_release);
+        }
+    }
+
+    /**
+     * Return and clear the rows marked so far.
+     */
+    rows take()
+    {
+        rows result;
+        for (unsigned int i = 0; i < bits.size(); ++i) {
+            const auto chunk = bits[i].exchange(0, std::memory_order_acquire);
+            for (unsigned int j = 0; j < 64; ++j) {
+                result[i * 64 + j] = (chunk >> j) & 1;
+            }
+        }
+        return result;
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, SCREEN_HEIGHT / 64> bits;
+};
+
+} // namespace cpu {
+} // namespace hcc {
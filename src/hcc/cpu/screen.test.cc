@@ -0,0 +1,131 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/screen.h"
+#include <cassert>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace hcc::cpu;
+
+void test_expand()
+{
+    std::mt19937 generator{42};
+    std::uniform_int_distribution<word> any;
+    std::vector<word> words(SCREEN_ROW_WORDS * 4);
+    for (auto& w : words) {
+        w = any(generator);
+    }
+    words[0] = 0x0000;
+    words[1] = 0xffff;
+    words[2] = 0x8001;
+
+    for (std::size_t count = 0; count <= words.size(); ++count) {
+        std::vector<std::uint32_t> expected(count * 16 + 1, 42);
+        std::vector<std::uint32_t> actual(count * 16 + 1, 42);
+        std::vector<std::uint32_t> scalar(count * 16 + 1, 42);
+        for (std::size_t i = 0; i < count * 16; ++i) {
+            expected[i] = (words[i / 16] & (1 << (i % 16))) ? 0x00000000 : 0x00ffffff;
+        }
+        expand(words.data(), count, actual.data(), 0x00000000, 0x00ffffff);
+        expand_scalar(words.data(), count, scalar.data(), 0x00000000, 0x00ffffff);
+        assert(actual == expected);
+        assert(scalar == expected);
+    }
+
+    // default colours are opaque
+    std::uint32_t pixels[16];
+    expand(&words[2], 1, pixels);
+    assert(pixels[0] == 0xff000000);
+    assert(pixels[1] == 0xffffffff);
+    assert(pixels[15] == 0xff000000);
+}
+
+void test_dirty()
+{
+    screen_dirty dirty;
+    assert(dirty.take().all());
+    assert(dirty.take().none());
+
+    dirty.mark(SCREEN - 1);
+    dirty.mark(KEYBOARD);
+    assert(dirty.take().none());
+
+    dirty.mark(SCREEN);
+    dirty.mark(SCREEN + SCREEN_ROW_WORDS - 1);
+    dirty.mark(SCREEN + 100 * SCREEN_ROW_WORDS + 3);
+    dirty.mark(KEYBOARD - 1);
+    const auto rows = dirty.take();
+    assert(rows.count() == 3);
+    assert(rows[0] && rows[100] && rows[SCREEN_HEIGHT - 1]);
+}
+
+std::uint32_t get_u32(const std::string& s, std::size_t offset)
+{
+    std::uint32_t value = 0;
+    for (std::size_t i = offset; i < offset + 4; ++i) {
+        value = value << 8 | static_cast<unsigned char>(s[i]);
+    }
+    return value;
+}
+
+void test_images()
+{
+    screen_frame frame{};
+    frame[0] = 0x0001;                           // leftmost pixel
+    frame[SCREEN_ROW_WORDS + 1] = 0x8000;        // pixel 31 of row 1
+    frame[frame.size() - 1] = 0x00f0;            // pixels 4..7 of the last word
+
+    std::ostringstream pbm;
+    write_pbm(pbm, frame.data());
+    const std::string header = "P4\n512 256\n";
+    const auto p = pbm.str();
+    assert(p.size() == header.size() + SCREEN_HEIGHT * SCREEN_WIDTH / 8);
+    assert(p.compare(0, header.size(), header) == 0);
+    assert(static_cast<unsigned char>(p[header.size()]) == 0x80);
+    assert(p[header.size() + 1] == 0);
+    assert(p[header.size() + 64 + 3] == 1);
+    assert(static_cast<unsigned char>(p[p.size() - 2]) == 0x0f);
+    assert(p[p.size() - 1] == 0);
+
+    std::ostringstream png;
+    write_png(png, frame.data());
+    const auto g = png.str();
+    assert(g.compare(0, 8, "\x89PNG\r\n\x1a\n") == 0);
+    assert(get_u32(g, 8) == 13 && g.compare(12, 4, "IHDR") == 0);
+    assert(get_u32(g, 16) == SCREEN_WIDTH && get_u32(g, 20) == SCREEN_HEIGHT);
+    assert(g[24] == 1 && g[25] == 0);
+
+    // a single stored block of rows, white where the screen is clear
+    const std::size_t idat = 8 + 12 + 13;
+    const std::size_t raw = SCREEN_HEIGHT * (1 + SCREEN_WIDTH / 8);
+    assert(get_u32(g, idat) == 2 + 5 + raw + 4 && g.compare(idat + 4, 4, "IDAT") == 0);
+    const std::size_t rows = idat + 8 + 2 + 5;
+    assert(static_cast<unsigned char>(g[rows - 5]) == 1);
+    assert(static_cast<unsigned char>(g[rows - 4]) + 256 * static_cast<unsigned char>(g[rows - 3])
+           == raw);
+    assert(g[rows] == 0);
+    assert(static_cast<unsigned char>(g[rows + 1]) == 0x7f);
+    assert(static_cast<unsigned char>(g[rows + 2]) == 0xff);
+    std::uint32_t a = 1;
+    std::uint32_t b = 0;
+    for (std::size_t i = rows; i < rows + raw; ++i) {
+        a = (a + static_cast<unsigned char>(g[i])) % 65521;
+        b = (b + a) % 65521;
+    }
+    assert(get_u32(g, rows + raw) == (b << 16 | a));
+
+    // IEND has no data, and thus a well known CRC
+    assert(g.size() == rows + raw + 4 + 4 + 12);
+    assert(get_u32(g, g.size() - 12) == 0 && g.compare(g.size() - 8, 4, "IEND") == 0);
+    assert(get_u32(g, g.size() - 4) == 0xae426082);
+}
+
+int main()
+{
+    test_expand();
+    test_dirty();
+    test_images();
+}
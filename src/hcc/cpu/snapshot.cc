@@ -0,0 +1,189 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace hcc {
+namespace cpu {
+
+namespace {
+
+const std::size_t rom_size = sizeof(ROM) / sizeof(word);
+const std::size_t ram_size = sizeof(RAM) / sizeof(word);
+const std::size_t page_words = snapshot::page_words;
+
+using page_list = std::vector<std::shared_ptr<snapshot::page>>;
+
+const char MAGIC[8] = {'H', 'A', 'C', 'K', 'S', 'N', 'A', 'P'};
+const word VERSION = 1;
+
+std::size_t page_count(std::size_t words)
+{
+    return (words + page_words - 1) / page_words;
+}
+
+// shared by all snapshots, never written to
+const std::shared_ptr<snapshot::page>& zero_page()
+{
+    static const auto page = std::make_shared<snapshot::page>(snapshot::page{});
+    return page;
+}
+
+// Split memory into pages, reusing pages of parent and the zero page where
+// the contents are the same.
+void capture(const word* data, std::size_t size, page_list& captured, const page_list* parent)
+{
+    captured.resize(page_count(size));
+    for (std::size_t i = 0; i < captured.size(); ++i) {
+        const auto first = i * page_words;
+        const auto count = std::min(page_words, size - first);
+        const auto bytes = count * sizeof(word);
+        const auto& zero = zero_page();
+        if (parent && std::memcmp((*parent)[i]->data(), data + first, bytes) == 0) {
+            captured[i] = (*parent)[i];
+        } else if (std::memcmp(zero->data(), data + first, bytes) == 0) {
+            captured[i] = zero;
+        } else {
+            captured[i] = std::make_shared<snapshot::page>();
+            std::copy(data + first, data + first + count, captured[i]->begin());
+        }
+    }
+}
+
+void copy_out(const page_list& captured, word* data, std::size_t size)
+{
+    for (std::size_t i = 0; i < captured.size(); ++i) {
+        const auto first = i * page_words;
+        const auto count = std::min(page_words, size - first);
+        std::copy(captured[i]->begin(), captured[i]->begin() + count, data + first);
+    }
+}
+
+void write_words(std::ostream& out, const word* data, std::size_t count)
+{
+    unsigned char buffer[2 * page_words];
+    while (count > 0) {
+        const auto n = std::min(count, page_words);
+        for (std::size_t i = 0; i < n; ++i) {
+            buffer[2 * i] = static_cast<unsigned char>(data[i]);
+            buffer[2 * i + 1] = static_cast<unsigned char>(data[i] >> 8);
+        }
+        out.write(reinterpret_cast<const char*>(buffer), 2 * n);
+        data += n;
+        count -= n;
+    }
+}
+
+void read_words(std::istream& in, word* data, std::size_t count)
+{
+    unsigned char buffer[2 * page_words];
+    while (count > 0) {
+        const auto n = std::min(count, page_words);
+        if (!in.read(reinterpret_cast<char*>(buffer), 2 * n)) {
+            throw std::runtime_error("Truncated snapshot");
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            data[i] = buffer[2 * i] | buffer[2 * i + 1] << 8;
+        }
+        data += n;
+        count -= n;
+    }
+}
+
+} // namespace {
+
+const std::size_t snapshot::page_words;
+
+snapshot::snapshot()
+    : cpu{0, 0, 0}
+    , rom_pages(page_count(rom_size), zero_page())
+    , ram_pages(page_count(ram_size), zero_page())
+{
+}
+
+snapshot::snapshot(const CPU& cpu_, const ROM& rom, const RAM& ram, const snapshot* parent)
+    : cpu(cpu_)
+{
+    capture(rom.data(), rom_size, rom_pages, parent ? &parent->rom_pages : nullptr);
+    capture(ram.data(), ram_size, ram_pages, parent ? &parent->ram_pages : nullptr);
+}
+
+void snapshot::restore(CPU& cpu_, ROM& rom, RAM& ram) const
+{
+    copy_out(rom_pages, rom.data(), rom_size);
+    restore(cpu_, ram);
+}
+
+void snapshot::restore(CPU& cpu_, RAM& ram) const
+{
+    cpu_ = cpu;
+    copy_out(ram_pages, ram.data(), ram_size);
+}
+
+word snapshot::read_rom(word address) const
+{
+    if (address >= rom_size) {
+        throw std::out_of_range("ROM address out of range");
+    }
+    return (*rom_pages[address / page_words])[address % page_words];
+}
+
+word snapshot::read_ram(word address) const
+{
+    if (address >= ram_size) {
+        throw std::out_of_range("RAM address out of range");
+    }
+    return (*ram_pages[address / page_words])[address % page_words];
+}
+
+void snapshot::write_ram(word address, word value)
+{
+    if (address >= ram_size) {
+        throw std::out_of_range("RAM address out of range");
+    }
+    // nobody else can see a page referenced only from here
+    auto& p = ram_pages[address / page_words];
+    if (p.use_count() > 1) {
+        p = std::make_shared<page>(*p);
+    }
+    (*p)[address % page_words] = value;
+}
+
+void snapshot::save(std::ostream& out) const
+{
+    out.write(MAGIC, sizeof(MAGIC));
+    const word header[4] = {VERSION, cpu.pc, cpu.a, cpu.d};
+    write_words(out, header, 4);
+    for (std::size_t i = 0; i < rom_pages.size(); ++i) {
+        write_words(out, rom_pages[i]->data(), std::min(page_words, rom_size - i * page_words));
+    }
+    for (std::size_t i = 0; i < ram_pages.size(); ++i) {
+        write_words(out, ram_pages[i]->data(), std::min(page_words, ram_size - i * page_words));
+    }
+}
+
+snapshot snapshot::load(std::istream& in)
+{
+    char magic[sizeof(MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), MAGIC)) {
+        throw std::runtime_error("Not a snapshot");
+    }
+    word header[4];
+    read_words(in, header, 4);
+    if (header[0] != VERSION) {
+        throw std::runtime_error("Unsupported snapshot version " + std::to_string(header[0]));
+    }
+
+    std::unique_ptr<ROM> rom{new ROM()};
+    std::unique_ptr<RAM> ram{new RAM()};
+    read_words(in, rom->data(), rom_size);
+    read_words(in, ram->data(), ram_size);
+    return snapshot{{header[1], header[2], header[3]}, *rom, *ram};
+}
+
+} // namespace cpu {
+} // namespace hcc {
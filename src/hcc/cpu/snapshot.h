@@ -0,0 +1,67 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <array>
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * Complete machine state: registers, ROM and RAM, including the keyboard
+ * register at its end.
+ *
+ * Memory is held in immutable pages shared between snapshots, so copying a
+ * snapshot is cheap, and so is taking one which differs from its parent in a
+ * few pages only. Pages are copied when written to. Different snapshots may
+ * be used from different threads.
+ */
+struct snapshot {
+    static const std::size_t page_words = 256;
+    using page = std::array<word, page_words>;
+
+    snapshot();
+
+    /**
+     * Capture the machine. Pages equal to those of parent, if given, are
+     * shared with it.
+     */
+    snapshot(const CPU& cpu, const ROM& rom, const RAM& ram, const snapshot* parent = nullptr);
+
+    /**
+     * Bring the machine back to the captured state.
+     */
+    void restore(CPU& cpu, ROM& rom, RAM& ram) const;
+    void restore(CPU& cpu, RAM& ram) const;
+
+    word read_rom(word address) const;
+    word read_ram(word address) const;
+    void write_ram(word address, word value);
+
+    /**
+     * Binary format: magic "HACKSNAP", format version, PC, A and D, the
+     * whole ROM and the whole RAM, all as 16-bit little endian numbers.
+     */
+    void save(std::ostream& out) const;
+
+    /**
+     * @throws std::runtime_error if the input is not a snapshot
+     */
+    static snapshot load(std::istream& in);
+
+    CPU cpu;
+
+private:
+    std::vector<std::shared_ptr<page>> rom_pages;
+    std::vector<std::shared_ptr<page>> ram_pages;
+};
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,163 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/snapshot.h"
+#include "hcc/cpu/instruction.h"
+#include <cassert>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+struct machine {
+    CPU cpu{0, 0, 0};
+    std::unique_ptr<ROM> rom{new ROM()};
+    std::unique_ptr<RAM> ram{new RAM()};
+};
+
+void assert_equal(const machine& expected, const machine& actual)
+{
+    assert(expected.cpu.pc == actual.cpu.pc);
+    assert(expected.cpu.a == actual.cpu.a);
+    assert(expected.cpu.d == actual.cpu.d);
+    assert(*expected.rom == *actual.rom);
+    assert(*expected.ram == *actual.ram);
+}
+
+// counts in RAM[0] forever, stepping on every RAM word on the way:
+// loop: @0; AM=M+1; M=-1; @loop; 0;JMP
+void counter(machine& m)
+{
+    (*m.rom)[0] = 0;
+    (*m.rom)[1] = COMPUTE | RESERVED | DEST_A | DEST_M | COMP_M_PLUS_ONE;
+    (*m.rom)[2] = COMPUTE | RESERVED | DEST_M | COMP_MINUS_ONE;
+    (*m.rom)[3] = 0;
+    (*m.rom)[4] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+}
+
+void test_restore()
+{
+    std::mt19937 generator{42};
+    std::uniform_int_distribution<word> any;
+    machine expected;
+    expected.cpu = {any(generator), any(generator), any(generator)};
+    for (auto& w : *expected.rom) {
+        w = any(generator);
+    }
+    for (auto& w : *expected.ram) {
+        w = any(generator);
+    }
+    (*expected.ram)[KEYBOARD] = 'K';
+
+    const snapshot s{expected.cpu, *expected.rom, *expected.ram};
+    assert(s.read_ram(KEYBOARD) == 'K');
+    assert(s.read_rom(0x7fff) == (*expected.rom)[0x7fff]);
+
+    machine actual;
+    s.restore(actual.cpu, *actual.rom, *actual.ram);
+    assert_equal(expected, actual);
+
+    // empty snapshot is a machine after reset
+    machine reset;
+    snapshot{}.restore(actual.cpu, *actual.rom, *actual.ram);
+    assert_equal(reset, actual);
+}
+
+// Forks continue the same way as the original.
+void test_fork()
+{
+    machine m;
+    counter(m);
+    for (int i = 0; i < 1000; ++i) {
+        m.cpu.step(*m.rom, *m.ram);
+    }
+    const snapshot booted{m.cpu, *m.rom, *m.ram};
+    for (int i = 0; i < 1000; ++i) {
+        m.cpu.step(*m.rom, *m.ram);
+    }
+
+    for (int fork = 0; fork < 3; ++fork) {
+        machine f;
+        booted.restore(f.cpu, *f.rom, *f.ram);
+        for (int i = 0; i < 1000; ++i) {
+            f.cpu.step(*f.rom, *f.ram);
+        }
+        assert_equal(m, f);
+    }
+}
+
+// Writes into a copy do not show in the original, nor the other way around.
+void test_copy_on_write()
+{
+    machine m;
+    counter(m);
+    snapshot original{m.cpu, *m.rom, *m.ram};
+    snapshot copy = original;
+    copy.write_ram(100, 1);
+    copy.write_ram(101, 2);
+    original.write_ram(100, 3);
+    assert(original.read_ram(100) == 3);
+    assert(original.read_ram(101) == 0);
+    assert(copy.read_ram(100) == 1);
+    assert(copy.read_ram(101) == 2);
+
+    // child shares with parent, but sees its own changes
+    (*m.ram)[5000] = 7;
+    const snapshot child{m.cpu, *m.rom, *m.ram, &copy};
+    assert(child.read_ram(100) == 0);
+    assert(child.read_ram(5000) == 7);
+    assert(copy.read_ram(5000) == 0);
+
+    bool thrown = false;
+    try {
+        copy.write_ram(KEYBOARD + 1, 0);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_save_load()
+{
+    machine expected;
+    counter(expected);
+    for (int i = 0; i < 5000; ++i) {
+        expected.cpu.step(*expected.rom, *expected.ram);
+    }
+    (*expected.ram)[KEYBOARD] = 140;
+
+    std::stringstream file;
+    snapshot{expected.cpu, *expected.rom, *expected.ram}.save(file);
+    assert(file.str().size() == 8 + 2 * (4 + 0x8000 + 0x6001));
+
+    machine actual;
+    snapshot::load(file).restore(actual.cpu, *actual.rom, *actual.ram);
+    assert_equal(expected, actual);
+
+    const std::string inputs[] = {
+        "HACKSNIP", // not a snapshot
+        file.str().substr(0, 1000), // truncated
+        std::string("HACKSNAP\x02\0", 10), // newer version
+    };
+    for (const auto& input : inputs) {
+        std::istringstream ss{input};
+        bool thrown = false;
+        try {
+            snapshot::load(ss);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+int main()
+{
+    test_restore();
+    test_fork();
+    test_copy_on_write();
+    test_save_load();
+}
@@ -0,0 +1,143 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+#include "hcc/cpu/instruction.h"
+
+#include <cassert>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+
+namespace hcc {
+namespace cpu {
+namespace testing {
+
+// Helpers for tests comparing an implementation with CPU::step().
+
+/**
+ * Random program. Its A-instructions mostly load RAM addresses, and some
+ * of them short jump targets, so that some code gets hot and runs
+ * diverge and meet again. Others load anything, so it faults now and
+ * then.
+ */
+inline ROM random_rom(std::mt19937& generator)
+{
+    using namespace hcc::instruction;
+    std::uniform_int_distribution<word> any;
+    std::uniform_int_distribution<word> address(0, 0x6000);
+    std::uniform_int_distribution<word> nearby(0, 0x100);
+    std::uniform_int_distribution<int> kind(0, 7);
+
+    ROM rom;
+    for (auto& instruction : rom) {
+        switch (kind(generator)) {
+        case 0:
+        case 1:
+            instruction = address(generator);
+            break;
+        case 2:
+            instruction = nearby(generator);
+            break;
+        case 3:
+            instruction = any(generator) & ~COMPUTE;
+            break;
+        case 4:
+            instruction = any(generator) | COMPUTE;
+            break;
+        default:
+            instruction = (any(generator) | COMPUTE) & ~MASK_JUMP;
+            break;
+        }
+    }
+    return rom;
+}
+
+/**
+ * Random program with short jumps, which writes into RAM a lot. A is
+ * mostly loaded by A-instructions, so that it does not fault right away.
+ */
+inline ROM random_storing_rom(std::mt19937& generator)
+{
+    using namespace hcc::instruction;
+    std::uniform_int_distribution<word> any;
+    std::uniform_int_distribution<word> address(0, 0x100);
+    std::uniform_int_distribution<int> kind(0, 15);
+
+    ROM rom;
+    for (auto& instruction : rom) {
+        const int k = kind(generator);
+        if (k < 5) {
+            instruction = address(generator);
+        } else if (k < 8) {
+            instruction = (any(generator) | COMPUTE) & ~(DEST_A | DEST_M);
+        } else if (k < 15) {
+            instruction = (any(generator) | COMPUTE | DEST_M) & ~(DEST_A | MASK_JUMP);
+        } else {
+            instruction = (any(generator) | COMPUTE | DEST_A) & ~(DEST_M | MASK_JUMP);
+        }
+    }
+    return rom;
+}
+
+/**
+ * Step cpu for ticks as the reference. Return false if it faulted, in
+ * which case it stopped at the faulting instruction.
+ */
+inline bool reference_run(CPU& cpu, const ROM& rom, RAM& ram, std::uint64_t ticks)
+{
+    try {
+        for (std::uint64_t i = 0; i < ticks; ++i) {
+            cpu.step(rom, ram);
+        }
+    } catch (const std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
+
+inline void assert_equal(const CPU& expected, const CPU& actual)
+{
+    assert(expected.pc == actual.pc);
+    assert(expected.a == actual.a);
+    assert(expected.d == actual.d);
+}
+
+/**
+ * Run rom from reset in chunks of 1 to max_chunk ticks, by reference_run()
+ * and by run(cpu, ram, ticks), and compare the CPUs after each chunk and
+ * the RAMs at the end. Both have to fault in the same chunk, which ends
+ * the comparison.
+ */
+template <typename Run>
+void compare_chunks(const ROM& rom, std::mt19937& generator, int chunks, int max_chunk, Run run)
+{
+    std::uniform_int_distribution<int> chunk(1, max_chunk);
+    CPU expected_cpu, actual_cpu;
+    RAM expected_ram, actual_ram;
+    expected_cpu.reset();
+    actual_cpu.reset();
+
+    for (int i = 0; i < chunks; ++i) {
+        const int ticks = chunk(generator);
+        const bool expected_throw = !reference_run(expected_cpu, rom, expected_ram, ticks);
+        bool actual_throw = false;
+        try {
+            run(actual_cpu, actual_ram, ticks);
+        } catch (const std::out_of_range&) {
+            actual_throw = true;
+        }
+
+        assert(expected_throw == actual_throw);
+        assert_equal(expected_cpu, actual_cpu);
+        if (expected_throw) {
+            break;
+        }
+    }
+    assert(expected_ram == actual_ram);
+}
+
+} // namespace testing {
+} // namespace cpu {
+} // namespace hcc {
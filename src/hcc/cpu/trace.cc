@@ -0,0 +1,278 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/cpu/trace.h"
+
+#include "hcc/cpu/instruction.h"
+
+#include <stdexcept>
+
+namespace hcc {
+namespace cpu {
+
+using namespace instruction;
+
+namespace {
+
+// Record header. Key records carry tick, pc, A and D in full, and the
+// address of the write, if any. Other records continue the previous one: pc
+// is either the next address or A, a jump target, and the write goes to A
+// as it was before the instruction.
+const std::uint8_t JUMPED = 0x01;
+const std::uint8_t NEW_A = 0x02; // delta of A follows
+const std::uint8_t NEW_D = 0x04; // delta of D follows
+const std::uint8_t WRITE = 0x08; // M written, the value follows unless WRITE_D
+const std::uint8_t WRITE_D = 0x10; // written value is D, not stored
+const std::uint8_t KEY = 0x80;
+
+// header, tick and five words as LEB128: pc, A, D, and the address and
+// value of a write which is not D
+const std::size_t MAX_RECORD = 1 + 10 + 5 * 3;
+
+void put(std::uint8_t*& out, std::uint64_t value)
+{
+    while (value >= 0x80) {
+        *out++ = static_cast<std::uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<std::uint8_t>(value);
+}
+
+// zigzag, so that small negative deltas are short too
+void put_delta(std::uint8_t*& out, word from, word to)
+{
+    const word delta = to - from;
+    put(out, static_cast<word>((delta << 1) ^ (0 - (delta >> 15))));
+}
+
+struct reader {
+    const trace_chunk& chunk;
+    std::size_t position;
+
+    std::uint64_t get()
+    {
+        std::uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7) {
+            if (position == chunk.size()) {
+                break;
+            }
+            const auto byte = chunk[position++];
+            value |= std::uint64_t{byte & 0x7fu} << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Malformed trace chunk");
+    }
+
+    word get_word()
+    {
+        const auto value = get();
+        if (value > 0xffff) {
+            throw std::runtime_error("Malformed trace chunk");
+        }
+        return static_cast<word>(value);
+    }
+
+    word get_delta(word from)
+    {
+        const word zigzag = get_word();
+        return from + static_cast<word>((zigzag >> 1) ^ (0 - (zigzag & 1)));
+    }
+};
+
+} // namespace {
+
+trace::trace(std::size_t chunks, std::size_t chunk_size_, bool streaming_)
+    : ring(chunks)
+    , chunk_size(chunk_size_)
+    , streaming(streaming_)
+{
+    if (chunks == 0 || chunk_size < MAX_RECORD) {
+        throw std::invalid_argument("Trace ring too small");
+    }
+    for (auto& chunk : ring) {
+        chunk.reserve(chunk_size);
+    }
+    current.resize(chunk_size);
+}
+
+void trace::step(CPU& cpu, const ROM& rom, RAM& ram)
+{
+    const word pc = cpu.pc;
+    const word old_a = cpu.a;
+    const word instruction = rom.at(pc);
+    cpu.step(rom, ram);
+    const bool write = (instruction & COMPUTE) && (instruction & DEST_M);
+    record(pc, old_a, cpu, write, write ? ram[old_a] : 0);
+}
+
+void trace::run(CPU& cpu, const ROM& rom, RAM& ram, std::uint64_t ticks)
+{
+    for (std::uint64_t i = 0; i < ticks; ++i) {
+        step(cpu, rom, ram);
+    }
+}
+
+// Everything is read into locals first, byte stores may alias anything.
+void trace::record(word pc, word old_a, const CPU& cpu, bool write, word value)
+{
+    if (used + MAX_RECORD > chunk_size) {
+        flush();
+    }
+    const CPU next{pc, cpu.a, cpu.d};
+    const CPU previous = last;
+    std::uint8_t* out = current.data() + used;
+
+    std::uint8_t header = 0;
+    if (write) {
+        header |= (value == next.d) ? WRITE | WRITE_D : WRITE;
+    }
+    const bool sequential = pc == word(previous.pc + 1);
+    const bool continues = !resync && used > 0 && (sequential || pc == previous.a)
+                           && (!write || old_a == previous.a);
+    if (continues) {
+        header |= sequential ? 0 : JUMPED;
+        header |= (next.a != previous.a) ? NEW_A : 0;
+        header |= (next.d != previous.d) ? NEW_D : 0;
+        *out++ = header;
+        if (header & NEW_A) {
+            put_delta(out, previous.a, next.a);
+        }
+        if (header & NEW_D) {
+            put_delta(out, previous.d, next.d);
+        }
+    } else {
+        const auto key_tick = tick;
+        *out++ = header | KEY;
+        put(out, key_tick);
+        put(out, next.pc);
+        put(out, next.a);
+        put(out, next.d);
+        if (write) {
+            put(out, old_a);
+        }
+    }
+    if (write && !(header & WRITE_D)) {
+        put(out, value);
+    }
+
+    used = out - current.data();
+    last = next;
+    resync = false;
+    ++tick;
+}
+
+void trace::skip(std::uint64_t ticks)
+{
+    tick += ticks;
+    resync = true;
+}
+
+void trace::flush()
+{
+    if (used == 0) {
+        return;
+    }
+
+    current.resize(used);
+    const auto s = sealed.load(std::memory_order_relaxed);
+    if (streaming && s - consumed.load(std::memory_order_acquire) >= ring.size()) {
+        // reader is behind, the chunk is lost
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        ring[s % ring.size()].swap(current);
+        sealed.store(s + 1, std::memory_order_release);
+    }
+    current.resize(chunk_size);
+    used = 0;
+}
+
+bool trace::read(trace_chunk& chunk)
+{
+    const auto c = consumed.load(std::memory_order_relaxed);
+    if (c == sealed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    const auto& source = ring[c % ring.size()];
+    chunk.assign(source.begin(), source.end());
+    consumed.store(c + 1, std::memory_order_release);
+    return true;
+}
+
+std::vector<trace_chunk> trace::chunks() const
+{
+    const auto s = sealed.load(std::memory_order_acquire);
+    std::vector<trace_chunk> result;
+    for (auto i = s > ring.size() ? s - ring.size() : 0; i < s; ++i) {
+        result.push_back(ring[i % ring.size()]);
+    }
+    return result;
+}
+
+void decode(const trace_chunk& chunk, std::vector<trace_entry>& entries)
+{
+    reader in{chunk, 0};
+    trace_entry last{};
+    bool started = false;
+    while (in.position < chunk.size()) {
+        const auto header = chunk[in.position++];
+        trace_entry entry;
+        if (header & KEY) {
+            entry.tick = in.get();
+            entry.pc = in.get_word();
+            entry.a = in.get_word();
+            entry.d = in.get_word();
+            entry.address = (header & WRITE) ? in.get_word() : 0;
+        } else if (started) {
+            entry.tick = last.tick + 1;
+            entry.pc = (header & JUMPED) ? last.a : last.pc + 1;
+            entry.a = (header & NEW_A) ? in.get_delta(last.a) : last.a;
+            entry.d = (header & NEW_D) ? in.get_delta(last.d) : last.d;
+            entry.address = (header & WRITE) ? last.a : 0;
+        } else {
+            throw std::runtime_error("Malformed trace chunk");
+        }
+        entry.write = header & WRITE;
+        if (!entry.write) {
+            entry.value = 0;
+        } else if (header & WRITE_D) {
+            entry.value = entry.d;
+        } else {
+            entry.value = in.get_word();
+        }
+
+        entries.push_back(entry);
+        last = entry;
+        started = true;
+    }
+}
+
+void write_chunk(std::ostream& out, const trace_chunk& chunk)
+{
+    const std::uint32_t size = chunk.size();
+    const char prefix[4] = {static_cast<char>(size), static_cast<char>(size >> 8),
+                            static_cast<char>(size >> 16), static_cast<char>(size >> 24)};
+    out.write(prefix, sizeof(prefix));
+    out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+bool read_chunk(std::istream& in, trace_chunk& chunk)
+{
+    unsigned char prefix[4];
+    if (!in.read(reinterpret_cast<char*>(prefix), sizeof(prefix))) {
+        if (in.gcount() == 0) {
+            return false;
+        }
+        throw std::runtime_error("Truncated trace");
+    }
+    const std::uint32_t size = prefix[0] | prefix[1] << 8 | prefix[2] << 16
+                               | std::uint32_t{prefix[3]} << 24;
+    chunk.resize(size);
+    if (!in.read(reinterpret_cast<char*>(chunk.data()), size)) {
+        throw std::runtime_error("Truncated trace");
+    }
+    return true;
+}
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,124 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include "hcc/cpu/cpu.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace hcc {
+namespace cpu {
+
+/**
+ * One executed instruction: its address, registers after it and the RAM
+ * write it made, if any.
+ */
+struct trace_entry {
+    std::uint64_t tick; // number of instructions executed before this one
+    word pc;
+    word a;
+    word d;
+    bool write;
+    word address;
+    word value;
+};
+
+using trace_chunk = std::vector<std::uint8_t>;
+
+/**
+ * Records executed instructions into a ring of fixed size chunks.
+ *
+ * Every record is delta encoded against the previous one; most take one to
+ * three bytes. A chunk starts with a self-contained key record, so chunks
+ * can be decoded on their own, in any order and with gaps between them.
+ *
+ * Recording is done by one thread, the one running the CPU. Without a
+ * reader the oldest chunks are overwritten, so the ring keeps the tail of the
+ * run. A streaming reader may collect sealed chunks from another thread
+ * without locks; chunks are dropped, not waited for, when the reader falls
+ * behind.
+ */
+struct trace {
+    explicit trace(std::size_t chunks = 256, std::size_t chunk_size = 1 << 16,
+                   bool streaming = false);
+
+    /**
+     * Execute one instruction like CPU::step() and record it. Nothing is
+     * recorded if it throws.
+     */
+    void step(CPU& cpu, const ROM& rom, RAM& ram);
+
+    /**
+     * Execute given number of instructions, recording each of them. Runs by
+     * CPU::step(); interpreter::set_trace() records faster.
+     */
+    void run(CPU& cpu, const ROM& rom, RAM& ram, std::uint64_t ticks);
+
+    /**
+     * Record one instruction executed elsewhere: its address, A before it,
+     * registers after it and the value written into M at old_a, if any.
+     */
+    void record(word pc, word old_a, const CPU& cpu, bool write, word value);
+
+    /**
+     * Account for instructions executed without recording them.
+     */
+    void skip(std::uint64_t ticks);
+
+    /**
+     * Seal the chunk being recorded, making it visible to readers.
+     */
+    void flush();
+
+    /**
+     * Take the oldest sealed chunk not read yet, if any. Called by the
+     * streaming reader, possibly concurrently with recording.
+     */
+    bool read(trace_chunk& chunk);
+
+    /**
+     * Sealed chunks still in the ring, oldest first.
+     *
+     * @precondition not streaming, no concurrent recording
+     */
+    std::vector<trace_chunk> chunks() const;
+
+    std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<trace_chunk> ring;
+    const std::size_t chunk_size;
+    const bool streaming;
+    std::atomic<std::uint64_t> sealed{0}; // chunks published
+    std::atomic<std::uint64_t> consumed{0}; // chunks read by the streaming reader
+    std::atomic<std::uint64_t> dropped_{0};
+
+    // recorder state
+    trace_chunk current; // chunk_size bytes, used of them recorded
+    std::size_t used = 0;
+    std::uint64_t tick = 0;
+    CPU last{0, 0, 0};
+    bool resync = true; // next record is a key record
+};
+
+/**
+ * Append all entries of a chunk.
+ *
+ * @throws std::runtime_error if the chunk is malformed
+ */
+void decode(const trace_chunk& chunk, std::vector<trace_entry>& entries);
+
+/**
+ * Trace files are a sequence of chunks, each prefixed with its size as
+ * 32-bit little endian number.
+ */
+void write_chunk(std::ostream& out, const trace_chunk& chunk);
+bool read_chunk(std::istream& in, trace_chunk& chunk);
+
+} // namespace cpu {
+} // namespace hcc {
@@ -0,0 +1,285 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/cpu/trace.h"
+#include "hcc/cpu/instruction.h"
+#include "hcc/cpu/interpreter.h"
+#include "hcc/cpu/testing.h"
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace hcc::cpu;
+using namespace hcc::instruction;
+
+// loop: @0; M=M+1; @loop; 0;JMP
+ROM counter_rom()
+{
+    ROM rom;
+    rom[0] = 0;
+    rom[1] = COMPUTE | RESERVED | DEST_M | COMP_M_PLUS_ONE;
+    rom[2] = 0;
+    rom[3] = COMPUTE | RESERVED | COMP_ZERO | JMP;
+    return rom;
+}
+
+// Entries of a run done by CPU::step(), until it ends or faults.
+std::vector<trace_entry> reference(const ROM& rom, std::uint64_t ticks)
+{
+    std::vector<trace_entry> entries;
+    std::unique_ptr<RAM> ram{new RAM()};
+    CPU cpu;
+    cpu.reset();
+    try {
+        for (std::uint64_t tick = 0; tick < ticks; ++tick) {
+            const word pc = cpu.pc;
+            const word a = cpu.a;
+            const bool write = (rom.at(pc) & COMPUTE) && (rom.at(pc) & DEST_M);
+            cpu.step(rom, *ram);
+            entries.push_back({tick, pc, cpu.a, cpu.d, write, write ? a : word{0},
+                               write ? (*ram)[a] : word{0}});
+        }
+    } catch (const std::out_of_range&) {
+    }
+    return entries;
+}
+
+std::uint64_t traced(trace& t, const ROM& rom, std::uint64_t ticks)
+{
+    std::unique_ptr<RAM> ram{new RAM()};
+    CPU cpu;
+    cpu.reset();
+    std::uint64_t done = 0;
+    try {
+        for (; done < ticks; ++done) {
+            t.step(cpu, rom, *ram);
+        }
+    } catch (const std::out_of_range&) {
+    }
+    t.flush();
+    return done;
+}
+
+void assert_equal(const trace_entry& expected, const trace_entry& actual)
+{
+    assert(expected.tick == actual.tick);
+    assert(expected.pc == actual.pc);
+    assert(expected.a == actual.a);
+    assert(expected.d == actual.d);
+    assert(expected.write == actual.write);
+    assert(expected.address == actual.address);
+    assert(expected.value == actual.value);
+}
+
+void test_round_trip()
+{
+    std::mt19937 generator{42};
+    for (int i = 0; i < 10; ++i) {
+        const auto rom = testing::random_storing_rom(generator);
+        const auto expected = reference(rom, 100000);
+
+        // small chunks, to get many key records
+        trace t{100000, 64};
+        assert(traced(t, rom, 100000) == expected.size());
+        std::vector<trace_entry> actual;
+        for (const auto& chunk : t.chunks()) {
+            assert(chunk.size() <= 64);
+            decode(chunk, actual);
+        }
+        assert(actual.size() == expected.size());
+        for (std::size_t j = 0; j < expected.size(); ++j) {
+            assert_equal(expected[j], actual[j]);
+        }
+    }
+}
+
+// The interpreter records the same, in chunks of random size which end
+// blocks early, through fused instructions and up to a fault.
+void test_interpreter()
+{
+    std::mt19937 generator{4242};
+    std::uniform_int_distribution<int> chunk(1, 200);
+    for (int i = 0; i < 20; ++i) {
+        const auto rom = (i % 2) ? testing::random_rom(generator)
+                                 : testing::random_storing_rom(generator);
+        const auto expected = reference(rom, 20000);
+
+        trace t{100000, 256};
+        interpreter interp{rom};
+        interp.set_trace(&t);
+        std::unique_ptr<RAM> ram{new RAM()};
+        CPU cpu;
+        cpu.reset();
+        try {
+            for (int done = 0; done < 20000;) {
+                const int ticks = std::min(chunk(generator), 20000 - done);
+                interp.run(cpu, *ram, ticks);
+                done += ticks;
+            }
+        } catch (const std::out_of_range&) {
+        }
+        t.flush();
+
+        std::vector<trace_entry> actual;
+        for (const auto& chunk : t.chunks()) {
+            decode(chunk, actual);
+        }
+        assert(actual.size() == expected.size());
+        for (std::size_t j = 0; j < expected.size(); ++j) {
+            assert_equal(expected[j], actual[j]);
+        }
+    }
+}
+
+// Only the tail of the run is kept.
+void test_ring()
+{
+    const auto rom = counter_rom();
+    const auto expected = reference(rom, 200000);
+
+    trace t{4, 256};
+    traced(t, rom, 200000);
+    const auto chunks = t.chunks();
+    assert(chunks.size() == 4);
+    std::vector<trace_entry> actual;
+    for (const auto& chunk : chunks) {
+        decode(chunk, actual);
+    }
+    assert(actual.size() < expected.size());
+    const auto skipped = expected.size() - actual.size();
+    for (std::size_t j = 0; j < actual.size(); ++j) {
+        assert_equal(expected[skipped + j], actual[j]);
+    }
+}
+
+// Reader on another thread writes the trace into a file.
+void test_streaming()
+{
+    const auto rom = counter_rom();
+    const std::uint64_t ticks = 1000000;
+    const auto expected = reference(rom, ticks);
+
+    trace t{1024, 4096, true};
+    std::stringstream file;
+    std::atomic<bool> done{false};
+    std::thread reader{[&] {
+        trace_chunk chunk;
+        for (;;) {
+            const bool last = done.load();
+            while (t.read(chunk)) {
+                write_chunk(file, chunk);
+            }
+            if (last) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }};
+    traced(t, rom, ticks);
+    done = true;
+    reader.join();
+
+    std::vector<trace_entry> actual;
+    trace_chunk chunk;
+    std::size_t bytes = 0;
+    while (read_chunk(file, chunk)) {
+        decode(chunk, actual);
+        bytes += chunk.size();
+    }
+    // the reader may have fallen behind, but every entry is still right
+    assert(t.dropped() > 0 || actual.size() == ticks);
+    for (const auto& entry : actual) {
+        assert_equal(expected[entry.tick], entry);
+    }
+    // two bytes per instruction at most, here
+    assert(bytes <= 2 * actual.size());
+}
+
+// Instructions executed elsewhere only move the tick.
+void test_skip()
+{
+    const auto rom = counter_rom();
+    const auto expected = reference(rom, 20);
+    std::unique_ptr<RAM> ram{new RAM()};
+    CPU cpu;
+    cpu.reset();
+    trace t;
+    t.run(cpu, rom, *ram, 3);
+    for (int i = 0; i < 10; ++i) {
+        cpu.step(rom, *ram);
+    }
+    t.skip(10);
+    t.run(cpu, rom, *ram, 7);
+    t.flush();
+
+    std::vector<trace_entry> actual;
+    decode(t.chunks().at(0), actual);
+    assert(actual.size() == 10);
+    for (std::size_t j = 0; j < actual.size(); ++j) {
+        assert_equal(expected[j < 3 ? j : j + 10], actual[j]);
+    }
+}
+
+// Longest record there is, into the smallest chunk allowed.
+void test_longest_record()
+{
+    std::size_t chunk_size = 1;
+    for (;; ++chunk_size) {
+        try {
+            trace{1, chunk_size};
+            break;
+        } catch (const std::invalid_argument&) {
+        }
+    }
+
+    // M=D-1 at the end of ROM, with every word taking three bytes
+    ROM rom;
+    rom[0x7fff] = COMPUTE | RESERVED | DEST_M | COMP_D_MINUS_ONE;
+    std::unique_ptr<RAM> ram{new RAM()};
+    CPU cpu{0x7fff, 0x6000, 0xffff};
+    trace t{1, chunk_size};
+    t.skip(std::uint64_t{1} << 63);
+    t.step(cpu, rom, *ram);
+    t.flush();
+
+    std::vector<trace_entry> actual;
+    decode(t.chunks().at(0), actual);
+    assert(actual.size() == 1);
+    assert_equal({std::uint64_t{1} << 63, 0x7fff, 0x6000, 0xffff, true, 0x6000, 0xfffe},
+                 actual[0]);
+}
+
+void test_malformed()
+{
+    std::vector<trace_entry> entries;
+    bool thrown = false;
+    try {
+        decode(trace_chunk{0x00}, entries); // does not start with a key record
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    thrown = false;
+    try {
+        decode(trace_chunk{0x80, 0x00, 0x80}, entries); // truncated
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+int main()
+{
+    test_round_trip();
+    test_interpreter();
+    test_ring();
+    test_streaming();
+    test_skip();
+    test_longest_record();
+    test_malformed();
+}
@@ -324,6 +324,10 @@ struct Subroutine {
     VariableDeclarationList arguments;
     VariableDeclarationList variables;
     StatementList statements;
+
+    // source lines of the declaration
+    unsigned first_line{0};
+    unsigned last_line{0};
 };
 typedef std::vector<Subroutine> SubroutineList;
 
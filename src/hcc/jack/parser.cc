@@ -104,6 +104,7 @@ struct parser {
     {
         Subroutine subroutine;
         subroutine.kind = kind;
+        subroutine.first_line = t.pos.line;
 
         if (accept_token(token_type::VOID)) {
             subroutine.returnType = nullptr;
@@ -119,6 +120,7 @@ struct parser {
             parse_variable_declaration(subroutine.variables);
         }
         subroutine.statements = parse_statements();
+        subroutine.last_line = t.pos.line;
         expect_token(token_type::BRACE_RIGHT);
 
         return subroutine;
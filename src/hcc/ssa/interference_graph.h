@@ -2,6 +2,7 @@
 // See LICENSE for details
 #pragma once
 
+#include <algorithm>
 #include <boost/optional.hpp>
 #include <stack>
 #include <vector>
@@ -328,11 +328,13 @@ struct asm_writer {
     {
     }
 
-    void write(unit& u)
+    void write(unit& u, bool runtime)
     {
-        write_bootstrap();
-        write_return_helper();
-        write_call_helper();
+        if (runtime) {
+            write_bootstrap();
+            write_return_helper();
+            write_call_helper();
+        }
         for (auto& s : u.subroutines) {
             subroutine_writer sw{u, out, s.first, s.second};
             sw.write_subroutine();
@@ -413,10 +415,10 @@ private:
 
 } // namespace {
 
-void unit::translate_to_asm(assembler::program& out)
+void unit::translate_to_asm(assembler::program& out, bool runtime)
 {
     asm_writer w{out};
-    w.write(*this);
+    w.write(*this, runtime);
 }
 
 } // namespace ssa {
@@ -67,7 +67,9 @@ void subroutine_ir::recompute_dominance()
     for (auto& node : basic_blocks) {
         const auto& from = node.first;
         if (!dfs.visited()[from.index]) {
-            for (const auto& to : g.successors()[from.index]) {
+            // copy, as removing edges invalidates iterators into the set
+            const auto successors = g.successors()[from.index];
+            for (const auto& to : successors) {
                 g.remove_edge(from.index, to);
                 basic_blocks.at(from).instructions.clear();
             }
@@ -8,6 +8,24 @@ namespace {
 
 struct congruence_classes {
     std::map<argument, reg> classes;
+    std::map<reg, std::vector<reg>> members; // of each class
+
+    void add(const argument& arg, const reg& class_)
+    {
+        if (classes.emplace(arg, class_).second) {
+            members[class_].push_back(arg.get_reg());
+        }
+    }
+
+    void merge(const reg& keep, const reg& remove)
+    {
+        auto& kept = members[keep];
+        for (const auto& member : members[remove]) {
+            classes.at(member) = keep;
+            kept.push_back(member);
+        }
+        members.erase(remove);
+    }
 
     std::function<void(argument&)> replacer()
     {
@@ -48,8 +66,8 @@ void naive_copy_insertion(subroutine& s, congruence_classes& cc)
             // insert MOV after PHI
             bb.instructions.insert(++decltype(i)(i),
                                    instruction(instruction_type::MOV, {*arg, base}));
-            cc.classes.emplace(base, base);
-            cc.classes.emplace(*arg, base);
+            cc.add(base, base);
+            cc.add(*arg, base);
 
             // rename PHI's dest
             *arg++ = base;
@@ -65,7 +83,7 @@ void naive_copy_insertion(subroutine& s, congruence_classes& cc)
                 // insert MOV into worklist
                 worklist[label.get_label()].emplace_back(
                     instruction(instruction_type::MOV, {name, value}));
-                cc.classes.emplace(name, base);
+                cc.add(name, base);
 
                 // rename PHI's src
                 *arg++ = name;
@@ -142,6 +160,22 @@ bool interfere(const reg& a, const reg& b, subroutine& s)
     return intersect && differ_in_value;
 }
 
+// Determine if any member of class *a* interferes with any member of class *b*.
+//
+// Checking just the registers of the copy being coalesced is not enough: phi
+// copies of different phis may copy the same value, and merging their classes
+// would merge the phis too.
+bool classes_interfere(const congruence_classes& cc, const reg& a, const reg& b, subroutine& s)
+{
+    for (const auto& x : cc.members.at(a)) {
+        for (const auto& y : cc.members.at(b)) {
+            if (interfere(x, y, s))
+                return true;
+        }
+    }
+    return false;
+}
+
 } // namespace {
 
 // Inspired by paper
@@ -167,15 +201,14 @@ void subroutine::ssa_deconstruct()
                         if (!has_src_class && !has_dest_class) {
                             const auto r = create_reg();
                             add_debug(r, "congruence_class");
-                            cc.classes.emplace(src, r);
-                            cc.classes.emplace(dest, r);
+                            cc.add(src, r);
+                            cc.add(dest, r);
                         } else if (has_src_class && has_dest_class) {
                             auto keep_class = cc.classes.at(src);
                             auto remove_class = cc.classes.at(dest);
-                            for (auto& kv : cc.classes) {
-                                if (kv.second == remove_class)
-                                    kv.second = keep_class;
-                            }
+                            if (classes_interfere(cc, keep_class, remove_class, *this))
+                                continue;
+                            cc.merge(keep_class, remove_class);
                         }
                     }
                 }
@@ -517,7 +517,8 @@ struct unit {
 
     void load(std::istream&);
     void save(std::ostream&);
-    void translate_to_asm(hcc::assembler::program&);
+    // runtime is the bootstrap and the call and return helpers, needed once per program
+    void translate_to_asm(hcc::assembler::program&, bool runtime = true);
     void translate_from_jack(const hcc::jack::Class&);
 };
 
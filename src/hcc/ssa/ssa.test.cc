@@ -0,0 +1,90 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/assembler/asm.h"
+#include "hcc/cpu/cpu.h"
+#include "hcc/jack/ast.h"
+#include "hcc/jack/parser.h"
+#include "hcc/jack/tokenizer.h"
+#include "hcc/ssa/ssa.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+
+using namespace hcc::cpu;
+
+// Compile a program of one class, as hcc does, and run it until it stores
+// 1 into 2999.
+std::unique_ptr<RAM> run(const std::string& source)
+{
+    std::istringstream input{source};
+    hcc::jack::tokenizer tokens{std::istreambuf_iterator<char>(input),
+                                std::istreambuf_iterator<char>()};
+    hcc::ssa::unit u;
+    u.translate_from_jack(parse(tokens));
+    for (auto& subroutine_entry : u.subroutines) {
+        auto& subroutine = subroutine_entry.second;
+        subroutine.dead_code_elimination();
+        subroutine.copy_propagation();
+        subroutine.dead_code_elimination();
+        subroutine.ssa_deconstruct();
+        subroutine.allocate_registers();
+    }
+    hcc::assembler::program out;
+    u.translate_to_asm(out);
+    out.local_optimization();
+    out.global_optimization();
+    const auto code = out.assemble();
+
+    ROM rom;
+    std::copy(code.begin(), code.end(), rom.begin());
+    std::unique_ptr<RAM> ram{new RAM()};
+    CPU cpu;
+    cpu.reset();
+    for (int ticks = 0; (*ram)[2999] != 1; ++ticks) {
+        assert(ticks < 1000000);
+        cpu.step(rom, *ram);
+    }
+    return ram;
+}
+
+// Phi copies of a and b read the same value of x. Their congruence classes
+// must not be merged, which would put a and b into one register.
+void test_phis_copying_same_value()
+{
+    const auto ram = run(R"(
+class Sys {
+    function void init() {
+        var Array memory;
+        var int x, a, b, i;
+        let x = 1;
+        while (i < 3) {
+            let a = x;
+            let b = x;
+            while (a < 10) {
+                let a = a + 1;
+                let b = b + 2;
+            }
+            let x = a + b;
+            let i = i + 1;
+        }
+        let memory = 0;
+        let memory[3000] = x;
+        let memory[2999] = 1;
+        while (true) {
+        }
+        return;
+    }
+}
+)");
+    // 1 becomes 10 + 19, then doubles twice
+    assert((*ram)[3000] == 116);
+}
+
+int main()
+{
+    test_phis_copying_same_value();
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/util/mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hcc {
+namespace util {
+
+mapped_file::mapped_file(const std::string& filename)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode)) {
+        is_open = true;
+        length = status.st_size;
+    }
+    if (is_open && length > 0) {
+        void* const mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            is_open = false;
+            length = 0;
+        } else {
+            address = static_cast<const char*>(mapping);
+            madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+}
+
+mapped_file::~mapped_file()
+{
+    if (address) {
+        munmap(const_cast<char*>(address), length);
+    }
+}
+
+} // namespace util {
+} // namespace hcc {
@@ -0,0 +1,36 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace hcc {
+namespace util {
+
+/**
+ * Read-only mapping of a whole file into memory, for parsers which would
+ * otherwise copy it through a stream. Empty files have no mapping, so data is
+ * nullptr for them.
+ */
+struct mapped_file {
+    explicit mapped_file(const std::string& filename);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // the file is a regular file, and was mapped
+    bool opened() const { return is_open; }
+
+    const char* data() const { return address; }
+    std::size_t size() const { return length; }
+
+private:
+    bool is_open = false;
+    const char* address = nullptr;
+    std::size_t length = 0;
+};
+
+} // namespace util {
+} // namespace hcc {
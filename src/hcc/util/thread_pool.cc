@@ -0,0 +1,83 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#include "hcc/util/thread_pool.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace hcc {
+namespace util {
+
+thread_pool::thread_pool(unsigned int threads_)
+    : threads(threads_ ? threads_ : std::max(1u, std::thread::hardware_concurrency()))
+{
+    for (unsigned int i = 0; i < threads; ++i) {
+        queues.emplace_back(new queue());
+    }
+}
+
+void thread_pool::run(std::vector<job> jobs)
+{
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        queues[i % threads]->jobs.emplace_back(std::move(jobs[i]));
+    }
+    error = nullptr;
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; ++i) {
+        workers.emplace_back([this, i] { work(i); });
+    }
+    work(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool thread_pool::take(unsigned int worker, job& out)
+{
+    {
+        auto& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            out = std::move(own.jobs.front());
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // steal
+    for (unsigned int i = 1; i < threads; ++i) {
+        auto& other = *queues[(worker + i) % threads];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.jobs.empty()) {
+            out = std::move(other.jobs.back());
+            other.jobs.pop_back();
+            return true;
+        }
+    }
+
+    // no jobs are added while running, so everything is taken
+    return false;
+}
+
+void thread_pool::work(unsigned int worker)
+{
+    job current;
+    while (take(worker, current)) {
+        try {
+            current();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+}
+
+} // namespace util {
+} // namespace hcc {
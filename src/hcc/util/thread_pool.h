@@ -0,0 +1,53 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace hcc {
+namespace util {
+
+/**
+ * Runs a batch of independent jobs on a fixed number of threads. Jobs are
+ * dealt out to per-thread queues; each thread takes jobs from the front of
+ * its own queue and, once it runs dry, steals from the back of the others,
+ * so that a few long jobs do not leave the remaining threads idle.
+ */
+struct thread_pool {
+    using job = std::function<void()>;
+
+    /**
+     * Zero threads means one per hardware thread.
+     */
+    explicit thread_pool(unsigned int threads = 0);
+
+    unsigned int size() const { return threads; }
+
+    /**
+     * Run all jobs and wait for them to finish. If any job throws, the
+     * remaining jobs are still run and the first exception is rethrown.
+     */
+    void run(std::vector<job> jobs);
+
+private:
+    struct queue {
+        std::mutex mutex;
+        std::deque<job> jobs;
+    };
+
+    bool take(unsigned int worker, job& out);
+    void work(unsigned int worker);
+
+    unsigned int threads;
+    std::vector<std::unique_ptr<queue>> queues;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+} // namespace util {
+} // namespace hcc {
@@ -0,0 +1,92 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/util/thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using hcc::util::thread_pool;
+
+void test_every_job_runs_once()
+{
+    for (unsigned int threads = 1; threads <= 8; ++threads) {
+        thread_pool pool{threads};
+        assert(pool.size() == threads);
+
+        std::vector<std::atomic<int>> counters(1000);
+        std::vector<thread_pool::job> jobs;
+        for (auto& counter : counters) {
+            counter = 0;
+            jobs.emplace_back([&counter] { ++counter; });
+        }
+        pool.run(std::move(jobs));
+        for (const auto& counter : counters) {
+            assert(counter == 1);
+        }
+    }
+}
+
+// Long jobs all land in the first queue, the other threads must steal them.
+void test_stealing()
+{
+    const unsigned int threads = 4;
+    thread_pool pool{threads};
+    std::mutex mutex;
+    std::vector<std::thread::id> ids;
+    std::vector<thread_pool::job> jobs;
+    for (unsigned int i = 0; i < 4 * threads; ++i) {
+        if (i % threads == 0) {
+            jobs.emplace_back([&] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                std::lock_guard<std::mutex> lock(mutex);
+                ids.push_back(std::this_thread::get_id());
+            });
+        } else {
+            jobs.emplace_back([] {});
+        }
+    }
+    pool.run(std::move(jobs));
+    assert(ids.size() == 4);
+    std::sort(ids.begin(), ids.end());
+    assert(std::unique(ids.begin(), ids.end()) - ids.begin() > 1);
+}
+
+void test_exception()
+{
+    thread_pool pool{3};
+    std::atomic<int> counter{0};
+    std::vector<thread_pool::job> jobs;
+    for (int i = 0; i < 100; ++i) {
+        jobs.emplace_back([&counter, i] {
+            ++counter;
+            if (i == 50) {
+                throw std::runtime_error("job failed");
+            }
+        });
+    }
+
+    bool thrown = false;
+    try {
+        pool.run(std::move(jobs));
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(counter == 100);
+
+    // the pool is usable again
+    pool.run({[&counter] { ++counter; }});
+    assert(counter == 101);
+}
+
+int main()
+{
+    test_every_job_runs_once();
+    test_stealing();
+    test_exception();
+}
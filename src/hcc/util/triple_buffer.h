@@ -0,0 +1,55 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace hcc {
+namespace util {
+
+/**
+ * Hands values over from one writer thread to one reader thread without
+ * locks. The writer fills the back buffer and publishes it; the reader picks
+ * up the most recently published buffer, skipping any it was too slow for.
+ * Neither side ever waits for the other, and neither sees a buffer while the
+ * other one is using it.
+ */
+template <typename T>
+struct triple_buffer {
+    /**
+     * Writer side: buffer to be filled, then published.
+     */
+    T& back() { return buffers[back_index]; }
+    void publish()
+    {
+        back_index = state.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /**
+     * Reader side: pick up the latest published buffer, if there is one.
+     *
+     * @return true if front() changed
+     */
+    bool update()
+    {
+        if (!(state.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        front_index = state.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& front() const { return buffers[front_index]; }
+
+private:
+    static const unsigned int INDEX = 3;
+    static const unsigned int FRESH = 4;
+
+    std::array<T, 3> buffers{};
+    unsigned int back_index = 0; // owned by the writer
+    std::atomic<unsigned int> state{1}; // index of the middle buffer, and whether it is fresh
+    unsigned int front_index = 2; // owned by the reader
+};
+
+} // namespace util {
+} // namespace hcc {
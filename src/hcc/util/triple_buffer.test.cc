@@ -0,0 +1,74 @@
+// Copyright (c) 2012-2018 Dano Pernis
+// See LICENSE for details
+
+#include "hcc/util/triple_buffer.h"
+#include <cassert>
+#include <thread>
+
+using hcc::util::triple_buffer;
+
+struct frame {
+    unsigned int sequence;
+    unsigned int payload[255];
+};
+
+void test_single_thread()
+{
+    triple_buffer<int> buffer;
+    assert(!buffer.update());
+    assert(buffer.front() == 0);
+
+    buffer.back() = 1;
+    buffer.publish();
+    assert(buffer.update());
+    assert(buffer.front() == 1);
+    assert(!buffer.update());
+
+    // only the latest one is seen
+    buffer.back() = 2;
+    buffer.publish();
+    buffer.back() = 3;
+    buffer.publish();
+    assert(buffer.update());
+    assert(buffer.front() == 3);
+    assert(!buffer.update());
+    assert(buffer.front() == 3);
+}
+
+// The reader always sees whole frames, in order.
+void test_threads()
+{
+    const unsigned int frames = 100000;
+    triple_buffer<frame> buffer;
+
+    std::thread writer([&] {
+        for (unsigned int i = 1; i <= frames; ++i) {
+            auto& f = buffer.back();
+            f.sequence = i;
+            for (auto& word : f.payload) {
+                word = i;
+            }
+            buffer.publish();
+        }
+    });
+
+    unsigned int last = 0;
+    while (last < frames) {
+        if (!buffer.update()) {
+            continue;
+        }
+        const auto& f = buffer.front();
+        assert(f.sequence > last);
+        for (const auto word : f.payload) {
+            assert(word == f.sequence);
+        }
+        last = f.sequence;
+    }
+    writer.join();
+}
+
+int main()
+{
+    test_single_thread();
+    test_threads();
+}
@@ -3,6 +3,7 @@
 
 #include "hcc/assembler/asm.h"
 #include "hcc/cpu/cpu.h"
+#include "hcc/cpu/jit.h"
 #include "hcc/jack/ast.h"
 #include "hcc/jack/parser.h"
 #include "hcc/jack/tokenizer.h"
@@ -45,6 +46,16 @@ struct driver {
         for (int i = 0; i < ticks; ++i) {
             cpu.step(rom, ram);
         }
+
+        // JIT must give the same results
+        hcc::cpu::CPU jit_cpu;
+        jit_cpu.reset();
+        hcc::cpu::RAM jit_ram;
+        hcc::cpu::jit{rom}.run(jit_cpu, jit_ram, ticks);
+        assert(jit_cpu.pc == cpu.pc);
+        assert(jit_cpu.a == cpu.a);
+        assert(jit_cpu.d == cpu.d);
+        assert(jit_ram == ram);
     }
 
     hcc::cpu::RAM ram;